@@ -304,6 +304,19 @@ void Label(const char *text, float ysize);
 /// the label in this case.
 void Label(const char *text, float ysize, const mathfu::vec2 &size);
 
+/// @brief Render a label whose text changes frequently, such as a timer or a
+/// frame rate counter, as a GUI element.
+///
+/// Unlike `Label()`, the layout of the label is kept per ID instead of per
+/// text, and updated in place when the text changes.
+///
+/// @param[in] text A C-string in UTF-8 format to be displayed as the label.
+/// @param[in] ysize A float containing the vertical size in virtual resolution.
+/// @param[in] id A C-string containing the unique ID of the label.
+///
+/// @note The x-size will be derived automatically based on the text length.
+void DynamicLabel(const char *text, float ysize, const char *id);
+
 /// @brief Set the Label's text color.
 ///
 /// @param[in] color A vec4 representing the RGBA values that the text color
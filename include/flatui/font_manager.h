@@ -24,17 +24,35 @@
 #define FLATUI_USE_LIBUNIBREAK 1
 #endif  // !defined(FLATUI_USE_LIBUNIBREAK)
 
+// Eviction policy of the glyph cache, one of the policies in
+// glyph_cache_eviction.h.
+#if !defined(FLATUI_GLYPH_CACHE_EVICTION_POLICY)
+#define FLATUI_GLYPH_CACHE_EVICTION_POLICY LruEvictionPolicy
+#endif  // !defined(FLATUI_GLYPH_CACHE_EVICTION_POLICY)
+
+// Shape text laid out without harfbuzz with harfbuzz as well, and assert that
+// the layouts are identical.
+#if !defined(FLATUI_VALIDATE_SIMPLE_LAYOUT)
+#define FLATUI_VALIDATE_SIMPLE_LAYOUT 0
+#endif  // !defined(FLATUI_VALIDATE_SIMPLE_LAYOUT)
+
 #include "fplbase/renderer.h"
+#include "flatui/internal/distance_field.h"
 #include "flatui/internal/glyph_cache.h"
+#include "flatui/internal/glyph_rasterizer.h"
+#include "flatui/internal/layout_cache.h"
+#include "flatui/internal/shaping_cache.h"
+#include "flatui/internal/flat_hash_map.h"
 #include "flatui/internal/flatui_util.h"
 
 // Forward decls for FreeType & Harfbuzz
 typedef struct FT_LibraryRec_ *FT_Library;
 typedef struct FT_FaceRec_ *FT_Face;
 typedef struct FT_GlyphSlotRec_ *FT_GlyphSlot;
+typedef struct FT_SizeRec_ *FT_Size;
 struct hb_font_t;
 struct hb_buffer_t;
-struct hb_glyph_info_t;
+struct hb_language_impl_t;
 /// @endcond
 
 namespace flatui {
@@ -65,13 +83,122 @@ const int32_t kFreeTypeUnit = 64;
 /// @var kGlyphCacheWidth
 ///
 /// @brief The Default size of the glyph cache width.
+///
+/// The default glyph cache starts with `kGlyphCacheInitialWidth` and grows up
+/// to the width.
 const int32_t kGlyphCacheWidth = 1024;
 
 /// @var kGlyphCacheHeight
 ///
 /// @brief The default size of the glyph cache height.
+///
+/// The default glyph cache starts with `kGlyphCacheInitialHeight` and grows up
+/// to the height.
 const int32_t kGlyphCacheHeight = 1024;
 
+/// @var kGlyphCacheInitialWidth
+///
+/// @brief The initial width of the default glyph cache.
+const int32_t kGlyphCacheInitialWidth = 256;
+
+/// @var kGlyphCacheInitialHeight
+///
+/// @brief The initial height of the default glyph cache.
+const int32_t kGlyphCacheInitialHeight = 256;
+
+/// @var kGlyphCacheMaxPages
+///
+/// @brief The default maximum number of glyph cache pages.
+///
+/// Each page is a separate atlas texture of the glyph cache size. Additional
+/// pages are allocated only when the glyphs used in a frame don't fit in the
+/// allocated pages.
+const int32_t kGlyphCacheMaxPages = 4;
+
+/// @var kSDFSpread
+///
+/// @brief The distance range of signed distance field glyphs in pixels at the
+/// reference size. Glyph images are padded by the range on each side.
+const int32_t kSDFSpread = 4;
+
+/// @var kSDFMinReferenceSize
+///
+/// @brief The smallest reference size of signed distance field glyphs.
+///
+/// In the SDF mode, glyphs are rasterized at a power of 2 reference size
+/// between `kSDFMinReferenceSize` and `kSDFMaxReferenceSize` that is equal to
+/// or larger than the requested size, and scaled down when rendered. Bigger
+/// sizes are scaled up from `kSDFMaxReferenceSize`.
+const int32_t kSDFMinReferenceSize = 32;
+
+/// @var kSDFMaxReferenceSize
+///
+/// @brief The largest reference size of signed distance field glyphs.
+const int32_t kSDFMaxReferenceSize = 128;
+
+/// @var kGlyphRasterizerMinBatch
+///
+/// @brief The minimum number of glyphs missing in the glyph cache for a
+/// FontBuffer to be rasterized on the rasterizer threads.
+///
+/// Fewer glyphs are rasterized on the calling thread, as waking the threads
+/// costs more than they save.
+const int32_t kGlyphRasterizerMinBatch = 8;
+
+/// @var kFaceSizeCacheCapacity
+///
+/// @brief The number of pixel sizes a font face keeps scaled.
+///
+/// Switching to one of the sizes used most recently doesn't scale the font
+/// face again. See `FaceData::SetSize()`.
+const size_t kFaceSizeCacheCapacity = 8;
+
+/// @var kShapingCacheBudget
+///
+/// @brief The default memory budget of the shaping cache in bytes.
+///
+/// Text runs shaped by harfbuzz are cached within the budget, so that layouts
+/// of the same words don't shape them again.
+const size_t kShapingCacheBudget = 256 * 1024;
+
+/// @var kBufferCacheBudget
+///
+/// @brief The default memory budget of FontBuffers cached by
+/// `FontManager::GetBuffer()` in bytes.
+///
+/// Least recently used buffers are evicted when a frame starts and the
+/// buffers exceed the budget. Buffers used in the current frame are kept.
+const size_t kBufferCacheBudget = 4 * 1024 * 1024;
+
+/// @var kTextureCacheBudget
+///
+/// @brief The default memory budget of FontTextures cached by
+/// `FontManager::GetTexture()` in bytes, evicted as FontBuffers.
+const size_t kTextureCacheBudget = 4 * 1024 * 1024;
+
+/// @var kLayoutCacheMaxAge
+///
+/// @brief The default number of frames a cached FontBuffer or FontTexture is
+/// kept while it's not used.
+const uint32_t kLayoutCacheMaxAge = 600;
+
+/// @var kMeasurementCacheCapacity
+///
+/// @brief The maximum number of text measurements cached by
+/// `FontManager::MeasureText()`.
+///
+/// The cache is cleared when it is full.
+const size_t kMeasurementCacheCapacity = 1024;
+
+/// @var kGlyphMetricsCacheCapacity
+///
+/// @brief The maximum number of glyph metrics kept by FontManager.
+///
+/// Metrics of glyphs are kept apart from the glyph cache, so that layouts
+/// don't load glyphs again once their metrics are known. The metrics are
+/// cleared when the capacity is reached.
+const size_t kGlyphMetricsCacheCapacity = 16384;
+
 /// @var kLineHeightDefault
 ///
 /// @brief Default value for a line height factor.
@@ -104,7 +231,7 @@ enum TextLayoutDirection {
 /// @class FontBufferParameters
 ///
 /// @brief This class that includes font buffer parameters. It is used as a key
-/// in the unordered_map to look up FontBuffer.
+/// in the hash map to look up FontBuffer.
 class FontBufferParameters {
  public:
   /// @brief The default constructor for an empty FontBufferParameters.
@@ -113,7 +240,11 @@ class FontBufferParameters {
         text_id_(kNullHash),
         font_size_(0),
         size_(mathfu::kZeros2i),
-        caret_info_(false) {}
+        caret_info_(false),
+        layout_direction_(TextLayoutDirectionLTR),
+        script_(0),
+        language_id_(kNullHash),
+        line_height_(0.0f) {}
 
   /// @brief Constructor for a FontBufferParameters.
   ///
@@ -123,6 +254,9 @@ class FontBufferParameters {
   /// @param[in] size The size of the FontBuffer.
   /// @param[in] caret_info A bool determining if the font buffer contains caret
   /// info.
+  ///
+  /// @note FontManager sets the layout settings of the parameters (see
+  /// `SetLayoutSettings()`) when it looks up a layout.
   FontBufferParameters(const HashedId font_id, const HashedId text_id,
                        float font_size, const mathfu::vec2i &size,
                        bool caret_info) {
@@ -131,6 +265,10 @@ class FontBufferParameters {
     font_size_ = font_size;
     size_ = size;
     caret_info_ = caret_info;
+    layout_direction_ = TextLayoutDirectionLTR;
+    script_ = 0;
+    language_id_ = kNullHash;
+    line_height_ = 0.0f;
   }
 
   /// @brief The equal-to operator for comparing FontBufferParameters for
@@ -144,7 +282,10 @@ class FontBufferParameters {
   bool operator==(const FontBufferParameters &other) const {
     return (font_id_ == other.font_id_ && text_id_ == other.text_id_ &&
             font_size_ == other.font_size_ && size_.x() == other.size_.x() &&
-            size_.y() == other.size_.y() && caret_info_ == other.caret_info_);
+            size_.y() == other.size_.y() && caret_info_ == other.caret_info_ &&
+            layout_direction_ == other.layout_direction_ &&
+            script_ == other.script_ && language_id_ == other.language_id_ &&
+            line_height_ == other.line_height_);
   }
 
   /// @brief The hash function for FontBufferParameters.
@@ -154,18 +295,31 @@ class FontBufferParameters {
   ///
   /// @return Returns a `size_t` of the hash of the FontBufferParameters.
   size_t operator()(const FontBufferParameters &key) const {
-    // Note that font_id_ and text_id_ are already hashed values.
-    size_t value = (font_id_ ^ (text_id_ << 1)) >> 1;
-    value = value ^ (std::hash<float>()(key.font_size_) << 1) >> 1;
-    value = value ^ (std::hash<bool>()(key.caret_info_) << 1) >> 1;
-    value = value ^ (std::hash<int32_t>()(key.size_.x()) << 1) >> 1;
-    value = value ^ (std::hash<int32_t>()(key.size_.y()) << 1) >> 1;
+    // Note that font_id_ and text_id_ are already hashed values, but all the
+    // fields are mixed so that the lower bits of the value are well
+    // distributed.
+    auto value = HashCombine(HashMix(key.font_id_), key.text_id_);
+    value = HashCombine(
+        value, static_cast<uint32_t>(std::hash<float>()(key.font_size_)));
+    value = HashCombine(value, key.caret_info_);
+    value = HashCombine(value, key.size_.x());
+    value = HashCombine(value, key.size_.y());
+    value = HashCombine(value, static_cast<int32_t>(key.layout_direction_));
+    value = HashCombine(value, key.script_);
+    value = HashCombine(value, key.language_id_);
+    value = HashCombine(
+        value, static_cast<uint32_t>(std::hash<float>()(key.line_height_)));
     return value;
   }
 
   /// @return Returns a hash value of the text.
   HashedId get_text_id() const { return text_id_; }
 
+  /// @brief Set the hash value of the text.
+  ///
+  /// @param[in] text_id The HashedId for the text.
+  void set_text_id(const HashedId text_id) { text_id_ = text_id; }
+
   /// @return Returns the size value.
   const mathfu::vec2i &get_size() const { return size_; }
 
@@ -175,12 +329,118 @@ class FontBufferParameters {
   /// @return Returns a flag to indicate if the buffer has caret info.
   bool get_caret_info_flag() const { return caret_info_; }
 
+  /// @brief Set the layout settings of the text, so that layouts of different
+  /// settings are cached apart.
+  ///
+  /// @param[in] direction The layout direction.
+  /// @param[in] script The harfbuzz script tag.
+  /// @param[in] language_id The HashedId of the locale.
+  /// @param[in] line_height The line height of a multi-line text.
+  void SetLayoutSettings(const TextLayoutDirection direction,
+                         const uint32_t script, const HashedId language_id,
+                         const float line_height) {
+    layout_direction_ = direction;
+    script_ = script;
+    language_id_ = language_id;
+    line_height_ = line_height;
+  }
+
  private:
   HashedId font_id_;
   HashedId text_id_;
   float font_size_;
   mathfu::vec2i size_;
   bool caret_info_;
+  TextLayoutDirection layout_direction_;
+  uint32_t script_;
+  HashedId language_id_;
+  float line_height_;
+};
+
+/// @struct FontManagerCounters
+///
+/// @brief Event counters of FontManager and its glyph cache.
+struct FontManagerCounters {
+  FontManagerCounters()
+      : glyph_hits(0),
+        glyph_misses(0),
+        rasterizations(0),
+        evictions(0),
+        evicted_glyphs(0),
+        evicted_recent_glyphs(0),
+        flushes(0),
+        subpasses(0),
+        uploaded_bytes(0),
+        face_resizes(0),
+        face_resizes_avoided(0),
+        shaping_hits(0),
+        shaping_misses(0),
+        simple_layouts(0),
+        buffer_evictions(0),
+        texture_evictions(0) {}
+
+  /// @brief Glyph look ups that found the glyph in the glyph cache.
+  uint64_t glyph_hits;
+  /// @brief Glyph look ups that missed the glyph cache.
+  uint64_t glyph_misses;
+  /// @brief Glyphs rasterized by FreeType.
+  uint64_t rasterizations;
+  /// @brief Glyph cache rows (or glyphs with the skyline and guillotine
+  /// packers) evicted to make room for new glyphs.
+  uint64_t evictions;
+  /// @brief Glyphs evicted from the glyph cache.
+  uint64_t evicted_glyphs;
+  /// @brief Evicted glyphs that had been used in recent frames. A high ratio
+  /// to `evicted_glyphs` means the glyph cache is thrashing.
+  uint64_t evicted_recent_glyphs;
+  /// @brief Full flushes of the glyph cache.
+  uint64_t flushes;
+  /// @brief Subpasses started because the glyph cache was full.
+  uint64_t subpasses;
+  /// @brief Bytes uploaded to the atlas textures.
+  uint64_t uploaded_bytes;
+  /// @brief Font face size changes that scaled the face.
+  uint64_t face_resizes;
+  /// @brief Font face size changes served by a scaled size of the face.
+  uint64_t face_resizes_avoided;
+  /// @brief Text runs found in the shaping cache.
+  uint64_t shaping_hits;
+  /// @brief Text runs missing the shaping cache, which were laid out.
+  uint64_t shaping_misses;
+  /// @brief Text runs laid out without harfbuzz, see
+  /// `FaceData::BuildSimpleLayout()`.
+  uint64_t simple_layouts;
+  /// @brief FontBuffers evicted from the buffer cache.
+  uint64_t buffer_evictions;
+  /// @brief FontTextures evicted from the texture cache.
+  uint64_t texture_evictions;
+};
+
+/// @struct FontManagerStats
+///
+/// @brief Usage statistics of FontManager, returned by
+/// `FontManager::GetStats()`.
+struct FontManagerStats {
+  /// @brief Counters of the last frame, from a `StartLayoutPass()` call to the
+  /// next one.
+  FontManagerCounters frame;
+  /// @brief Counters since the FontManager is created.
+  FontManagerCounters total;
+  /// @brief Percentage of the glyph cache area occupied by glyphs.
+  float occupancy_percent;
+  /// @brief Percentage of the free glyph cache area that is not usable by the
+  /// largest free block. 0 means the free area is not fragmented.
+  float fragmentation_percent;
+  /// @brief Number of pinned glyphs.
+  int32_t pinned_glyphs;
+  /// @brief Percentage of the glyph cache area occupied by pinned glyphs.
+  float pinned_percent;
+  /// @brief Number of cached FontBuffers and the memory they use in bytes.
+  int32_t cached_buffers;
+  size_t buffer_cache_bytes;
+  /// @brief Number of cached FontTextures and the memory they use in bytes.
+  int32_t cached_textures;
+  size_t texture_cache_bytes;
 };
 
 /// @class FontManager
@@ -204,7 +464,11 @@ class FontManager {
   /// used as an OpenGL texture sizes.
   ///
   /// @param[in] cache_size The size of the cache, in pixels.
-  FontManager(const mathfu::vec2i &cache_size);
+  /// @param[in] packing The packing strategy used to place glyphs in the
+  /// glyph cache. The skyline and guillotine packers pack glyphs of mixed
+  /// sizes tighter than the default row allocator.
+  FontManager(const mathfu::vec2i &cache_size,
+              GlyphCachePacking packing = kGlyphCachePackingRow);
 
   /// @brief The destructor for FontManager.
   ~FontManager();
@@ -249,11 +513,18 @@ class FontManager {
   /// font texture is used for a long time, such as a string image used in game
   /// HUD.
   ///
+  /// @note Textures are cached within the budget of `SetLayoutCacheBudget()`
+  /// and for `SetLayoutCacheMaxAge()` frames. The returned pointer is valid
+  /// until the next `StartLayoutPass()` only, call this API each frame the
+  /// texture is rendered. A call with a cached text is a hash look up, and
+  /// keeps the texture from being evicted.
+  ///
   /// @param[in] text A C-string in UTF-8 format with the text for the texture.
   /// @param[in] length The length of the text string.
   /// @param[in] ysize The height of the texture.
   ///
-  /// @return Returns a pointer to the FontTexture.
+  /// @return Returns a pointer to the FontTexture, valid until the next
+  /// `StartLayoutPass()`.
   FontTexture *GetTexture(const char *text, const uint32_t length,
                           const float ysize);
 
@@ -265,12 +536,69 @@ class FontManager {
   /// @param[in] parameters The FontBufferParameters specifying the parameters
   /// for the FontBuffer.
   ///
-  /// @return Returns `nullptr` if the string does not fit in the glyph cache.
+  /// @return Returns the FontBuffer, valid until the next `StartLayoutPass()`.
+  /// Returns `nullptr` if the string does not fit in the glyph cache
+  /// even after allocating all the glyph cache pages allowed.
   ///  When this happens, caller may flush the glyph cache with
   /// `FlushAndUpdate()` call and re-try the `GetBuffer()` call.
   FontBuffer *GetBuffer(const char *text, const size_t length,
                         const FontBufferParameters &parameters);
 
+  /// @brief Retrieve a vertex buffer of a label whose text changes
+  /// frequently, such as a timer or a frame rate counter.
+  ///
+  /// Buffers of `GetBuffer()` are cached per text, whereas the buffer of a
+  /// dynamic label is kept per label ID and laid out again in place when the
+  /// text changes, reusing its arrays. Glyphs of digits are rasterized when
+  /// the label is laid out with new font settings, and changing digits that
+  /// have the same advance (e.g. tabular digits) only rewrites the vertices
+  /// of the changed digits.
+  ///
+  /// @param[in] id The ID of the label.
+  /// @param[in] text A C-string in UTF-8 format with the text for the
+  /// FontBuffer.
+  /// @param[in] length The length of the text string.
+  /// @param[in] parameters The FontBufferParameters specifying the parameters
+  /// for the FontBuffer.
+  ///
+  /// @return Returns the FontBuffer of the label, which is valid until the
+  /// next call with the ID, `ReleaseDynamicBuffer()` or `FlushLayout()`.
+  /// Returns `nullptr` if the text does not fit in the glyph cache as
+  /// `GetBuffer()`.
+  FontBuffer *GetDynamicBuffer(const HashedId id, const char *text,
+                               const size_t length,
+                               const FontBufferParameters &parameters);
+
+  /// @brief Release the buffer of a dynamic label.
+  ///
+  /// @param[in] id The ID of the label given to `GetDynamicBuffer()`.
+  void ReleaseDynamicBuffer(const HashedId id);
+
+  /// @brief Measure a text as `GetBuffer()` would lay it out, without
+  /// rasterizing glyphs or generating vertices.
+  ///
+  /// The layout pass can measure labels with this API and defer `GetBuffer()`
+  /// calls to the render pass, so that labels which are not rendered don't
+  /// use the glyph cache.
+  ///
+  /// When the FontBuffer of the text was rendered in the last frame, the text
+  /// is likely rendered again. Its glyphs are then fetched to the glyph cache
+  /// as `GetBuffer()` does, so that they are uploaded at once by
+  /// `StartRenderPass()` rather than before each label in the render pass.
+  ///
+  /// @param[in] text A C-string in UTF-8 format with the text to measure.
+  /// @param[in] length The length of the text string.
+  /// @param[in] parameters The FontBufferParameters the text would be laid
+  /// out with.
+  /// @param[out] metrics If not `nullptr`, receives the font metrics of the
+  /// laid out text.
+  ///
+  /// @return Returns the size of the text, the same as the size of the
+  /// FontBuffer `GetBuffer()` returns with the parameters.
+  mathfu::vec2i MeasureText(const char *text, const size_t length,
+                            const FontBufferParameters &parameters,
+                            FontMetrics *metrics = nullptr);
+
   /// @brief Set the renderer to be used to create texture instances.
   ///
   /// @param[in] renderer The Renderer to set for creating textures.
@@ -295,25 +623,330 @@ class FontManager {
   /// upload cache images to the atlas texture, and use the texture in the
   /// render pass. This design helps to minimize the frequency of the atlas
   /// texture upload.
+  ///
+  /// Labels measured with `MeasureText()` get their FontBuffer in the render
+  /// pass. Glyphs of labels rendered in the last frame are fetched in the
+  /// layout pass, so the atlas is uploaded once per frame unless new labels
+  /// appear (e.g. by scrolling). Glyphs of those are uploaded by
+  /// `UpdateAtlas()` before the label is rendered.
   void StartLayoutPass();
 
   /// @brief Flush the existing glyph cache contents and start new layout pass.
   ///
   /// Call this API while in a layout pass when the glyph cache is fragmented.
+  /// In the render pass, the glyph cache is flushed without starting a
+  /// subpass, glyphs of the following buffers are uploaded by
+  /// `UpdateAtlas()`.
   void FlushAndUpdate() { UpdatePass(true); }
 
   /// @brief Flush the existing FontBuffer in the cache.
   ///
-  /// Call this API when FontBuffers are not used anymore.
-  void FlushLayout() { map_buffers_.clear(); }
+  /// Call this API when FontBuffers are not used anymore. Text measurements
+  /// and buffers of dynamic labels are flushed as well.
+  void FlushLayout();
+
+  /// @brief Upload glyphs rasterized after `StartRenderPass()` to the atlas
+  /// textures.
+  ///
+  /// Call this API in the render pass after a `GetBuffer()` call, before the
+  /// buffer is rendered. Nothing is uploaded if the buffer didn't rasterize
+  /// glyphs.
+  void UpdateAtlas();
 
   /// @brief Indicates a start of new render pass.
   ///
   /// Call the API each time the user starts a render pass.
   void StartRenderPass() { UpdatePass(false); }
 
-  /// @return Returns font atlas texture.
-  fplbase::Texture *GetAtlasTexture() { return atlas_texture_.get(); }
+  /// @param[in] page The index of the glyph cache page.
+  ///
+  /// @return Returns font atlas texture of the glyph cache page.
+  /// Returns `nullptr` if the page has not been uploaded yet.
+  fplbase::Texture *GetAtlasTexture(int32_t page = 0) {
+    return page < static_cast<int32_t>(atlas_textures_.size())
+               ? atlas_textures_[page].get()
+               : nullptr;
+  }
+
+  /// @brief Set the maximum number of glyph cache pages.
+  ///
+  /// When a glyph doesn't fit in the glyph cache and no glyph can be evicted,
+  /// the font manager allocates an additional page (and atlas texture) up to
+  /// the limit, instead of flushing the whole glyph cache.
+  ///
+  /// @param[in] max_pages The maximum number of pages. Default value is
+  /// `kGlyphCacheMaxPages`.
+  void SetGlyphCacheMaxPages(int32_t max_pages) {
+    glyph_cache_->set_max_pages(max_pages);
+  }
+
+  /// @return Returns the number of glyph cache pages currently allocated.
+  int32_t GetGlyphCachePageCount() const {
+    return glyph_cache_->get_num_pages();
+  }
+
+  /// @brief Set the maximum size of the glyph cache.
+  ///
+  /// When the glyph cache is full and recently used glyphs would need to be
+  /// evicted, the glyph cache doubles its size (copying cached glyphs, no
+  /// re-rasterization needed) up to the size, before allocating additional
+  /// pages. The glyph cache shrinks back when the glyphs used recently occupy
+  /// a small part of it. Atlas textures are reallocated when the size changes.
+  ///
+  /// @param[in] size The maximum size of the glyph cache. Rounded up to power
+  /// of 2. The default constructor uses `kGlyphCacheWidth` x
+  /// `kGlyphCacheHeight`, the constructor with a cache size uses the given
+  /// size (no growth).
+  void SetGlyphCacheMaxSize(const mathfu::vec2i &size) {
+    glyph_cache_->set_max_size(size);
+  }
+
+  /// @return Returns the current size of the glyph cache.
+  const mathfu::vec2i &GetGlyphCacheSize() const {
+    return glyph_cache_->get_size();
+  }
+
+  /// @return Returns the total number of bytes uploaded to the atlas textures.
+  ///
+  /// Only dirty regions of the glyph cache are uploaded, so the number grows
+  /// with the area of newly cached glyphs.
+  uint64_t GetAtlasUploadedBytes() const { return counters_.uploaded_bytes; }
+
+  /// @brief Retrieve usage statistics of the font manager.
+  ///
+  /// The counters are always tracked, also in release builds, and cost an
+  /// increment per event.
+  ///
+  /// @return Returns the counters of the last frame and the cumulative
+  /// counters, with the current glyph cache occupancy and fragmentation.
+  FontManagerStats GetStats() const;
+
+  /// @brief Pin a glyph in the glyph cache.
+  ///
+  /// A pinned glyph is never evicted from the glyph cache, it survives
+  /// `FlushAndUpdate()` and subpasses as well. Use it for glyphs rendered in
+  /// every frame such as digits of a HUD counter, so that a burst of other
+  /// glyphs doesn't force them to be rasterized again.
+  ///
+  /// @param[in] code_point The Unicode code point of the glyph in the current
+  /// font.
+  /// @param[in] ysize The font size in pixels the glyph is rendered with.
+  ///
+  /// @return Returns `false` if the glyph couldn't be loaded or stored.
+  bool PinGlyph(uint32_t code_point, float ysize);
+
+  /// @brief Pin all glyphs of a string in the glyph cache.
+  ///
+  /// The string is shaped with the current font and language settings, and
+  /// resulting glyphs are pinned. See `PinGlyph()`.
+  ///
+  /// @param[in] text A C-string in UTF-8 format.
+  /// @param[in] ysize The font size in pixels the string is rendered with.
+  ///
+  /// @return Returns `false` if any of the glyphs couldn't be pinned.
+  bool PinText(const char *text, float ysize);
+
+  /// @brief Unpin all pinned glyphs. They are evicted as usual afterwards.
+  void UnpinAllGlyphs() { glyph_cache_->UnpinAll(); }
+
+  /// @return Returns the glyph cache area occupied by pinned glyphs in
+  /// pixels, including paddings between glyphs.
+  int32_t GetPinnedGlyphArea() const { return glyph_cache_->GetPinnedArea(); }
+
+  /// @brief Partition the glyph cache by glyph size and font.
+  ///
+  /// A glyph belongs to the first partition whose `font_id` (`HashId()` of
+  /// the font file name, `kNullHash` for any font) and `max_glyph_size` (the
+  /// size in pixels the glyph is rasterized at, 0 for any size) match it.
+  /// Glyphs that match no partition belong to the default partition. With the
+  /// default row allocator, a row of the glyph cache only holds glyphs of a
+  /// single partition, so that small glyphs don't end up in tall rows.
+  ///
+  /// Partitions share free space. Once the glyphs of a partition occupy its
+  /// `quota` of the glyph cache, new glyphs of the partition only evict
+  /// glyphs of the same partition, so that a burst of large glyphs can't
+  /// evict the whole working set of small text.
+  ///
+  /// The glyph cache and layouts are flushed.
+  ///
+  /// @param[in] partitions Partitions in the order they are matched.
+  void SetGlyphCachePartitions(
+      const std::vector<GlyphCachePartition> &partitions);
+
+  /// @brief Retrieve usage statistics of a glyph cache partition, to tune
+  /// the quotas.
+  ///
+  /// @param[in] partition Index of the partition. 0 is the default partition,
+  /// partitions given to `SetGlyphCachePartitions()` follow from 1.
+  ///
+  /// @return Returns the number of glyphs, occupancy and evictions of the
+  /// partition.
+  GlyphCachePartitionStats GetGlyphCachePartitionStats(
+      int32_t partition) const {
+    return glyph_cache_->GetPartitionStats(partition);
+  }
+
+  /// @return Returns the number of glyph cache partitions including the
+  /// default partition.
+  int32_t GetGlyphCachePartitionCount() const {
+    return glyph_cache_->get_num_partitions();
+  }
+
+  /// @brief Save glyphs in the glyph cache to a file.
+  ///
+  /// The file is meant to be loaded with `LoadGlyphCache()` at the next launch
+  /// on the same device, so that the first frames don't need to rasterize the
+  /// glyphs again. The file includes a hash of the contents of each opened
+  /// font.
+  ///
+  /// @param[in] file_name A path of the file in a writable storage.
+  ///
+  /// @return Returns `true` if the file is written.
+  bool SaveGlyphCache(const char *file_name);
+
+  /// @brief Restore glyphs saved by `SaveGlyphCache()` to the glyph cache.
+  ///
+  /// Glyphs of opened fonts are restored immediately, glyphs of other fonts
+  /// when the fonts are opened with `Open()`, so the API can be called right
+  /// after constructing the font manager. Glyphs of a font are discarded when
+  /// the contents of the font differ from the font the glyphs were saved
+  /// with, the whole file is discarded when the SDF mode differs.
+  ///
+  /// @param[in] file_name A path of the file.
+  ///
+  /// @return Returns `false` if the file can't be read or is not a valid glyph
+  /// cache file.
+  bool LoadGlyphCache(const char *file_name);
+
+  /// @brief Queue glyphs of a string to be cached by `Prewarm()`.
+  ///
+  /// The string is shaped immediately, so that the queued glyphs are the
+  /// glyphs the string is rendered with.
+  ///
+  /// @param[in] font_name A font name opened with `Open()`.
+  /// @param[in] text A C-string in UTF-8 format.
+  /// @param[in] ysize The font size in pixels the string is rendered with.
+  ///
+  /// @return Returns `false` if the font is not opened.
+  bool PrewarmText(const char *font_name, const char *text, float ysize);
+
+  /// @brief Queue glyphs of code points to be cached by `Prewarm()`.
+  ///
+  /// @param[in] font_name A font name opened with `Open()`.
+  /// @param[in] code_points Unicode code points of the glyphs.
+  /// @param[in] count The number of code points.
+  /// @param[in] ysize The font size in pixels the glyphs are rendered with.
+  ///
+  /// @return Returns `false` if the font is not opened.
+  bool PrewarmCodePoints(const char *font_name, const uint32_t *code_points,
+                         size_t count, float ysize);
+
+  /// @brief Rasterize queued glyphs into the glyph cache within a time budget.
+  ///
+  /// Call the API once a frame before `StartLayoutPass()` until the queue is
+  /// empty, so that the first frame showing new text doesn't hitch.
+  /// Prewarmed glyphs are evicted as usual when they are not used. The API
+  /// stops when the glyph cache is full and resumes in the next call.
+  ///
+  /// @param[in] milliseconds The time budget of the call in milliseconds.
+  ///
+  /// @return Returns the number of glyphs remaining in the queue.
+  size_t Prewarm(float milliseconds);
+
+  /// @brief Start or stop recording glyphs used by layouts.
+  ///
+  /// The recorded glyphs can be saved with `SaveGlyphUsageProfile()` and
+  /// prewarmed at the next launch with `LoadGlyphUsageProfile()`.
+  ///
+  /// @param[in] enable `true` to start recording. Glyphs recorded so far are
+  /// kept until `ClearGlyphUsageProfile()` is called.
+  void RecordGlyphUsage(bool enable) { record_glyph_usage_ = enable; }
+
+  /// @brief Clear recorded glyphs.
+  void ClearGlyphUsageProfile();
+
+  /// @brief Save recorded glyphs to a file, in the order they were first
+  /// used.
+  ///
+  /// @param[in] file_name A path of the file in a writable storage.
+  ///
+  /// @return Returns `true` if the file is written.
+  bool SaveGlyphUsageProfile(const char *file_name);
+
+  /// @brief Queue glyphs saved by `SaveGlyphUsageProfile()` to be cached by
+  /// `Prewarm()`.
+  ///
+  /// Glyphs of fonts that are not opened when they are prewarmed are skipped.
+  ///
+  /// @param[in] file_name A path of the file.
+  ///
+  /// @return Returns `false` if the file can't be read or is not a valid
+  /// profile.
+  bool LoadGlyphUsageProfile(const char *file_name);
+
+  /// @brief Set a time budget of the glyph cache compaction per frame.
+  ///
+  /// With a budget, the font manager moves cached glyphs to defragment the
+  /// glyph cache at the start of each render pass (unless the glyph cache has
+  /// been flushed in the frame) until the budget is used up. Moved glyphs are
+  /// uploaded with the atlas texture and UVs of FontBuffers are updated when
+  /// they are fetched with `GetBuffer()` in the render pass.
+  ///
+  /// @param[in] milliseconds The time budget in milliseconds. 0 disables the
+  /// compaction, which is the default.
+  void SetGlyphCacheCompactionBudget(float milliseconds) {
+    compaction_budget_ = milliseconds;
+  }
+
+  /// @brief Set the number of threads rasterizing glyphs.
+  ///
+  /// With threads, glyphs of a new FontBuffer missing in the glyph cache are
+  /// rasterized in parallel before the layout, and committed to the glyph
+  /// cache in the order of the text, so that layouts and the glyph cache
+  /// contents don't depend on the number of threads.
+  ///
+  /// @param[in] num_threads The number of worker threads. The calling thread
+  /// rasterizes glyphs as well. 0 rasterizes glyphs one by one during the
+  /// layout, which is the default.
+  void SetRasterizerThreads(int32_t num_threads);
+
+  /// @brief Set the memory budget of the shaping cache.
+  ///
+  /// @param[in] bytes The budget in bytes. Least recently used runs are
+  /// evicted to stay within the budget, 0 disables the cache. Default is
+  /// `kShapingCacheBudget`.
+  void SetShapingCacheBudget(size_t bytes) {
+    shaping_cache_->set_budget(bytes);
+  }
+
+  /// @brief Set the memory budgets of FontBuffers cached by `GetBuffer()` and
+  /// FontTextures cached by `GetTexture()`.
+  ///
+  /// Least recently used buffers and textures are evicted when a layout pass
+  /// starts until they fit in the budgets. Buffers and textures used in the
+  /// current frame are never evicted, so the budgets can be exceeded within a
+  /// frame. Pointers returned by `GetBuffer()` and `GetTexture()` are
+  /// therefore valid until the next `StartLayoutPass()`.
+  ///
+  /// @param[in] buffer_bytes The budget of buffers in bytes, counting their
+  /// vertices, indices, code points and caret positions. Default is
+  /// `kBufferCacheBudget`.
+  /// @param[in] texture_bytes The budget of textures in bytes. Default is
+  /// `kTextureCacheBudget`.
+  void SetLayoutCacheBudget(size_t buffer_bytes, size_t texture_bytes) {
+    map_buffers_.set_budget(buffer_bytes);
+    map_textures_.set_budget(texture_bytes);
+  }
+
+  /// @brief Set the number of frames cached FontBuffers and FontTextures are
+  /// kept while they are not used.
+  ///
+  /// @param[in] frames The number of layout passes. 0 keeps them until they
+  /// are evicted for the budget. Default is `kLayoutCacheMaxAge`.
+  void SetLayoutCacheMaxAge(uint32_t frames) {
+    map_buffers_.set_max_age(frames);
+    map_textures_.set_max_age(frames);
+  }
 
   /// @brief The user can supply a size selector function to adjust glyph sizes
   /// when storing a glyph cache entry. By doing that, multiple strings with
@@ -327,6 +960,29 @@ class FontManager {
     size_selector_.swap(selector);
   }
 
+  /// @brief Enable or disable the signed distance field (SDF) mode.
+  ///
+  /// In the SDF mode, the glyph cache stores signed distance fields of glyphs
+  /// rasterized at a few reference sizes, so that one glyph cache entry serves
+  /// a whole range of font sizes with sharp outlines. Labels are rendered with
+  /// the `font_sdf` and `font_clipping_sdf` shaders in the mode.
+  ///
+  /// @note Changing the mode flushes the glyph cache and FontBuffers.
+  ///
+  /// @param[in] enable `true` to enable the SDF mode. Default is `false`.
+  void EnableSDF(bool enable);
+
+  /// @return Returns `true` if the signed distance field mode is enabled.
+  bool IsSDFEnabled() const { return sdf_; }
+
+  /// @brief Retrieve the smoothing width for the SDF shaders.
+  ///
+  /// @param[in] ysize The font size the text is rendered with, in pixels.
+  ///
+  /// @return Returns the half width of the anti-aliased edge in distance field
+  /// values, to be set to the `smoothing` uniform of the SDF shaders.
+  float GetSDFSmoothing(float ysize);
+
   /// @param[in] locale  A C-string corresponding to the of the
   /// language defined in ISO 639 and the country code difined in ISO 3166
   /// separated
@@ -352,16 +1008,13 @@ class FontManager {
   /// @param[in] direction Text layout direction.
   ///            TextLayoutDirectionLTR & TextLayoutDirectionRTL are supported.
   ///
+  /// @note Layouts of both directions are cached, so the direction can be
+  /// switched within a frame.
   void SetLayoutDirection(const TextLayoutDirection direction) {
     if (direction == TextLayoutDirectionTTB) {
       fplbase::LogError("TextLayoutDirectionTTB is not supported yet.");
       return;
     }
-
-    // Flush layout cache if we switch a directin.
-    if (direction != layout_direction_) {
-      FlushLayout();
-    }
     layout_direction_ = direction;
   }
 
@@ -378,6 +1031,9 @@ class FontManager {
   FaceData *GetCurrentFace() { return current_face_; }
 
  private:
+  // The corpus check of the simple layout drives the private layout API.
+  friend class SimpleLayoutTest;
+
   // Pass indicating rendering pass.
   static const int32_t kRenderPass = -1;
 
@@ -389,21 +1045,40 @@ class FontManager {
   // to use the class.
   static void Terminate();
 
-  // Expand a texture image buffer when the font metrics is changed.
-  // Returns true if the image buffer was reallocated.
-  static bool ExpandBuffer(const int32_t width, const int32_t height,
-                           const FontMetrics &original_metrics,
-                           const FontMetrics &new_metrics,
-                           std::unique_ptr<uint8_t[]> *image);
+  // Shape text with the current font, size and language settings, or find
+  // the shaped run in the shaping cache.
+  // Returns the run, which is valid until the next call.
+  const ShapedRun *LayoutText(const char *text, const size_t length);
+
+  // Shape text with harfbuzz and the current settings into harfbuzz_buf_.
+  // The caller clears the buffer.
+  void ShapeText(const char *text, const size_t length);
+
+  // Lay out a run of simple glyphs of the current face without harfbuzz into
+  // shaped_glyphs_, see FaceData::BuildSimpleLayout().
+  // Returns false if the run needs harfbuzz.
+  bool LayoutSimpleText(const char *text, const size_t length,
+                        uint32_t *width);
 
-  // Layout text and update harfbuzz_buf_.
-  // Returns the width of the text layout in pixels.
-  uint32_t LayoutText(const char *text, const size_t length);
+  // Check if harfbuzz shapes text as LayoutSimpleText() laid it out in
+  // shaped_glyphs_. Clears harfbuzz_buf_.
+  bool MatchesShapedText(const char *text, const size_t length);
+
+  // Retrieve the advance of a simple glyph at the active size of the current
+  // face.
+  int32_t GetSimpleAdvance(const uint32_t code_point);
+
+  // Check if harfbuzz lays out a pair of simple glyphs as the glyphs laid out
+  // alone at the active size of the current face. Pairs that may be adjusted
+  // are shaped once per size, script and language.
+  bool IsSimplePair(const uint32_t first, const uint32_t second);
 
   // Calculate internal/external leading value and expand a buffer if
   // necessary.
   // Returns true if the size of metrics has been changed.
-  bool UpdateMetrics(const FT_GlyphSlot glyph,
+  // top: offset from the base line to the top of the glyph image in pixels.
+  // rows: height of the glyph image in pixels.
+  bool UpdateMetrics(const int32_t top, const int32_t rows,
                      const FontMetrics &current_metrics,
                      FontMetrics *new_metrics);
 
@@ -418,32 +1093,140 @@ class FontManager {
   const GlyphCacheEntry *GetCachedEntry(const uint32_t code_point,
                                         const int32_t y_size);
 
+  // Rasterize glyphs of a text missing in the glyph cache on the rasterizer
+  // threads and store them to the glyph cache, in the order of the text.
+  // The pixel size of the face must be set to |ysize|. Glyphs that don't fit
+  // are left to GetCachedEntry().
+  void RasterizeGlyphs(const char *text, const uint32_t length,
+                       const int32_t ysize, const bool multi_line);
+
   // Update font manager, check glyph cache if the texture atlas needs to be
   // updated.
   // If start_subpass == true,
   // the API uploads the current atlas texture, flushes cache and starts
   // a sub layout pass. Use the feature when the cache is full and needs to
-  // flushed during a rendering pass.
+  // flushed during a rendering pass. In the render pass, the cache is flushed
+  // and the render pass continues.
   void UpdatePass(const bool start_subpass);
 
+  // Retrieve cumulative counters including glyph cache counters.
+  FontManagerCounters GetTotalCounters() const;
+
+  // Create atlas textures for glyph cache pages that don't have one yet.
+  // All textures are recreated when the glyph cache size has changed.
+  // Returns the number of existing textures kept.
+  int32_t UpdateAtlasTextures();
+
   // Update UV value in the FontBuffer.
   // Returns nullptr if one of UV values couldn't be updated.
   FontBuffer *UpdateUV(const int32_t ysize, FontBuffer *buffer);
 
+  // Fetch UV values and glyph cache pages of all glyphs in the FontBuffer, and
+  // stamp the buffer with the glyph cache revision. Fetching a glyph may grow
+  // the glyph cache, which moves the glyphs fetched before it, so glyphs are
+  // fetched again until the revision doesn't change.
+  // Returns false if one of the glyphs couldn't be cached.
+  bool FetchUV(const int32_t ysize, FontBuffer *buffer);
+
+  // Fetch glyphs of a cached FontBuffer to the glyph cache in the layout pass
+  // as GetBuffer() does, flushing the glyph cache if it's full.
+  void PrefetchBuffer(const FontBufferParameters &parameters,
+                      FontBuffer *buffer);
+
   // Convert requested glyph size using SizeSelector if it's set.
   int32_t ConvertSize(const int32_t size);
 
-  // Retrieve a caret count in a specific glyph from linebreak and halfbuzz
-  // glyph information.
-  int32_t GetCaretPosCount(const WordEnumerator &enumerator,
-                           const hb_glyph_info_t *info, int32_t glyph_count,
-                           int32_t index);
+  // Convert requested glyph size to the size of glyph cache entries. In the
+  // SDF mode, sizes are collapsed into reference sizes.
+  int32_t ConvertGlyphSize(const int32_t size);
+
+  // Cache and pin a glyph with a glyph index of the current font.
+  // The pixel size of the face must be set to |ysize|.
+  bool PinGlyphIndex(const uint32_t glyph_index, const int32_t ysize);
+
+  // Restore glyphs of opened fonts from the loaded glyph cache file. The file
+  // is released when no glyphs are waiting for their fonts.
+  // Return value: false if the file is not valid.
+  bool RestoreGlyphCache();
+
+  // Retrieve a hash of the font file contents, calculated on the first call.
+  static uint32_t GetFontContentHash(FaceData *face);
+
+  // Find an opened font by its font id.
+  FaceData *FindFace(HashedId font_id);
+
+  // Set the pixel size of a font face and count the resize.
+  void SetFaceSize(FaceData *face, const int32_t ysize);
+
+  // Retrieve a caret count in a specific glyph from linebreak information.
+  // start, end: byte range of the glyph's cluster in the text.
+  int32_t GetCaretPosCount(const uint32_t start, const uint32_t end);
+
+  // Retrieve the end of the paragraph starting at |start|, which is shaped as
+  // a whole. A multi line text is split into paragraphs at mandatory line
+  // breaks in the linebreak information.
+  uint32_t GetParagraphEnd(const uint32_t start, const uint32_t length,
+                           const bool multi_line);
 
   // Create FontBuffer with requested parameters.
   // The function may return nullptr if the glyph cache is full.
   FontBuffer *CreateBuffer(const char *text, const uint32_t length,
                            const FontBufferParameters &parameters);
 
+  // Retrieve the parameters with the current layout settings, the key of
+  // the layout caches.
+  FontBufferParameters GetLayoutParameters(
+      const FontBufferParameters &parameters) const;
+
+  // A glyph of the buffer of a dynamic label: the byte offset of the glyph in
+  // the text and the pen position of its vertices.
+  struct DynamicGlyph {
+    uint32_t offset;
+    mathfu::vec2 position;
+  };
+
+  // Lay out a text with the current face set to the glyph size of the
+  // parameters.
+  // buffer: the FontBuffer receiving glyphs and carets, or nullptr to measure
+  // the text only without rasterizing glyphs.
+  // buffer_size, metrics: receive the size and the metrics of the laid out
+  // text.
+  // dynamic_glyphs: if not nullptr, receives a DynamicGlyph per glyph of the
+  // buffer.
+  // Return value: false if the glyph cache is full.
+  bool LayoutBuffer(const char *text, const uint32_t length,
+                    const FontBufferParameters &parameters, FontBuffer *buffer,
+                    mathfu::vec2i *buffer_size, FontMetrics *metrics,
+                    std::vector<DynamicGlyph> *dynamic_glyphs);
+
+  // Retrieve the base line of the current face at |ysize| in pixels.
+  int32_t GetBaseLine(const int32_t ysize) const;
+
+  // Lay out the buffer of a dynamic label if the text or the parameters have
+  // changed.
+  // The function may return nullptr if the glyph cache is full.
+  FontBuffer *UpdateDynamicBuffer(const HashedId id, const char *text,
+                                  const size_t length,
+                                  const FontBufferParameters &parameters);
+
+  // Rewrite the vertices of changed digits of a dynamic label laid out with
+  // the same parameters except the text.
+  // Return value: false if the text needs a new layout.
+  struct DynamicBuffer;
+  bool UpdateDynamicDigits(DynamicBuffer *dynamic, const char *text,
+                           const size_t length,
+                           const FontBufferParameters &parameters);
+
+  // Retrieve metrics of a glyph in the current face, which is set to |ysize|.
+  // Metrics of a glyph not rasterized yet are loaded without rendering the
+  // glyph.
+  // Return value: false if the glyph can't be loaded.
+  bool GetGlyphMetrics(const uint32_t glyph_index, const int32_t ysize,
+                       GlyphMetrics *metrics);
+
+  // Store metrics of a glyph, loaded or rasterized.
+  void SetGlyphMetrics(const GlyphKey &key, const GlyphMetrics &metrics);
+
   // Update language related settings.
   void SetLanguageSettings();
 
@@ -468,15 +1251,26 @@ class FontManager {
 
   // Texture cache for a rendered string image.
   // Using the FontBufferParameters as keys.
-  // The map is used for GetTexture() API.
-  std::unordered_map<FontBufferParameters, std::unique_ptr<FontTexture>,
-                     FontBufferParameters> map_textures_;
+  // The cache is used for GetTexture() API.
+  LayoutCache<FontBufferParameters, FontTexture, FontBufferParameters>
+      map_textures_;
 
   // Cache for a texture atlas + vertex array rendering.
   // Using the FontBufferParameters as keys.
-  // The map is used for GetBuffer() API.
-  std::unordered_map<FontBufferParameters, std::unique_ptr<FontBuffer>,
-                     FontBufferParameters> map_buffers_;
+  // The cache is used for GetBuffer() API.
+  LayoutCache<FontBufferParameters, FontBuffer, FontBufferParameters>
+      map_buffers_;
+
+  // Cache for text measurements, the size and the metrics of a layout.
+  // Using the FontBufferParameters as keys.
+  // The map is used for MeasureText() API.
+  struct TextMeasurement;
+  FlatHashMap<FontBufferParameters, std::unique_ptr<TextMeasurement>,
+              FontBufferParameters> map_measurements_;
+
+  // Buffers of dynamic labels per label ID.
+  // The map is used for GetDynamicBuffer() API.
+  FlatHashMap<HashedId, std::unique_ptr<DynamicBuffer>> map_dynamic_buffers_;
 
   // Singleton instance of Freetype library.
   static FT_Library *ft_;
@@ -484,14 +1278,44 @@ class FontManager {
   // Harfbuzz buffer
   static hb_buffer_t *harfbuzz_buf_;
 
+  // Metrics of glyphs per font, glyph index and size.
+  FlatHashMap<GlyphKey, GlyphMetrics, GlyphKey> map_glyph_metrics_;
+
+  // Cache of shaped text runs, and glyphs of a run being shaped.
+  std::unique_ptr<ShapingCache> shaping_cache_;
+  // False while a dynamic label is laid out, so that texts changing every
+  // frame don't evict runs from the shaping cache.
+  bool cache_shaping_;
+  std::vector<ShapedGlyph> shaped_glyphs_;
+
   // Unique pointer to a glyph cache.
-  std::unique_ptr<GlyphCache<uint8_t>> glyph_cache_;
+  typedef GlyphCache<uint8_t, FLATUI_GLYPH_CACHE_EVICTION_POLICY>
+      FontGlyphCache;
+  std::unique_ptr<FontGlyphCache> glyph_cache_;
 
   // Current atlas texture's contents revision.
   uint32_t current_atlas_revision_;
 
-  // Unique pointer to a font atlas texture.
-  std::unique_ptr<fplbase::Texture> atlas_texture_;
+  // Time budget of the glyph cache compaction per frame in milliseconds.
+  float compaction_budget_;
+
+  // Font atlas textures, one per glyph cache page.
+  std::vector<std::unique_ptr<fplbase::Texture>> atlas_textures_;
+
+  // Size of the atlas textures.
+  mathfu::vec2i atlas_texture_size_;
+
+  // Staging buffer to upload a part of the glyph cache.
+  std::vector<uint8_t> upload_buffer_;
+
+  // Counters tracked by FontManager. Glyph cache counters are merged in
+  // GetTotalCounters().
+  FontManagerCounters counters_;
+
+  // Total counters at the start of the current frame and counters of the
+  // last frame.
+  FontManagerCounters frame_start_counters_;
+  FontManagerCounters frame_counters_;
 
   // Current pass counter.
   // Current implementation only supports up to 2 passes in a rendering cycle.
@@ -500,11 +1324,40 @@ class FontManager {
   // Size selector function object used to adjust a glyph size.
   std::function<int32_t(const int32_t)> size_selector_;
 
+  // Flag indicating the glyph cache stores signed distance fields.
+  bool sdf_;
+
+  // Distance field generator used in the SDF mode.
+  DistanceFieldGenerator sdf_generator_;
+
+  // Rasterizer of glyph batches, created by SetRasterizerThreads(), and
+  // glyphs of the current batch with a look-up map of them.
+  std::unique_ptr<GlyphRasterizer> rasterizer_;
+  std::vector<GlyphRasterRequest> raster_requests_;
+  FlatHashMap<GlyphKey, bool, GlyphKey> raster_request_map_;
+
+  // Glyph cache file loaded by LoadGlyphCache(), kept until glyphs of all
+  // fonts in the file are restored.
+  std::vector<uint8_t> glyph_cache_file_;
+
+  // Glyphs queued for Prewarm() and the index of the next glyph. The glyph
+  // size in the keys is the size glyphs are rasterized at.
+  std::vector<GlyphKey> prewarm_queue_;
+  size_t prewarm_index_;
+
+  // Glyphs used by layouts in the order of the first use, and a look-up map
+  // of them.
+  bool record_glyph_usage_;
+  std::vector<GlyphKey> glyph_usage_;
+  FlatHashMap<GlyphKey, bool, GlyphKey> glyph_usage_map_;
+
   // Language of input strings.
   // Used to determine line breaking depending on a language.
   uint32_t script_;
   std::string language_;
   std::string locale_;
+  HashedId locale_id_;
+  const hb_language_impl_t *harfbuzz_language_;
   TextLayoutDirection layout_direction_;
   static const ScriptInfo script_table_[];
   static const char *language_table_[];
@@ -705,7 +1558,7 @@ class FontBuffer {
   static const int32_t kVerticesPerCodePoint = 4;
 
   /// @brief The default constructor for a FontBuffer.
-  FontBuffer() : revision_(0) {}
+  FontBuffer() : revision_(0), pass_(0) {}
 
   /// @brief The constructor for FontBuffer with a given buffer size.
   ///
@@ -719,10 +1572,10 @@ class FontBuffer {
   ///
   /// Since it has a strong relationship to rendering positions, we store the
   /// caret position information in the FontBuffer.
-  FontBuffer(uint32_t size, bool caret_info) : revision_(0) {
-    indices_.reserve(size * kIndiciesPerCodePoint);
+  FontBuffer(uint32_t size, bool caret_info) : revision_(0), pass_(0) {
     vertices_.reserve(size * kVerticesPerCodePoint);
     code_points_.reserve(size);
+    glyph_pages_.reserve(size);
     if (caret_info) {
       caret_positions_.reserve(size + 1);
     }
@@ -741,11 +1594,33 @@ class FontBuffer {
   /// @param[in] metrics The FontMetrics to set for the font texture.
   void set_metrics(const FontMetrics &metrics) { metrics_ = metrics; }
 
-  /// @return Returns the indices array as a std::vector<uint16_t>.
-  std::vector<uint16_t> *get_indices() { return &indices_; }
+  /// @param[in] page The index of the glyph cache page.
+  ///
+  /// @return Returns the indices array of glyphs stored in the glyph cache
+  /// page as a std::vector<uint16_t>.
+  std::vector<uint16_t> *get_indices(int32_t page = 0) {
+    if (page >= static_cast<int32_t>(indices_.size())) {
+      indices_.resize(page + 1);
+    }
+    return &indices_[page];
+  }
 
-  /// @return Returns the indices array as a const std::vector<uint16_t>.
-  const std::vector<uint16_t> *get_indices() const { return &indices_; }
+  /// @param[in] page The index of the glyph cache page.
+  ///
+  /// @return Returns the indices array of glyphs stored in the glyph cache
+  /// page as a const std::vector<uint16_t>.
+  const std::vector<uint16_t> *get_indices(int32_t page = 0) const {
+    static const std::vector<uint16_t> kEmptyIndices;
+    return page < static_cast<int32_t>(indices_.size()) ? &indices_[page]
+                                                         : &kEmptyIndices;
+  }
+
+  /// @return Returns the number of glyph cache pages referenced by the buffer.
+  ///
+  /// @note Glyphs in the buffer can be stored in different glyph cache pages.
+  /// A caller renders the buffer with one draw call per page, using
+  /// `get_indices(page)` and the atlas texture of the page.
+  int32_t get_num_pages() const { return static_cast<int32_t>(indices_.size()); }
 
   /// @return Returns the vertices array as a std::vector<FontVertex>.
   std::vector<FontVertex> *get_vertices() { return &vertices_; }
@@ -829,6 +1704,34 @@ class FontBuffer {
   /// components of the vector.
   void UpdateUV(const int32_t index, const mathfu::vec4 &uv);
 
+  /// @brief Set the glyph cache page of a glyph entry.
+  ///
+  /// @param[in] index The index of the glyph entry that should be updated.
+  /// @param[in] page The index of the glyph cache page holding the glyph.
+  ///
+  /// @return Returns `true` if the page of the glyph has been changed. In that
+  /// case, `UpdateIndices()` needs to be called to update index arrays.
+  bool SetGlyphPage(const int32_t index, const int32_t page);
+
+  /// @brief Set 4 vertices of a glyph added with `AddVertices()`.
+  ///
+  /// @param[in] index The index of the glyph entry that should be updated.
+  /// @param[in] pos, base_line, scale, entry As `AddVertices()`.
+  ///
+  /// @note UV values of the glyph are cleared, call `UpdateUV()` afterwards.
+  void SetVertices(const int32_t index, const mathfu::vec2 &pos,
+                   const int32_t base_line, const float scale,
+                   const GlyphCacheEntry &entry);
+
+  /// @brief Rebuild index arrays of each page using the glyph pages.
+  void UpdateIndices();
+
+  /// @brief Remove all glyphs and caret positions, keeping the allocated
+  /// arrays so that the buffer can be laid out again.
+  ///
+  /// @param[in] size, caret_info As the constructor.
+  void Clear(uint32_t size, bool caret_info);
+
   /// @brief Verifies that the sizes of the arrays used in the buffer are
   /// correct.
   ///
@@ -837,7 +1740,13 @@ class FontBuffer {
   /// @return Returns `true`.
   bool Verify() {
     assert(vertices_.size() == code_points_.size() * kVerticesPerCodePoint);
-    assert(indices_.size() == code_points_.size() * kIndiciesPerCodePoint);
+    assert(glyph_pages_.size() == code_points_.size());
+    size_t num_indices = 0;
+    for (auto &indices : indices_) {
+      num_indices += indices.size();
+    }
+    assert(num_indices == code_points_.size() * kIndiciesPerCodePoint);
+    (void)num_indices;
     return true;
   }
 
@@ -871,8 +1780,8 @@ class FontBuffer {
   // They are hold as a separate vector because OpenGL draw call needs them to
   // be a separate array.
 
-  // Indices of the font buffer.
-  std::vector<uint16_t> indices_;
+  // Indices of the font buffer, one array per glyph cache page.
+  std::vector<std::vector<uint16_t>> indices_;
 
   // Vertices data of the font buffer.
   std::vector<FontVertex> vertices_;
@@ -881,6 +1790,9 @@ class FontBuffer {
   // entries when the glyph cache is flushed.
   std::vector<uint32_t> code_points_;
 
+  // Glyph cache page of each glyph in the buffer.
+  std::vector<int32_t> glyph_pages_;
+
   // Caret positions in the buffer. We need to track them differently than a
   // vertices information because we support ligatures so that single glyph
   // can include multiple caret positions.
@@ -907,7 +1819,12 @@ class FontBuffer {
 class FaceData {
  public:
   /// @brief The default constructor for FaceData.
-  FaceData() : face_(nullptr), harfbuzz_font_(nullptr), font_id_(kNullHash) {}
+  FaceData()
+      : face_(nullptr),
+        harfbuzz_font_(nullptr),
+        font_id_(kNullHash),
+        content_hash_(0),
+        ysize_(0) {}
 
   /// @brief The destructor for FaceData.
   ///
@@ -917,6 +1834,27 @@ class FaceData {
   /// @brief Close the fontface.
   void Close();
 
+  /// @brief Set the pixel size of the fontface.
+  ///
+  /// The fontface keeps FreeType size objects of the last
+  /// `kFaceSizeCacheCapacity` sizes with the matching harfbuzz scale, so that
+  /// switching to one of them only activates the size object.
+  ///
+  /// @param[in] ysize The size in pixels.
+  ///
+  /// @return Returns `true` if the fontface was scaled to the size.
+  bool SetSize(int32_t ysize);
+
+  /// @brief Build the tables of text laid out without harfbuzz.
+  ///
+  /// Runs of printable Latin-1 characters whose glyphs are not affected by
+  /// the OpenType features harfbuzz applies by default are laid out with the
+  /// cmap and the advances of the glyphs. Glyphs that may be adjusted by
+  /// pair positioning or legacy kerning are checked per pair, see
+  /// `FontManager::IsSimplePair()`. Faces with AAT layout tables are always
+  /// shaped by harfbuzz.
+  void BuildSimpleLayout();
+
   /// @var face_
   ///
   /// @brief freetype's fontface instance.
@@ -937,6 +1875,45 @@ class FaceData {
   /// @var font_id_
   /// @brief Hashed value of the font face.
   HashedId font_id_;
+
+  /// @var content_hash_
+  /// @brief Hash of the font file contents, 0 until it's calculated.
+  uint32_t content_hash_;
+
+  /// @var ysize_
+  /// @brief The pixel size set by `SetSize()`.
+  int32_t ysize_;
+
+  /// @struct ScaledSize
+  /// @brief A FreeType size object scaled to a pixel size, and the harfbuzz
+  /// scale of the size.
+  struct ScaledSize {
+    int32_t ysize;
+    FT_Size size;
+    int32_t harfbuzz_x_scale;
+    int32_t harfbuzz_y_scale;
+    // Advances of simple glyphs per code point, allocated on the first use.
+    std::vector<int32_t> simple_advances;
+    // States of pairs of simple code points, 2 bits per pair, and the script
+    // and the language the pairs were shaped with.
+    std::vector<uint8_t> simple_pairs;
+    uint32_t simple_pairs_script;
+    const void *simple_pairs_language;
+  };
+
+  /// @var sizes_
+  /// @brief Scaled sizes in the order of use, the active size is the last.
+  std::vector<ScaledSize> sizes_;
+
+  /// @var simple_glyphs_
+  /// @brief Glyph indices of Latin-1 code points laid out without harfbuzz,
+  /// 0 for code points that need harfbuzz. Empty if all text needs harfbuzz.
+  std::vector<uint32_t> simple_glyphs_;
+
+  /// @var simple_paired_glyphs_
+  /// @brief Flags of the simple code points whose glyphs may be adjusted by
+  /// the glyph next to them.
+  std::vector<bool> simple_paired_glyphs_;
 };
 
 /// @struct ScriptInfo
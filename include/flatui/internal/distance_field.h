@@ -0,0 +1,163 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DISTANCE_FIELD_H
+#define DISTANCE_FIELD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// Large enough value for the distance to a pixel that doesn't exist. Finite so
+// that the distance transform stays free of inf - inf.
+const float kDistanceFieldInfinity = 1e20f;
+
+// Generator of signed distance fields from 8 bit coverage bitmaps, such as
+// glyph images rasterized by FreeType.
+//
+// The distance is calculated with the exact euclidean distance transform of
+// Felzenszwalb & Huttenlocher (separable 1D passes, linear time in the number
+// of pixels). Pixels with a coverage of 50% or more are treated as inside.
+//
+// The output is a bitmap padded by |spread| pixels on each side. A value of
+// 128 is on the outline, larger values are inside and the value reaches 0 or
+// 255 at |spread| pixels from the outline.
+//
+// Work buffers are kept in the instance to avoid allocations per glyph.
+class DistanceFieldGenerator {
+ public:
+  DistanceFieldGenerator() {}
+
+  // Generate a distance field.
+  // image: coverage bitmap.
+  // width, height: size of the bitmap.
+  // pitch: bytes per row of the bitmap.
+  // spread: padding and the distance range of the output in pixels.
+  // Return value: the distance field bitmap of
+  // (width + spread * 2) x (height + spread * 2) pixels. The buffer is valid
+  // until next call.
+  const uint8_t* Generate(const uint8_t* image, const int32_t width,
+                          const int32_t height, const int32_t pitch,
+                          const int32_t spread) {
+    auto out_width = width + spread * 2;
+    auto out_height = height + spread * 2;
+    auto num_pixels = static_cast<size_t>(out_width * out_height);
+    inside_.assign(num_pixels, kDistanceFieldInfinity);
+    outside_.assign(num_pixels, kDistanceFieldInfinity);
+    for (int32_t y = 0; y < out_height; ++y) {
+      for (int32_t x = 0; x < out_width; ++x) {
+        auto src_x = x - spread;
+        auto src_y = y - spread;
+        auto inside = src_x >= 0 && src_x < width && src_y >= 0 &&
+                      src_y < height && image[src_x + src_y * pitch] >= 128;
+        // Distance to the nearest inside pixel is 0 for inside pixels and
+        // vice versa.
+        (inside ? outside_ : inside_)[x + y * out_width] = 0.0f;
+      }
+    }
+    Transform(&outside_, out_width, out_height);
+    Transform(&inside_, out_width, out_height);
+
+    // Pixel centers are half a pixel away from the outline.
+    field_.resize(num_pixels);
+    auto scale = 0.5f / static_cast<float>(spread);
+    for (size_t i = 0; i < num_pixels; ++i) {
+      auto distance = outside_[i] > 0.0f ? std::sqrt(outside_[i]) - 0.5f
+                                         : 0.5f - std::sqrt(inside_[i]);
+      auto value = 0.5f - distance * scale;
+      field_[i] = static_cast<uint8_t>(
+          std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+    return field_.data();
+  }
+
+ private:
+  // 2D squared distance transform, columns then rows.
+  void Transform(std::vector<float>* grid, const int32_t width,
+                 const int32_t height) {
+    auto size = std::max(width, height);
+    f_.resize(size);
+    v_.resize(size);
+    z_.resize(size + 1);
+    for (int32_t x = 0; x < width; ++x) {
+      Transform1D(grid->data() + x, height, width);
+    }
+    for (int32_t y = 0; y < height; ++y) {
+      Transform1D(grid->data() + y * width, width, 1);
+    }
+  }
+
+  // 1D squared distance transform of |n| values placed every |stride|.
+  // Computes the lower envelope of parabolas rooted at each sample.
+  void Transform1D(float* data, const int32_t n, const int32_t stride) {
+    for (int32_t q = 0; q < n; ++q) {
+      f_[q] = data[q * stride];
+    }
+    int32_t k = 0;
+    v_[0] = 0;
+    z_[0] = -kDistanceFieldInfinity;
+    z_[1] = kDistanceFieldInfinity;
+    for (int32_t q = 1; q < n; ++q) {
+      // Drop parabolas hidden by the new one. z_[0] is lower than any
+      // intersection, so the loop stops at the first parabola.
+      auto s = Intersect(q, v_[k]);
+      while (s <= z_[k]) {
+        k--;
+        s = Intersect(q, v_[k]);
+      }
+      k++;
+      v_[k] = q;
+      z_[k] = s;
+      z_[k + 1] = kDistanceFieldInfinity;
+    }
+    k = 0;
+    for (int32_t q = 0; q < n; ++q) {
+      while (z_[k + 1] < static_cast<float>(q)) {
+        k++;
+      }
+      auto d = q - v_[k];
+      data[q * stride] = static_cast<float>(d * d) + f_[v_[k]];
+    }
+  }
+
+  // Horizontal position of the intersection of parabolas rooted at |q| and
+  // |r|.
+  float Intersect(const int32_t q, const int32_t r) const {
+    return ((f_[q] + static_cast<float>(q * q)) -
+            (f_[r] + static_cast<float>(r * r))) /
+           static_cast<float>(2 * (q - r));
+  }
+
+  // Squared distances to the nearest inside/outside pixels.
+  std::vector<float> inside_;
+  std::vector<float> outside_;
+
+  // Work buffers of the 1D transform.
+  std::vector<float> f_;
+  std::vector<int32_t> v_;
+  std::vector<float> z_;
+
+  // Output buffer.
+  std::vector<uint8_t> field_;
+};
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // DISTANCE_FIELD_H
@@ -0,0 +1,285 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FLAT_HASH_MAP_H
+#define FLAT_HASH_MAP_H
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// Handle to an entry in FlatHashMap. A handle stays valid until the entry is
+// erased (or the map is cleared), regardless of other insertions/erasures.
+typedef uint32_t FlatHashMapHandle;
+const FlatHashMapHandle kInvalidFlatHashMapHandle = 0xffffffff;
+
+// Mix a 32 bit value so that all input bits affect the lower bits of the
+// result. (Finalizer of MurmurHash3.)
+inline uint32_t HashMix(uint32_t value) {
+  value ^= value >> 16;
+  value *= 0x85ebca6b;
+  value ^= value >> 13;
+  value *= 0xc2b2ae35;
+  value ^= value >> 16;
+  return value;
+}
+
+// Combine a hash value with another field value.
+inline uint32_t HashCombine(uint32_t seed, uint32_t value) {
+  return seed ^ (HashMix(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+// Open addressing hash map used for the hot caches of FontManager and
+// GlyphCache.
+//
+// The bucket array only holds a hash value and a slot index per bucket, so
+// that a look up walks a compact array with linear probing and touches the
+// key only when the hashes match. Keys and values are stored inline in slots
+// allocated in fixed size chunks, which gives
+// - no allocation per entry (one allocation per kSlotsPerChunk entries),
+// - stable pointers to the values and stable handles, chunks never move
+// and erased slots are recycled through a free list.
+// Erasure uses backward shift deletion, so there are no tombstones and look
+// up performance does not degrade over time.
+//
+// Requirements: K and V must be default constructible and move assignable.
+// Hash must return a well mixed value, lower bits are used as bucket index.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class FlatHashMap {
+ public:
+  FlatHashMap() : size_(0), mask_(0) {}
+
+  // Look up an entry.
+  // Returns kInvalidFlatHashMapHandle if the key is not found.
+  FlatHashMapHandle Find(const K& key) const {
+    if (buckets_.empty()) {
+      return kInvalidFlatHashMapHandle;
+    }
+    auto hash = static_cast<uint32_t>(Hash()(key));
+    for (auto index = hash & mask_;; index = (index + 1) & mask_) {
+      auto& bucket = buckets_[index];
+      if (bucket.slot == kInvalidFlatHashMapHandle) {
+        return kInvalidFlatHashMapHandle;
+      }
+      if (bucket.hash == hash && GetSlot(bucket.slot).key == key) {
+        return bucket.slot;
+      }
+    }
+  }
+
+  // Insert an entry.
+  // Returns a handle to the entry and a flag indicating if the entry was
+  // newly inserted. An existing entry is not overwritten.
+  std::pair<FlatHashMapHandle, bool> Insert(const K& key, V value) {
+    auto found = Find(key);
+    if (found != kInvalidFlatHashMapHandle) {
+      return std::make_pair(found, false);
+    }
+    // Keep load factor under 3/4.
+    if ((size_ + 1) * 4 > buckets_.size() * 3) {
+      Rehash(buckets_.empty() ? static_cast<size_t>(kInitialBuckets)
+                             : buckets_.size() * 2);
+    }
+
+    auto handle = AllocateSlot();
+    auto& slot = GetSlot(handle);
+    auto hash = static_cast<uint32_t>(Hash()(key));
+    slot.key = key;
+    slot.value = std::move(value);
+    slot.hash = hash;
+    InsertBucket(hash, handle);
+    size_++;
+    return std::make_pair(handle, true);
+  }
+
+  // Erase an entry with a handle.
+  void Erase(const FlatHashMapHandle handle) {
+    auto& slot = GetSlot(handle);
+    auto index = slot.hash & mask_;
+    while (buckets_[index].slot != handle) {
+      assert(buckets_[index].slot != kInvalidFlatHashMapHandle);
+      index = (index + 1) & mask_;
+    }
+
+    // Backward shift deletion: move following entries of the probe sequence
+    // into the hole so that look ups never need tombstones.
+    for (auto next = (index + 1) & mask_;; next = (next + 1) & mask_) {
+      auto& bucket = buckets_[next];
+      if (bucket.slot == kInvalidFlatHashMapHandle) {
+        break;
+      }
+      auto home = bucket.hash & mask_;
+      // Move the entry if its home bucket is not in (index, next].
+      if (((next - home) & mask_) >= ((next - index) & mask_)) {
+        buckets_[index] = bucket;
+        index = next;
+      }
+    }
+    buckets_[index].slot = kInvalidFlatHashMapHandle;
+
+    // Release resources held by the entry and recycle the slot.
+    slot.key = K();
+    slot.value = V();
+    free_slots_.push_back(handle);
+    size_--;
+  }
+
+  // Erase an entry with a key.
+  // Returns true if the entry has been erased.
+  bool EraseKey(const K& key) {
+    auto handle = Find(key);
+    if (handle == kInvalidFlatHashMapHandle) {
+      return false;
+    }
+    Erase(handle);
+    return true;
+  }
+
+  // Remove all entries. Allocated buckets and slots are kept for reuse.
+  void Clear() {
+    if (!size_) {
+      return;
+    }
+    for (auto& bucket : buckets_) {
+      if (bucket.slot != kInvalidFlatHashMapHandle) {
+        auto& slot = GetSlot(bucket.slot);
+        slot.key = K();
+        slot.value = V();
+        bucket.slot = kInvalidFlatHashMapHandle;
+      }
+    }
+    free_slots_.clear();
+    auto num_slots = chunks_.size() * kSlotsPerChunk;
+    for (auto i = num_slots; i > 0; --i) {
+      free_slots_.push_back(static_cast<FlatHashMapHandle>(i - 1));
+    }
+    size_ = 0;
+  }
+
+  // Call a function for each entry as f(handle, key, value).
+  template <typename F>
+  void ForEach(F f) {
+    for (auto& bucket : buckets_) {
+      if (bucket.slot != kInvalidFlatHashMapHandle) {
+        auto& slot = GetSlot(bucket.slot);
+        f(bucket.slot, slot.key, slot.value);
+      }
+    }
+  }
+
+  // Getters of the key and the value of an entry.
+  const K& get_key(const FlatHashMapHandle handle) const {
+    return GetSlot(handle).key;
+  }
+  V& get_value(const FlatHashMapHandle handle) {
+    return GetSlot(handle).value;
+  }
+  const V& get_value(const FlatHashMapHandle handle) const {
+    return GetSlot(handle).value;
+  }
+
+  // Getter of the number of entries.
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  enum {
+    kInitialBuckets = 64,
+    kSlotsPerChunk = 64,
+  };
+
+  struct Bucket {
+    uint32_t hash;
+    FlatHashMapHandle slot;
+  };
+
+  struct Slot {
+    Slot() : hash(0) {}
+    K key;
+    V value;
+    uint32_t hash;
+  };
+
+  Slot& GetSlot(const FlatHashMapHandle handle) {
+    return chunks_[handle / kSlotsPerChunk][handle % kSlotsPerChunk];
+  }
+  const Slot& GetSlot(const FlatHashMapHandle handle) const {
+    return chunks_[handle / kSlotsPerChunk][handle % kSlotsPerChunk];
+  }
+
+  FlatHashMapHandle AllocateSlot() {
+    if (free_slots_.empty()) {
+      // Allocate new chunk and push its slots to the free list in reverse
+      // order so that slots are used from the beginning of the chunk.
+      auto first = chunks_.size() * kSlotsPerChunk;
+      chunks_.push_back(std::unique_ptr<Slot[]>(new Slot[kSlotsPerChunk]));
+      for (auto i = first + kSlotsPerChunk; i > first; --i) {
+        free_slots_.push_back(static_cast<FlatHashMapHandle>(i - 1));
+      }
+    }
+    auto handle = free_slots_.back();
+    free_slots_.pop_back();
+    return handle;
+  }
+
+  void InsertBucket(const uint32_t hash, const FlatHashMapHandle handle) {
+    auto index = hash & mask_;
+    while (buckets_[index].slot != kInvalidFlatHashMapHandle) {
+      index = (index + 1) & mask_;
+    }
+    buckets_[index].hash = hash;
+    buckets_[index].slot = handle;
+  }
+
+  void Rehash(const size_t num_buckets) {
+    std::vector<Bucket> buckets(num_buckets);
+    for (auto& bucket : buckets) {
+      bucket.slot = kInvalidFlatHashMapHandle;
+    }
+    buckets.swap(buckets_);
+    mask_ = static_cast<uint32_t>(num_buckets - 1);
+    for (auto& bucket : buckets) {
+      if (bucket.slot != kInvalidFlatHashMapHandle) {
+        InsertBucket(bucket.hash, bucket.slot);
+      }
+    }
+  }
+
+  // Number of entries in the map.
+  size_t size_;
+
+  // Bucket count - 1. The bucket count is always a power of 2.
+  uint32_t mask_;
+
+  // Open addressing bucket array.
+  std::vector<Bucket> buckets_;
+
+  // Entry storage. Chunks never move so that pointers to values are stable.
+  std::vector<std::unique_ptr<Slot[]>> chunks_;
+
+  // Unused slots.
+  std::vector<FlatHashMapHandle> free_slots_;
+};
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // FLAT_HASH_MAP_H
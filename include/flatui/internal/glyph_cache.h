@@ -15,14 +15,20 @@
 #ifndef GLYPH_CACH_H
 #define GLYPH_CACH_H
 
-#include <list>
-#include <map>
-#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
 
+#include "flat_hash_map.h"
 #include "flatui_util.h"
+#include "glyph_cache_eviction.h"
+#include "glyph_cache_packer.h"
+#include "intrusive_list.h"
 #include "fplbase/utilities.h"
 #include "mathfu/constants.h"
 
+using fplbase::LogError;
 using fplbase::LogInfo;
 
 namespace flatui {
@@ -40,27 +46,159 @@ namespace flatui {
 // caching perfomance estimating same size of glphys tends to be stored in a
 // cache at same time. (e.g. Caching a string in a same size.)
 //
-// When looking up a cached entry, the API looks up unordered_map which is O(1)
-// operation.
+// When looking up a cached entry, the API looks up a flat hash map which is
+// O(1) operation. Cache entries are stored inline in the map and referenced by
+// handles from rows and LRU lists.
 // If there is no cached entry for given code point, the caller needs to invoke
 // Set() API to fill in a cache.
 // Set() operation takes
-// O(log N (N=# of rows)) when there is a room in the cache for the request,
+// O(H + N (H=# of row heights, N=# of rows in the height buckets visited))
+// when there is a room in the cache for the request,
 // + O(N (N=# of rows)) to look up and evict least recently used row with
 // sufficient height.
-
-// Enable tracking stats in Debug build.
-#ifdef _DEBUG
-#define GLYPH_CACHE_STATS (1)
-#endif
+//
+// Rows live in a pool and are linked with intrusive lists (a list of rows in
+// buffer order, a row LRU list and a list per row height), cache entries are
+// linked to their row or to the glyph LRU list in the same way. So Find() and
+// Set() don't allocate memory once the pools have grown to their working size.
+//
+// The row allocator is the default packing strategy. The cache can also
+// delegate the placement to a GlyphCachePacker (skyline or guillotine, see
+// glyph_cache_packer.h). In that mode, glyphs are packed regardless of their
+// height and evicted one by one in least recently used order, and the evicted
+// areas are recycled by the packer.
+//
+// The cache can span multiple pages of the same size, each page corresponds
+// to one atlas texture. Pages are laid out vertically in the cache buffer
+// (page N occupies [N * height, (N + 1) * height) rows), and rows or packed
+// glyphs never cross a page boundary. When no space can be made available by
+// evicting entries that are not used in current cycle, new page is allocated
+// up to the configured limit before Set() fails.
+// With the row allocator, when no single row that is not used in current cycle
+// is tall enough for a glyph, adjacent unused rows are evicted together and
+// merged into one row.
+//
+// The page size can grow by powers of 2 up to a limit (see set_max_size()).
+// Before a glyph used in recent cycles would be evicted, or when there is no
+// room for a glyph, the pages are enlarged: cached images are copied to the
+// new buffer and UVs are rescaled, nothing needs to be rasterized again. When
+// the glyphs used recently occupy a small part of the cache, the page size
+// shrinks back by re-storing the cached images.
+//
+// CompactStep() incrementally defragments the buffer by moving cached glyph
+// images. A moved glyph keeps its cache entry (handle and pointer), its
+// position and UV are updated in place and the destination area is marked
+// dirty, so the cache entries work as the remap table of the moved glyphs.
+//
+// Pinned glyphs (see Pin()) are marked as used at the start of each cycle, so
+// that no eviction path takes them. They survive Flush() as well, their images
+// are stored again at the top of the emptied buffer.
+//
+// The order of evictions is decided by the EvictionPolicy template parameter
+// (see glyph_cache_eviction.h). The default is LRU, rows with the row
+// allocator and glyphs with the packers.
+//
+// Glyphs can be assigned to partitions by font and size (see
+// SetPartitions()). With the row allocator, a row holds glyphs of a single
+// partition, so that small glyphs are not placed in rows of large glyphs.
+// When a partition occupies its quota of the cache, its new glyphs only evict
+// glyphs of the same partition.
+//
+// Cached glyphs can be saved to a snapshot (see Save()) and restored later
+// without rasterizing them again.
 
 // Forward decl.
-template <typename T>
+template <typename T, typename EvictionPolicy = LruEvictionPolicy>
 class GlyphCache;
 class GlyphCacheRow;
 class GlyphCacheEntry;
 class GlyphKey;
 
+// Usage counters of the cache.
+// The counters are always tracked, the cost is an increment per event.
+struct GlyphCacheStats {
+  GlyphCacheStats()
+      : lookups(0),
+        hits(0),
+        evictions(0),
+        flushes(0),
+        set_fails(0),
+        compaction_moves(0),
+        grows(0) {}
+  // Number of Find() calls and calls that found the glyph.
+  uint64_t lookups;
+  uint64_t hits;
+  // Number of evicted rows (row allocator) or glyphs (packers).
+  uint64_t evictions;
+  // Number of Flush() calls.
+  uint64_t flushes;
+  // Number of Set() calls failed with a full cache.
+  uint64_t set_fails;
+  // Number of glyphs moved by the compaction.
+  uint64_t compaction_moves;
+  // Number of times the page size grew.
+  uint64_t grows;
+};
+
+// Partition of the cache. A glyph belongs to the first partition that matches
+// its font and size, or to the default partition.
+// A partition can use free space of the cache without a limit. The quota
+// limits the area it takes from other partitions by evicting their glyphs, so
+// that a burst of glyphs in one partition (e.g. large headline glyphs) doesn't
+// evict the working set of other partitions.
+struct GlyphCachePartition {
+  GlyphCachePartition()
+      : font_id(kNullHash), max_glyph_size(0), quota(1.0f) {}
+  GlyphCachePartition(const HashedId font_id, const uint32_t max_glyph_size,
+                      const float quota)
+      : font_id(font_id), max_glyph_size(max_glyph_size), quota(quota) {}
+  // Font of the glyphs. kNullHash matches any font.
+  HashedId font_id;
+  // Maximum glyph size (the size in GlyphKey). 0 matches any size.
+  uint32_t max_glyph_size;
+  // Ratio of the cache area (0.0 - 1.0) the partition can occupy before its
+  // glyphs evict only glyphs of the same partition.
+  float quota;
+};
+
+// Usage counters of a partition.
+struct GlyphCachePartitionStats {
+  GlyphCachePartitionStats()
+      : num_glyphs(0), used_area(0), occupancy(0.0f), evictions(0),
+        set_fails(0) {}
+  // Number of cached glyphs.
+  int32_t num_glyphs;
+  // Area occupied by the glyphs including paddings.
+  int32_t used_area;
+  // Ratio of the cache area occupied by the glyphs. (0.0 - 1.0)
+  float occupancy;
+  // Number of evicted rows (row allocator) or glyphs (packers).
+  uint64_t evictions;
+  // Number of Set() calls failed with a full cache or partition.
+  uint64_t set_fails;
+};
+
+// Growth and shrink parameters of the cache.
+// kGlyphCacheRecentCycles: the cache grows rather than evicting a glyph used
+// within the cycles.
+// kGlyphCacheShrinkOccupancy, kGlyphCacheShrinkCycles: the cache usage is
+// checked every kGlyphCacheShrinkCycles cycles, and the cache shrinks when the
+// glyphs used in the period occupy less than the ratio of the cache.
+const uint32_t kGlyphCacheRecentCycles = 30;
+const float kGlyphCacheShrinkOccupancy = 0.25f;
+const int32_t kGlyphCacheShrinkCycles = 600;
+
+// Dirty rect parameters.
+// kGlyphCacheDirtyRectAlignX: horizontal alignment of dirty rects in pixels, so
+// that rows of an uploaded rect keep the default 4 byte unpack alignment.
+// kGlyphCacheDirtyRectMergeSlack: two dirty rects are merged when their
+// bounding box is larger than the sum of their areas by at most the slack.
+// Merging trades uploading some clean pixels for fewer upload calls.
+// kGlyphCacheMaxDirtyRects: maximum number of dirty rects per page.
+const int32_t kGlyphCacheDirtyRectAlignX = 4;
+const int32_t kGlyphCacheDirtyRectMergeSlack = 32 * 32;
+const size_t kGlyphCacheMaxDirtyRects = 32;
+
 // Constants for a cache entry size rounding up and padding between glyphs.
 // Adding a padding between cached glyph images to avoid sampling artifacts of
 // texture fetches.
@@ -73,6 +211,35 @@ static inline int32_t RoundUpToPowerOf2(int32_t x) {
   return static_cast<int32_t>(mathfu::RoundUpToPowerOf2(static_cast<float>(x)));
 }
 
+// Snapshot format of the cache, see GlyphCache::Save().
+// A snapshot consists of a header, glyph records and glyph images in the
+// order of the records. Rows of a glyph image are stored without gaps. Values
+// are in the native byte order, a snapshot is meant to be restored on the
+// device that saved it. The records have a fixed size, so that a memory
+// mapped snapshot can be read in place.
+const uint32_t kGlyphCacheSnapshotMagic = 0x53434746;  // 'FGCS'
+const uint32_t kGlyphCacheSnapshotVersion = 1;
+
+struct GlyphCacheSnapshotHeader {
+  uint32_t magic;
+  uint32_t version;
+  // Size of a pixel in bytes.
+  uint32_t pixel_size;
+  uint32_t num_glyphs;
+};
+
+struct GlyphCacheSnapshotGlyph {
+  // Glyph key.
+  uint32_t font_id;
+  uint32_t code_point;
+  uint32_t glyph_size;
+  // Size and offset of the glyph image.
+  int32_t width;
+  int32_t height;
+  int32_t offset_x;
+  int32_t offset_y;
+};
+
 // Class that includes glyph parameters.
 class GlyphKey {
  public:
@@ -84,6 +251,11 @@ class GlyphKey {
     glyph_size_ = glyph_size;
   }
 
+  // Getters of the parameters.
+  HashedId get_font_id() const { return font_id_; }
+  uint32_t get_code_point() const { return code_point_; }
+  uint32_t get_glyph_size() const { return glyph_size_; }
+
   // Compare operator.
   bool operator==(const GlyphKey& other) const {
     return (code_point_ == other.code_point_ && font_id_ == other.font_id_ &&
@@ -91,11 +263,12 @@ class GlyphKey {
   }
 
   // Hash function.
+  // All fields are mixed so that the lower bits used as a bucket index of the
+  // flat hash map are well distributed. (Code points and sizes are small
+  // integers.)
   size_t operator()(const GlyphKey& key) const {
-    // Note that font_id_ is an already hashed value.
-    return ((std::hash<uint32_t>()(key.code_point_) ^ (key.font_id_ << 1)) >>
-            1) ^
-           (std::hash<uint32_t>()(key.glyph_size_) << 1);
+    auto value = HashCombine(HashMix(key.font_id_), key.code_point_);
+    return HashCombine(value, key.glyph_size_);
   }
 
  private:
@@ -107,12 +280,19 @@ class GlyphKey {
 // Cache entry for a glyph.
 class GlyphCacheEntry {
  public:
-  // Typedef for cache entry map's iterator.
-  typedef std::unordered_map<GlyphKey, std::unique_ptr<GlyphCacheEntry>,
-                             GlyphKey>::iterator iterator;
-  typedef std::list<GlyphCacheRow>::iterator iterator_row;
-
-  GlyphCacheEntry() : code_point_(0), size_(0, 0), offset_(0, 0) {}
+  // Typedef for cache entry map's handle.
+  typedef FlatHashMapHandle handle;
+
+  GlyphCacheEntry()
+      : code_point_(0),
+        size_(0, 0),
+        offset_(0, 0),
+        pos_(0, 0),
+        page_(0),
+        last_used_counter_(0),
+        row_(kIntrusiveListNull),
+        partition_(0),
+        pinned_(false) {}
 
   // Setter/Getter of code point.
   // Code point is an entry in a font file, not a direct transform of Unicode.
@@ -131,10 +311,19 @@ class GlyphCacheEntry {
   mathfu::vec4 get_uv() const { return uv_; }
   void set_uv(const mathfu::vec4& uv) { uv_ = uv; }
 
+  // Getter of the position in the cache buffer.
+  mathfu::vec2i get_pos() const { return pos_; }
+
+  // Getter of the cache page that holds the glyph image.
+  int32_t get_page() const { return page_; }
+
+  // Getter of the pinned flag.
+  bool get_pinned() const { return pinned_; }
+
  private:
   // Friend class, GlyphCache needs an access to internal variables of the
   // class.
-  template <typename T>
+  template <typename T, typename EvictionPolicy>
   friend class GlyphCache;
 
   // Code point of the glyph.
@@ -149,11 +338,32 @@ class GlyphCacheEntry {
   // Glyph image's UV in the texture atlas.
   mathfu::vec4 uv_;
 
-  // Iterator to the row entry.
-  GlyphCacheEntry::iterator_row it_row;
+  // Position of the glyph image in the cache buffer.
+  mathfu::vec2i pos_;
 
-  // Iterator to the row LRU entry.
-  std::list<GlyphCacheEntry::iterator_row>::iterator it_lru_row_;
+  // Index of the cache page.
+  int32_t page_;
+
+  // Last used counter value of the entry. Used with the packer based
+  // allocation where glyphs are evicted one by one.
+  uint32_t last_used_counter_;
+
+  // Use frequency of the entry, tracked with the packer based allocation when
+  // the eviction policy needs it.
+  GlyphCacheFrequency frequency_;
+
+  // Link to the glyphs in the same row, or to the glyph LRU list with the
+  // packer based allocation.
+  IntrusiveLink link_;
+
+  // Index of the row in the row pool.
+  IntrusiveListIndex row_;
+
+  // Index of the partition.
+  int32_t partition_;
+
+  // Flag indicating the glyph is never evicted.
+  bool pinned_;
 };
 
 // Single row in a cache. A row correspond to a horizontal slice of a texture.
@@ -177,12 +387,15 @@ class GlyphCacheRow {
   ~GlyphCacheRow() {}
 
   // Initialize the row width and height.
+  // Links of the row are not changed.
   void Initialize(const int32_t y_pos, const mathfu::vec2i& size) {
     last_used_counter_ = 0;
+    frequency_ = GlyphCacheFrequency();
+    partition_ = 0;
     y_pos_ = y_pos;
     remaining_width_ = size.x();
     size_ = size;
-    cached_entries_.clear();
+    cached_entries_.Clear();
   }
 
   // Check if the row has a room for a requested width and height.
@@ -191,14 +404,16 @@ class GlyphCacheRow {
   }
 
   // Reserve an area in the row.
-  int32_t Reserve(const GlyphCacheEntry::iterator it,
-                  const mathfu::vec2i& size) {
+  // links: accessor of the entry links, see IntrusiveList.
+  template <typename Links>
+  int32_t Reserve(const GlyphCacheEntry::handle handle,
+                  const mathfu::vec2i& size, Links links) {
     assert(DoesFit(size));
 
     // Update row info.
     int32_t pos = size_.x() - remaining_width_;
     remaining_width_ -= size.x();
-    cached_entries_.push_back(it);
+    cached_entries_.PushBack(handle, links);
     return pos;
   }
 
@@ -212,6 +427,9 @@ class GlyphCacheRow {
   mathfu::vec2i get_size() const { return size_; }
   void set_size(const mathfu::vec2i size) { size_ = size; }
 
+  // Getter of remaining width.
+  int32_t get_remaining_width() const { return remaining_width_; }
+
   // Setter/Getter of row y pos.
   int32_t get_y_pos() const { return y_pos_; }
   void set_y_pos(const int32_t y_pos) { y_pos_ = y_pos; }
@@ -219,37 +437,25 @@ class GlyphCacheRow {
   // Getter of cached glyphs.
   size_t get_num_glyphs() const { return cached_entries_.size(); }
 
-  // Setter/Getter of iterator to row LRU.
-  const std::list<GlyphCacheEntry::iterator_row>::iterator get_it_lru_row()
-      const {
-    return it_lru_row_;
-  }
-  void set_it_lru_row(
-      const std::list<GlyphCacheEntry::iterator_row>::iterator it_lru_row) {
-    it_lru_row_ = it_lru_row;
-  }
-
-  // Setter/Getter of iterator to row height map.
-  std::multimap<int32_t, GlyphCacheEntry::iterator_row>::iterator
-  get_it_row_height_map() const {
-    return it_row_height_map_;
-  }
-  void set_it_row_height_map(
-      const std::multimap<int32_t, GlyphCacheEntry::iterator_row>::iterator
-          it_row_height_map) {
-    it_row_height_map_ = it_row_height_map;
-  }
-
   // Getter of cached glyph entries.
-  std::vector<GlyphCacheEntry::iterator>& get_cached_entries() {
-    return cached_entries_;
-  }
+  IntrusiveList& get_cached_entries() { return cached_entries_; }
 
  private:
+  // Friend class, GlyphCache needs an access to the links of the row.
+  template <typename T, typename EvictionPolicy>
+  friend class GlyphCache;
+
   // Last used counter value of the entry. The value is used to determine
   // if the entry can be evicted from the cache.
   uint32_t last_used_counter_;
 
+  // Use frequency of glyphs in the row, tracked when the eviction policy
+  // needs it.
+  GlyphCacheFrequency frequency_;
+
+  // Partition of the glyphs in the row. Set when the first glyph is stored.
+  int32_t partition_;
+
   // Remaining width of the row.
   // As new contents are added to the row, remaining width decreases.
   int32_t remaining_width_;
@@ -260,44 +466,60 @@ class GlyphCacheRow {
   // Vertical position of the row in the entire cache buffer.
   uint32_t y_pos_;
 
-  // Iterator to the row LRU list.
-  std::list<GlyphCacheEntry::iterator_row>::iterator it_lru_row_;
+  // Link to the neighbor rows in the buffer, or to the free row pool.
+  IntrusiveLink link_;
+
+  // Link to the row LRU list.
+  IntrusiveLink link_lru_;
 
-  // Iterator to the row height map.
-  std::multimap<int32_t, GlyphCacheEntry::iterator_row>::iterator
-      it_row_height_map_;
+  // Link to the rows with the same height.
+  IntrusiveLink link_height_;
 
   // Tracking cached entries in the row.
-  // When flushing the row, entries in the map is removed using the vector.
-  std::vector<GlyphCacheEntry::iterator> cached_entries_;
+  // When flushing the row, entries in the map is removed using the list.
+  IntrusiveList cached_entries_;
 };
 
-template <typename T>
+template <typename T, typename EvictionPolicy>
 class GlyphCache {
  public:
   // Constructor with parameters.
   // width: width of the glyph cache texture. Rounded up to power of 2.
   // height: height of the glyph cache texture. Rounded up to power of 2.
-  GlyphCache(const mathfu::vec2i& size)
-      : counter_(0), revision_(0), dirty_(false) {
+  // packing: packing strategy used to place glyphs in the buffer.
+  // max_pages: maximum number of pages the cache can allocate.
+  GlyphCache(const mathfu::vec2i& size,
+             GlyphCachePacking packing = kGlyphCachePackingRow,
+             int32_t max_pages = 1)
+      : counter_(0),
+        shrink_check_cycles_(0),
+        packing_(packing),
+        num_pages_(0),
+        max_pages_(std::max(max_pages, 1)),
+        used_area_(0),
+        revision_(0),
+        revision_counter_(0),
+        dirty_(false),
+        compacted_(true) {
     // Round up cache sizes to power of 2.
     size_.x() = RoundUpToPowerOf2(size.x());
     size_.y() = RoundUpToPowerOf2(size.y());
 
-    // Allocate the glyph cache buffer.
-    // A buffer format can be 8/32 bpp (32 bpp is mostly used for Emoji).
-    buffer_.reset(new T[size_.x() * size_.y()]);
+    // The cache doesn't grow/shrink by default.
+    min_size_ = max_size_ = size_;
 
-    // Clearing allocated buffer.
-    const int32_t kCacheClearValue = 0x0;
-    memset(buffer_.get(), kCacheClearValue, size_.x() * size_.y() * sizeof(T));
+    // A list of rows per row height.
+    if (packing_ == kGlyphCachePackingRow) {
+      row_heights_.resize(size_.y() / kGlyphCacheHeightRound + 1);
+    }
 
-    // Create first (empty) row entry.
-    InsertNewRow(0, size_, list_row_.end());
+    // The default partition.
+    partitions_.resize(1);
+    partition_stats_.resize(1);
+    lru_entries_.resize(1);
 
-#ifdef GLYPH_CACHE_STATS
-    ResetStats();
-#endif
+    // Allocate the first page.
+    AddPage();
   }
   ~GlyphCache(){};
 
@@ -305,25 +527,13 @@ class GlyphCache {
   // Return value: A pointer to a cached glyph entry.
   // nullptr if not found.
   const GlyphCacheEntry* Find(const GlyphKey& key) {
-#ifdef GLYPH_CACHE_STATS
-    // Update debug variable.
-    stats_lookup_++;
-#endif
-    auto it = map_entries_.find(key);
-    if (it != map_entries_.end()) {
+    stats_.lookups++;
+    auto handle = map_entries_.Find(key);
+    if (handle != kInvalidFlatHashMapHandle) {
       // Found an entry!
-
-      // Mark the row as being used in current cycle.
-      it->second->it_row->set_last_used_counter(counter_);
-
-      // Update row LRU entry. The row is now most recently used.
-      lru_row_.splice(lru_row_.end(), lru_row_, it->second->it_lru_row_);
-
-#ifdef GLYPH_CACHE_STATS
-      // Update debug variable.
-      stats_hit_++;
-#endif
-      return it->second.get();
+      Touch(handle);
+      stats_.hits++;
+      return &map_entries_.get_value(handle);
     }
 
     // Didn't find a cached entry. A caller may call Store() function to store
@@ -331,28 +541,625 @@ class GlyphCache {
     return nullptr;
   }
 
+  // Check if an entry is in the cache without counting a use of it.
+  bool Contains(const GlyphKey& key) const {
+    return map_entries_.Find(key) != kInvalidFlatHashMapHandle;
+  }
+
   // Set an entry to the cache.
+  // image: the glyph image, or nullptr to reserve a cleared area the caller
+  // renders the image to in place with GetImage().
+  // stride: width of the image buffer in pixels, 0 if the image width is same
+  // as the glyph width.
   // Return value: true if caching succeeded. false if there is no room in the
   // cache for a requested entry.
   // Returns a pointer to inserted entry.
   const GlyphCacheEntry* Set(const T* const image, const GlyphKey& key,
-                             const GlyphCacheEntry& entry) {
+                             const GlyphCacheEntry& entry,
+                             const int32_t stride = 0) {
+    auto handle = SetEntry(image, key, entry, stride);
+    return handle != kInvalidFlatHashMapHandle ? &map_entries_.get_value(handle)
+                                               : nullptr;
+  }
+
+  // Remove a glyph stored by Set() that is not pinned, e.g. an area reserved
+  // for an image that couldn't be rendered. With the row allocator, the area
+  // is reused only if the glyph is the last one stored in its row.
+  void Remove(const GlyphKey& key) {
+    auto handle = map_entries_.Find(key);
+    if (handle == kInvalidFlatHashMapHandle) {
+      return;
+    }
+    auto& entry = map_entries_.get_value(handle);
+    assert(!entry.pinned_);
+    auto req_size = entry.get_size() +
+                    mathfu::vec2i(kGlyphCachePaddingX, kGlyphCachePaddingY);
+    if (packing_ != kGlyphCachePackingRow) {
+      packers_[entry.page_]->Release(
+          entry.pos_ - mathfu::vec2i(0, entry.page_ * size_.y()), req_size);
+      lru_entries_[entry.partition_].Remove(handle, EntryLinks(&map_entries_));
+      compacted_ = false;
+    } else {
+      auto& row = rows_[entry.row_];
+      if (row.get_cached_entries().back() == handle) {
+        row.remaining_width_ += req_size.x();
+      }
+      row.get_cached_entries().Remove(handle, EntryLinks(&map_entries_));
+    }
+    AddUsedArea(entry.partition_, -1, -req_size.x() * req_size.y());
+    map_entries_.Erase(handle);
+  }
+
+  // Pin a cached glyph so that it's never evicted, also by Flush().
+  // Return value: false if the glyph is not in the cache.
+  bool Pin(const GlyphKey& key) {
+    auto handle = map_entries_.Find(key);
+    if (handle == kInvalidFlatHashMapHandle) {
+      return false;
+    }
+    auto& entry = map_entries_.get_value(handle);
+    if (!entry.pinned_) {
+      entry.pinned_ = true;
+      pinned_entries_.push_back(handle);
+      Touch(handle);
+    }
+    return true;
+  }
+
+  // Unpin a glyph. The glyph stays in the cache until it's evicted.
+  void Unpin(const GlyphKey& key) {
+    auto handle = map_entries_.Find(key);
+    if (handle == kInvalidFlatHashMapHandle ||
+        !map_entries_.get_value(handle).pinned_) {
+      return;
+    }
+    map_entries_.get_value(handle).pinned_ = false;
+    auto it =
+        std::find(pinned_entries_.begin(), pinned_entries_.end(), handle);
+    *it = pinned_entries_.back();
+    pinned_entries_.pop_back();
+  }
+
+  // Unpin all glyphs.
+  void UnpinAll() {
+    for (auto handle : pinned_entries_) {
+      map_entries_.get_value(handle).pinned_ = false;
+    }
+    pinned_entries_.clear();
+  }
+
+  // Getter of the number of pinned glyphs.
+  size_t get_num_pinned() const { return pinned_entries_.size(); }
+
+  // Retrieve the buffer area occupied by pinned glyphs including their
+  // paddings, in pixels.
+  int32_t GetPinnedArea() const {
+    auto area = 0;
+    for (auto handle : pinned_entries_) {
+      auto size = map_entries_.get_value(handle).get_size();
+      area +=
+          (size.x() + kGlyphCachePaddingX) * (size.y() + kGlyphCachePaddingY);
+    }
+    return area;
+  }
+
+  // Save cached glyphs to a snapshot, most recently used glyphs first.
+  // data: buffer the snapshot is written to.
+  void Save(std::vector<uint8_t>* data) {
+    snapshot_entries_.clear();
+    map_entries_.ForEach([this](FlatHashMapHandle handle, const GlyphKey&,
+                                GlyphCacheEntry&) {
+      snapshot_entries_.push_back(handle);
+    });
+    std::sort(snapshot_entries_.begin(), snapshot_entries_.end(),
+              [this](FlatHashMapHandle a, FlatHashMapHandle b) {
+                return GetLastUsedCounter(map_entries_.get_value(a)) >
+                       GetLastUsedCounter(map_entries_.get_value(b));
+              });
+
+    GlyphCacheSnapshotHeader header = {
+        kGlyphCacheSnapshotMagic, kGlyphCacheSnapshotVersion, sizeof(T),
+        static_cast<uint32_t>(snapshot_entries_.size())};
+    data->resize(sizeof(header) +
+                 sizeof(GlyphCacheSnapshotGlyph) * snapshot_entries_.size());
+    memcpy(data->data(), &header, sizeof(header));
+    auto offset = sizeof(header);
+    for (auto handle : snapshot_entries_) {
+      auto& key = map_entries_.get_key(handle);
+      auto& entry = map_entries_.get_value(handle);
+      GlyphCacheSnapshotGlyph glyph = {
+          key.get_font_id(),        key.get_code_point(),
+          key.get_glyph_size(),     entry.get_size().x(),
+          entry.get_size().y(),     entry.get_offset().x(),
+          entry.get_offset().y()};
+      memcpy(data->data() + offset, &glyph, sizeof(glyph));
+      offset += sizeof(glyph);
+    }
+
+    // Append glyph images.
+    for (auto handle : snapshot_entries_) {
+      auto& entry = map_entries_.get_value(handle);
+      auto row_size = entry.get_size().x() * sizeof(T);
+      for (int32_t y = 0; y < entry.get_size().y(); ++y) {
+        auto row = reinterpret_cast<const uint8_t*>(
+            buffer_.get() + entry.pos_.x() + (entry.pos_.y() + y) * size_.x());
+        data->insert(data->end(), row, row + row_size);
+      }
+    }
+  }
+
+  // Restore glyphs from a snapshot created by Save(). Restored glyphs are
+  // marked as used in current cycle. Restoring stops when the cache is full.
+  // accept: functor taking a GlyphKey, returns false to skip the glyph.
+  // Return value: number of restored glyphs, -1 if the snapshot is invalid.
+  template <typename Accept>
+  int32_t Restore(const uint8_t* data, const size_t size, Accept accept) {
+    // Validate the snapshot before touching the cache.
+    GlyphCacheSnapshotHeader header;
+    if (size < sizeof(header)) {
+      return -1;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != kGlyphCacheSnapshotMagic ||
+        header.version != kGlyphCacheSnapshotVersion ||
+        header.pixel_size != sizeof(T) ||
+        header.num_glyphs > (size - sizeof(header)) /
+                                sizeof(GlyphCacheSnapshotGlyph)) {
+      return -1;
+    }
+    auto image_offset =
+        sizeof(header) + sizeof(GlyphCacheSnapshotGlyph) * header.num_glyphs;
+    auto offset = image_offset;
+    for (uint32_t i = 0; i < header.num_glyphs; ++i) {
+      auto glyph = GetSnapshotGlyph(data, i);
+      if (glyph.width < 0 || glyph.height < 0 || glyph.width > max_size_.x() ||
+          glyph.height > max_size_.y()) {
+        return -1;
+      }
+      offset += static_cast<size_t>(glyph.width * glyph.height) * sizeof(T);
+      if (offset > size) {
+        return -1;
+      }
+    }
+
+    auto restored = 0;
+    offset = image_offset;
+    for (uint32_t i = 0; i < header.num_glyphs; ++i) {
+      auto glyph = GetSnapshotGlyph(data, i);
+      auto image = data + offset;
+      offset += static_cast<size_t>(glyph.width * glyph.height) * sizeof(T);
+      GlyphKey key(glyph.font_id, glyph.code_point, glyph.glyph_size);
+      if (!accept(key) || map_entries_.Find(key) != kInvalidFlatHashMapHandle) {
+        continue;
+      }
+      GlyphCacheEntry entry;
+      entry.set_code_point(glyph.code_point);
+      entry.set_size(mathfu::vec2i(glyph.width, glyph.height));
+      entry.set_offset(mathfu::vec2i(glyph.offset_x, glyph.offset_y));
+      // Glyph images in the snapshot may not be aligned.
+      snapshot_image_.resize(glyph.width * glyph.height);
+      memcpy(snapshot_image_.data(), image, snapshot_image_.size() * sizeof(T));
+      if (Set(snapshot_image_.data(), key, entry) == nullptr) {
+        break;
+      }
+      restored++;
+    }
+    return restored;
+  }
+
+  // Flush all cache entries except pinned glyphs.
+  bool Flush() {
+    stats_.flushes++;
+
+    // Save pinned glyphs. Images are copied out of the buffer.
+    pinned_glyphs_.clear();
+    pinned_images_.clear();
+    for (auto handle : pinned_entries_) {
+      auto& entry = map_entries_.get_value(handle);
+      PinnedGlyph glyph = {map_entries_.get_key(handle), entry,
+                           pinned_images_.size()};
+      pinned_glyphs_.push_back(glyph);
+      for (int32_t y = 0; y < entry.get_size().y(); ++y) {
+        auto row = buffer_.get() + entry.pos_.x() +
+                   (entry.pos_.y() + y) * size_.x();
+        pinned_images_.insert(pinned_images_.end(), row,
+                              row + entry.get_size().x());
+      }
+    }
+
+    Reset();
+
+    // Store pinned glyphs again.
+    for (auto& glyph : pinned_glyphs_) {
+      auto handle = SetEntry(pinned_images_.data() + glyph.offset, glyph.key,
+                             glyph.entry, 0);
+      if (handle != kInvalidFlatHashMapHandle) {
+        pinned_entries_.push_back(handle);
+      }
+    }
+    return true;
+  }
+
+  // Set partitions of the cache. Glyphs that don't match any of the
+  // partitions belong to the default partition (index 0) whose quota is 1.0,
+  // the given partitions follow from index 1.
+  // The cache is flushed, pinned glyphs are stored again in their new
+  // partitions.
+  void SetPartitions(const std::vector<GlyphCachePartition>& partitions) {
+    partitions_.resize(1);
+    partitions_.insert(partitions_.end(), partitions.begin(),
+                       partitions.end());
+    partition_stats_.assign(partitions_.size(), GlyphCachePartitionStats());
+    lru_entries_.resize(partitions_.size());
+    Flush();
+  }
+
+  // Getter of the number of partitions including the default partition.
+  int32_t get_num_partitions() const {
+    return static_cast<int32_t>(partitions_.size());
+  }
+
+  // Retrieve usage counters of a partition.
+  GlyphCachePartitionStats GetPartitionStats(const int32_t partition) const {
+    auto stats = partition_stats_[partition];
+    stats.occupancy = static_cast<float>(stats.used_area) /
+                      static_cast<float>(size_.x() * size_.y() * num_pages_);
+    return stats;
+  }
+
+  // Increment a cycle counter of the cache.
+  // Invoke this API for each rendering cycle.
+  // The counter is used to determine which cache entries can be evicted when
+  // cache entries are full.
+  void Update() {
+    counter_++;
+
+    // Pinned glyphs are always used.
+    for (auto handle : pinned_entries_) {
+      Touch(handle);
+    }
+
+    // Shrink the cache when recently used glyphs occupy a small part of it.
+    if (++shrink_check_cycles_ >= kGlyphCacheShrinkCycles) {
+      shrink_check_cycles_ = 0;
+      if ((size_.x() > min_size_.x() || size_.y() > min_size_.y()) &&
+          GetRecentOccupancy(kGlyphCacheShrinkCycles) <
+              kGlyphCacheShrinkOccupancy) {
+        Shrink();
+      }
+    }
+  }
+
+
+  // Run a step of the buffer compaction.
+  // With the row allocator, glyphs in a sparsely used row are moved to other
+  // rows that have a room for them, and the emptied row is merged with
+  // neighboring empty rows. With the packer, the bottom most glyph is moved to
+  // a free area closer to the top of the buffer.
+  // A step is short (moves a row's worth of glyphs at most), so that a caller
+  // can run steps within a time budget.
+  // The cache revision is updated when glyphs are moved. Make sure no glyph
+  // UVs fetched before the call are used without being fetched again.
+  // Return value: false if there is nothing to compact.
+  bool CompactStep() {
+    if (compacted_) {
+      return false;
+    }
+    auto moved = packing_ != kGlyphCachePackingRow ? CompactPacked()
+                                                   : CompactRows();
+    if (moved) {
+      // Update cache revision so that users update UVs.
+      UpdateRevision(true);
+    } else {
+      // Nothing to do until cache contents are changed.
+      compacted_ = true;
+    }
+    return moved;
+  }
+
+  // Retrieve a ratio of the buffer area occupied by cached glyph images
+  // including their paddings. (0.0 - 1.0)
+  float GetOccupancy() const {
+    return static_cast<float>(used_area_) /
+           static_cast<float>(size_.x() * size_.y() * num_pages_);
+  }
+
+  // Retrieve a fragmentation ratio of the free space in the buffer.
+  // 0.0 means all the free space is in a single rectangle, the value
+  // approaches 1.0 as the free space is scattered in small pieces.
+  // Note that the API walks all rows or free rectangles, so it's intended for
+  // statistics rather than for a per-glyph call.
+  float GetFragmentation() const {
+    int32_t free_area = 0;
+    int32_t largest_free_area = 0;
+    if (packing_ != kGlyphCachePackingRow) {
+      for (auto& packer : packers_) {
+        free_area += packer->GetFreeArea();
+        largest_free_area =
+            std::max(largest_free_area, packer->GetLargestFreeArea());
+      }
+    } else {
+      for (auto i = list_row_.front(); i != kIntrusiveListNull;
+           i = rows_[i].link_.next) {
+        auto& row = rows_[i];
+        auto width =
+            row.get_num_glyphs() ? row.get_remaining_width() : size_.x();
+        auto area = width * row.get_size().y();
+        free_area += area;
+        largest_free_area = std::max(largest_free_area, area);
+      }
+    }
+    if (free_area == 0) {
+      return 0.0f;
+    }
+    return 1.0f -
+           static_cast<float>(largest_free_area) / static_cast<float>(free_area);
+  }
+
+  // Debug API to show cache statistics.
+  void Status() {
+    LogInfo("Cache size: %dx%d (max %dx%d)", size_.x(), size_.y(),
+            max_size_.x(), max_size_.y());
+    LogInfo("Cache hit: %llu / %llu",
+            static_cast<unsigned long long>(stats_.hits),
+            static_cast<unsigned long long>(stats_.lookups));
+
+    auto total_glyph = 0;
+    for (auto i = list_row_.front(); i != kIntrusiveListNull;
+         i = rows_[i].link_.next) {
+      auto& row = rows_[i];
+      LogInfo("Row start:%d height:%d glyphs:%d counter:%d", row.get_y_pos(),
+              row.get_size().y(), row.get_num_glyphs(),
+              row.get_last_used_counter());
+      total_glyph += row.get_num_glyphs();
+    }
+    if (packing_ != kGlyphCachePackingRow) {
+      total_glyph = static_cast<int32_t>(map_entries_.size());
+    }
+    LogInfo("Cached glyphs: %d", total_glyph);
+    LogInfo("Pages: %d / %d", num_pages_, max_pages_);
+    LogInfo("Occupancy: %.1f%% Fragmentation: %.1f%%", GetOccupancy() * 100.0f,
+            GetFragmentation() * 100.0f);
+    LogInfo("Evictions: %llu Flushes: %llu",
+            static_cast<unsigned long long>(stats_.evictions),
+            static_cast<unsigned long long>(stats_.flushes));
+    LogInfo("Compaction moves: %llu",
+            static_cast<unsigned long long>(stats_.compaction_moves));
+    LogInfo("Grow: %llu", static_cast<unsigned long long>(stats_.grows));
+    LogInfo("Set fail: %llu",
+            static_cast<unsigned long long>(stats_.set_fails));
+    if (partitions_.size() > 1) {
+      for (int32_t i = 0; i < get_num_partitions(); ++i) {
+        auto stats = GetPartitionStats(i);
+        LogInfo("Partition %d glyphs:%d occupancy:%.1f%% evictions:%llu", i,
+                stats.num_glyphs, stats.occupancy * 100.0f,
+                static_cast<unsigned long long>(stats.evictions));
+      }
+    }
+  }
+
+  // Getter of the usage counters.
+  const GlyphCacheStats& get_stats() const { return stats_; }
+
+  // Getter of the eviction policy, which holds eviction counters.
+  const EvictionPolicy& get_eviction_policy() const { return eviction_policy_; }
+
+  // Getter/Setter of the counter.
+  uint32_t get_revision() const { return revision_; }
+  void set_revision(const uint32_t revision) { revision_ = revision; }
+
+  // Setter/Getter of the maximum page size.
+  // The cache grows by powers of 2 from the size given to the constructor up
+  // to the size. The cache shrinks back, but not below the initial size.
+  const mathfu::vec2i& get_max_size() const { return max_size_; }
+  void set_max_size(const mathfu::vec2i& size) {
+    max_size_ = mathfu::vec2i::Max(
+        mathfu::vec2i(RoundUpToPowerOf2(size.x()), RoundUpToPowerOf2(size.y())),
+        size_);
+  }
+
+  // Getter/Setter of dirty state.
+  bool get_dirty_state() const { return dirty_; };
+  void set_dirty_state(const bool dirty) {
+    dirty_ = dirty;
+    if (!dirty) {
+      for (auto& rects : dirty_rects_) {
+        rects.clear();
+      }
+    }
+  }
+
+  // Check if the page has been updated since the dirty state is cleared.
+  bool IsPageDirty(const int32_t page) const {
+    return !dirty_rects_[page].empty();
+  }
+
+  // Getter of dirty rects in a page. Rects are relative to the page origin
+  // and don't overlap each other.
+  const std::vector<mathfu::vec4i>& get_dirty_rects(
+      const int32_t page = 0) const {
+    return dirty_rects_[page];
+  }
+
+  // Getter of allocated glyph cache buffer of a page.
+  const T* get_buffer(const int32_t page = 0) const {
+    return buffer_.get() + size_.x() * size_.y() * page;
+  }
+
+  // Retrieve the image of a cached glyph in the buffer, rows are
+  // get_size().x() pixels apart. An area reserved by Set() with a null image
+  // is rendered through the pointer before the cache is modified again.
+  T* GetImage(const GlyphCacheEntry* entry) {
+    return buffer_.get() + entry->pos_.x() + entry->pos_.y() * size_.x();
+  }
+
+  // Getter of the cache size. (Size of a page.)
+  const mathfu::vec2i& get_size() const { return size_; }
+
+  // Getter of the number of allocated pages.
+  int32_t get_num_pages() const { return num_pages_; }
+
+  // Setter/Getter of the maximum number of pages.
+  // Reducing the limit does not release pages already allocated.
+  int32_t get_max_pages() const { return max_pages_; }
+  void set_max_pages(const int32_t max_pages) {
+    max_pages_ = std::max(max_pages, 1);
+  }
+
+  // Getter of the packing strategy.
+  GlyphCachePacking get_packing() const { return packing_; }
+
+ private:
+  // Remove all cache entries including pinned glyphs.
+  void Reset() {
+    map_entries_.Clear();
+    pinned_entries_.clear();
+    for (auto& lru : lru_entries_) {
+      lru.Clear();
+    }
+    used_area_ = 0;
+    for (auto& stats : partition_stats_) {
+      stats.num_glyphs = 0;
+      stats.used_area = 0;
+    }
+
+    // Return all rows to the pool.
+    list_row_.Clear();
+    lru_row_.Clear();
+    for (auto& height : row_heights_) {
+      height.Clear();
+    }
+    free_rows_.Clear();
+    for (size_t i = 0; i < rows_.size(); ++i) {
+      free_rows_.PushBack(static_cast<IntrusiveListIndex>(i),
+                          RowLinks(&rows_));
+    }
+
+    // Update cache revision.
+    UpdateRevision(true);
+
+    // Create first (empty) row entry or reset the packer of each page.
+    // Allocated pages are kept.
+    for (int32_t page = 0; page < num_pages_; ++page) {
+      ResetPage(page);
+    }
+
+    set_dirty_state(false);
+    compacted_ = true;
+  }
+
+  // Read a glyph record of a snapshot.
+  static GlyphCacheSnapshotGlyph GetSnapshotGlyph(const uint8_t* data,
+                                                  const uint32_t index) {
+    GlyphCacheSnapshotGlyph glyph;
+    memcpy(&glyph,
+           data + sizeof(GlyphCacheSnapshotHeader) +
+               sizeof(GlyphCacheSnapshotGlyph) * index,
+           sizeof(glyph));
+    return glyph;
+  }
+
+  // Mark a glyph as being used in current cycle.
+  void Touch(const FlatHashMapHandle handle) {
+    auto& entry = map_entries_.get_value(handle);
+    if (packing_ != kGlyphCachePackingRow) {
+      // Update glyph LRU entry.
+      entry.last_used_counter_ = counter_;
+      lru_entries_[entry.partition_].MoveToBack(handle,
+                                                EntryLinks(&map_entries_));
+      if (EvictionPolicy::kTrackFrequency) {
+        entry.frequency_.Increment(counter_);
+      }
+    } else {
+      // Mark the row as being used in current cycle.
+      auto& row = rows_[entry.row_];
+      row.set_last_used_counter(counter_);
+
+      // Update row LRU entry. The row is now most recently used.
+      lru_row_.MoveToBack(entry.row_, RowLruLinks(&rows_));
+      if (EvictionPolicy::kTrackFrequency) {
+        row.frequency_.Increment(counter_);
+      }
+    }
+  }
+
+  // Find the partition of a glyph.
+  int32_t FindPartition(const GlyphKey& key) const {
+    for (size_t i = 1; i < partitions_.size(); ++i) {
+      auto& partition = partitions_[i];
+      if ((partition.font_id == kNullHash ||
+           partition.font_id == key.get_font_id()) &&
+          (partition.max_glyph_size == 0 ||
+           key.get_glyph_size() <= partition.max_glyph_size)) {
+        return static_cast<int32_t>(i);
+      }
+    }
+    return 0;
+  }
+
+  // Check if a partition exceeds its quota by adding |area|. Then the
+  // partition can only evict its own glyphs.
+  bool IsOverQuota(const int32_t partition, const int32_t area) const {
+    if (partitions_.size() == 1) {
+      return false;
+    }
+    return static_cast<float>(partition_stats_[partition].used_area + area) >
+           partitions_[partition].quota *
+               static_cast<float>(size_.x() * size_.y() * num_pages_);
+  }
+
+  // Account glyphs added to (or removed from with negative values) a
+  // partition.
+  void AddUsedArea(const int32_t partition, const int32_t num_glyphs,
+                   const int32_t area) {
+    used_area_ += area;
+    partition_stats_[partition].num_glyphs += num_glyphs;
+    partition_stats_[partition].used_area += area;
+  }
+
+  // Retrieve the LRU list to evict a glyph from with the packer. A partition
+  // over its quota evicts its own glyphs, otherwise the least recently used
+  // glyph of all partitions is evicted.
+  IntrusiveList& GetVictimEntries(const int32_t partition,
+                                  const int32_t area) {
+    if (IsOverQuota(partition, area)) {
+      return lru_entries_[partition];
+    }
+    size_t victim = 0;
+    for (size_t i = 1; i < lru_entries_.size(); ++i) {
+      if (!lru_entries_[i].empty() &&
+          (lru_entries_[victim].empty() ||
+           map_entries_.get_value(lru_entries_[i].front()).last_used_counter_ <
+               map_entries_.get_value(lru_entries_[victim].front())
+                   .last_used_counter_)) {
+        victim = i;
+      }
+    }
+    return lru_entries_[victim];
+  }
+
+  // Set an entry to the cache, Set() returning the handle of the entry.
+  // The look up of an existing entry is not counted in the stats.
+  // Returns kInvalidFlatHashMapHandle if there is no room in the cache.
+  FlatHashMapHandle SetEntry(const T* const image, const GlyphKey& key,
+                             const GlyphCacheEntry& entry,
+                             const int32_t stride) {
     // Lookup entries if the entry is already stored in the cache.
-    auto p = Find(key);
-#ifdef GLYPH_CACHE_STATS
-    // Adjust debug variable.
-    stats_lookup_--;
-#endif
-    if (p) {
+    auto handle = map_entries_.Find(key);
+    if (handle != kInvalidFlatHashMapHandle) {
       // Make sure cached entry has same properties.
       // The cache only support one entry per a glyph code point for now.
-      assert(p->get_size().x() == entry.get_size().x());
-      assert(p->get_size().y() == entry.get_size().y());
-#ifdef GLYPH_CACHE_STATS
-      // Adjust debug variable.
-      stats_hit_--;
-#endif
-      return p;
+      assert(map_entries_.get_value(handle).get_size().x() ==
+             entry.get_size().x());
+      assert(map_entries_.get_value(handle).get_size().y() ==
+             entry.get_size().y());
+      Touch(handle);
+      return handle;
+    }
+
+    auto partition = FindPartition(key);
+    if (packing_ != kGlyphCachePackingRow) {
+      return SetPacked(image, key, entry, stride, partition);
     }
 
     // Adjust requested height & width.
@@ -363,258 +1170,1022 @@ class GlyphCache {
                            (kGlyphCacheHeightRound - 1)) &
                           ~(kGlyphCacheHeightRound - 1));
 
-    // Look up the row map to retrieve a row iterator to start with.
-    auto it = map_row_.lower_bound(req_height);
-    while (it != map_row_.end()) {
-      if (it->second->DoesFit(mathfu::vec2i(req_width, req_height))) {
-        break;
+    // Look up the row lists from the requested height to retrieve a row to
+    // start with.
+    auto req_size = mathfu::vec2i(req_width, req_height);
+    auto row_index = kIntrusiveListNull;
+    for (auto height = static_cast<size_t>(req_height / kGlyphCacheHeightRound);
+         height < row_heights_.size() && row_index == kIntrusiveListNull;
+         ++height) {
+      for (auto i = row_heights_[height].front(); i != kIntrusiveListNull;
+           i = rows_[i].link_height_.next) {
+        // A row holds glyphs of a single partition.
+        if (rows_[i].DoesFit(req_size) &&
+            (!rows_[i].get_num_glyphs() || rows_[i].partition_ == partition)) {
+          row_index = i;
+          break;
+        }
       }
-      it++;
     }
 
-    GlyphCacheEntry* ret;
-    if (it != map_row_.end()) {
+    if (row_index != kIntrusiveListNull) {
       // Found sufficient space in the buffer.
-      auto it_row = it->second;
-
-      if (it_row->get_num_glyphs() == 0) {
+      if (rows_[row_index].get_num_glyphs() == 0) {
         // Putting first entry to the row.
         // In this case, we create new empty row to track rest of free space.
-        auto original_height = it_row->get_size().y();
-        auto original_y_pos = it_row->get_y_pos();
+        auto original_height = rows_[row_index].get_size().y();
+        auto original_y_pos = rows_[row_index].get_y_pos();
 
         if (original_height - req_height >= kGlyphCacheHeightRound) {
           // Create new row for free space.
-          it_row->set_size(mathfu::vec2i(size_.x(), req_height));
-
-          // Update row height map key as well.
-          map_row_.erase(it_row->get_it_row_height_map());
-          auto it_map =
-              map_row_.insert(std::pair<int32_t, GlyphCacheEntry::iterator_row>(
-                  req_height, it_row));
-          it_row->set_it_row_height_map(it_map);
-
+          // Update row height list as well.
+          SetRowHeight(row_index, req_height);
           InsertNewRow(original_y_pos + req_height,
                        mathfu::vec2i(size_.x(), original_height - req_height),
-                       list_row_.end());
+                       row_index);
         }
+        rows_[row_index].partition_ = partition;
       }
+      auto& row = rows_[row_index];
 
       // Create new entry in the look-up map.
-      auto pair = map_entries_.insert(
-          std::pair<GlyphKey, std::unique_ptr<GlyphCacheEntry>>(
-              key,
-              std::unique_ptr<GlyphCacheEntry>(new GlyphCacheEntry(entry))));
-      auto it_entry = pair.first;
-      ret = it_entry->second.get();
+      handle = map_entries_.Insert(key, entry).first;
+      auto ret = &map_entries_.get_value(handle);
+      ret->partition_ = partition;
 
       // Reserve a region in the row.
-      auto pos = mathfu::vec2i(
-          it_row->Reserve(it_entry, mathfu::vec2i(req_width, req_height)),
-          it_row->get_y_pos());
+      auto pos =
+          mathfu::vec2i(row.Reserve(handle, req_size, EntryLinks(&map_entries_)),
+                        row.get_y_pos());
+      AddUsedArea(partition, 1,
+                  req_width * (entry.get_size().y() + kGlyphCachePaddingY));
 
-      // Store given image into the buffer.
-      CopyImage(pos, image, it_entry->second.get());
-
-      // Update UV of the entry.
-      mathfu::vec4 uv(
-          mathfu::vec2(pos) / mathfu::vec2(size_),
-          mathfu::vec2(pos + entry.get_size()) / mathfu::vec2(size_));
-      ret->set_uv(uv);
+      // Store given image into the buffer and update UV of the entry.
+      Store(pos, image, ret, stride);
 
       // Establish links.
-      ret->it_row = it_row;
-      ret->it_lru_row_ = it_row->get_it_lru_row();
+      ret->row_ = row_index;
 
       // Update row LRU entry.
-      lru_row_.splice(lru_row_.end(), lru_row_, it_row->get_it_lru_row());
-      it_row->set_last_used_counter(counter_);
+      lru_row_.MoveToBack(row_index, RowLruLinks(&rows_));
+      row.set_last_used_counter(counter_);
+      if (EvictionPolicy::kTrackFrequency) {
+        row.frequency_.Increment(counter_);
+      }
     } else {
       // Couldn't find sufficient row entry nor free space to create new row.
 
       // Try to find a row that is not used in current cycle and has enough
-      // height from LRU list.
-      for (auto row_it = lru_row_.begin(); row_it != lru_row_.end(); ++row_it) {
-        auto& row = *row_it;
-        if (row->get_last_used_counter() == counter_) {
+      // height, the lowest eviction score first. The LRU list is walked in
+      // order, so an ordered policy takes the first row.
+      // A partition over its quota only evicts its own rows.
+      auto own_rows = IsOverQuota(partition, req_width * req_height);
+      auto victim = kIntrusiveListNull;
+      uint64_t victim_score = 0;
+      for (auto i = lru_row_.front(); i != kIntrusiveListNull;
+           i = rows_[i].link_lru_.next) {
+        auto& row = rows_[i];
+        if (row.get_last_used_counter() == counter_) {
           // The row is being used in current rendering cycle.
           // We can not evict the row.
           continue;
         }
-        if (row->get_size().y() >= req_height) {
-          // Now flush & initialize the row.
-          FlushRow(row);
-          row->Initialize(row->get_y_pos(), row->get_size());
+        if (own_rows && row.get_num_glyphs() && row.partition_ != partition) {
+          continue;
+        }
+        if (row.get_size().y() >= req_height) {
+          auto score = GetRowScore(row);
+          if (victim == kIntrusiveListNull || score < victim_score) {
+            victim = i;
+            victim_score = score;
+          }
+          if (EvictionPolicy::kOrdered) {
+            break;
+          }
+        }
+      }
+      if (victim != kIntrusiveListNull) {
+        auto& row = rows_[victim];
+        if (counter_ - row.get_last_used_counter() < kGlyphCacheRecentCycles &&
+            Grow()) {
+          // Enlarge the cache rather than evicting recently used glyphs.
+          return SetEntry(image, key, entry, stride);
+        }
 
-          // Call the function recursively.
-          return Set(image, key, entry);
+        // Now flush & initialize the row.
+        FlushRow(victim);
+        row.Initialize(row.get_y_pos(), row.get_size());
+
+        // Call the function recursively.
+        return SetEntry(image, key, entry, stride);
+      }
+
+      // Try to evict multiple adjacent rows and merge them.
+      auto count = 0;
+      auto first =
+          FindEvictableRows(req_height, own_rows ? partition : -1, &count);
+      if (first != kIntrusiveListNull) {
+        for (auto i = first, n = 0; n < count; i = rows_[i].link_.next, ++n) {
+          FlushRow(i);
         }
+        MergeRows(first, count);
+
+        // Call the function recursively.
+        return SetEntry(image, key, entry, stride);
+      }
+      if (Grow()) {
+        // Enlarged the pages, try again.
+        return SetEntry(image, key, entry, stride);
+      }
+      if (num_pages_ < max_pages_) {
+        // Allocate new page and try again.
+        AddPage();
+        return SetEntry(image, key, entry, stride);
       }
-#ifdef GLYPH_CACHE_STATS
-      stats_set_fail_++;
-#endif
-      // TODO: Try to flush multiple rows and merge them to free up space.
-      // TODO: Evaluate re-allocate solution.
+      stats_.set_fails++;
+      partition_stats_[partition].set_fails++;
       // Now we don't have any space in the cache.
       // It's caller's responsivility to recover from the situation.
       // Possible work arounds are:
       // - Draw glyphs with current glyph cache contents and then flush them,
       // start new caching.
       // - Just increase cache size.
-      return nullptr;
+      return kInvalidFlatHashMapHandle;
     }
 
-    return ret;
+    return handle;
   }
 
-  // Flush all cache entries.
-  bool Flush() {
-#ifdef GLYPH_CACHE_STATS
-    ResetStats();
-#endif
-    map_entries_.clear();
-    lru_row_.clear();
-    list_row_.clear();
-    map_row_.clear();
+  // Set an entry to the cache using the packer.
+  // When the packer is full, glyphs that are not used in current cycle are
+  // evicted in LRU order until the request fits.
+  FlatHashMapHandle SetPacked(const T* const image, const GlyphKey& key,
+                              const GlyphCacheEntry& entry,
+                              const int32_t stride, const int32_t partition) {
+    auto req_size = entry.get_size() +
+                    mathfu::vec2i(kGlyphCachePaddingX, kGlyphCachePaddingY);
+    mathfu::vec2i pos;
+    int32_t page = 0;
+    while (page < num_pages_ && !packers_[page]->Reserve(req_size, &pos)) {
+      page++;
+    }
+    while (page >= num_pages_) {
+      auto& lru = GetVictimEntries(partition, req_size.x() * req_size.y());
+      if (lru.empty() ||
+          counter_ - map_entries_.get_value(lru.front()).last_used_counter_ <
+              kGlyphCacheRecentCycles) {
+        // Enlarge the cache rather than evicting recently used glyphs.
+        if (Grow()) {
+          return SetPacked(image, key, entry, stride, partition);
+        }
+      }
+      if (lru.empty() ||
+          map_entries_.get_value(lru.front()).last_used_counter_ == counter_) {
+        // Remaining glyphs are all used in current rendering cycle.
+        if (num_pages_ < max_pages_) {
+          // Allocate new page.
+          AddPage();
+          if (packers_[num_pages_ - 1]->Reserve(req_size, &pos)) {
+            page = num_pages_ - 1;
+            break;
+          }
+        }
+        stats_.set_fails++;
+        partition_stats_[partition].set_fails++;
+        return kInvalidFlatHashMapHandle;
+      }
+      // Evict a glyph and retry in the page that got some space back.
+      auto victim = SelectVictimEntry(lru);
+      auto evicted_page = map_entries_.get_value(victim).page_;
+      EvictEntry(victim);
+      if (packers_[evicted_page]->Reserve(req_size, &pos)) {
+        page = evicted_page;
+      }
+    }
+    pos.y() += page * size_.y();
+
+    // Create new entry in the look-up map.
+    auto handle = map_entries_.Insert(key, entry).first;
+    auto ret = &map_entries_.get_value(handle);
+    ret->last_used_counter_ = counter_;
+    ret->frequency_ = GlyphCacheFrequency();
+    if (EvictionPolicy::kTrackFrequency) {
+      ret->frequency_.Increment(counter_);
+    }
+    ret->partition_ = partition;
+    lru_entries_[partition].PushBack(handle, EntryLinks(&map_entries_));
+    AddUsedArea(partition, 1, req_size.x() * req_size.y());
+
+    // Store given image into the buffer and update UV of the entry.
+    Store(pos, image, ret, stride);
+    return handle;
+  }
+
+  // Select a glyph to evict from a LRU list with the packer. The least
+  // recently used glyph is not used in current cycle.
+  // An ordered policy takes the least recently used glyph. Otherwise the
+  // glyph with the lowest score among kGlyphCacheEvictionSamples least
+  // recently used glyphs is taken, so that the cost stays bounded.
+  GlyphCacheEntry::handle SelectVictimEntry(const IntrusiveList& lru) {
+    auto victim = lru.front();
+    if (EvictionPolicy::kOrdered) {
+      return victim;
+    }
+    auto victim_score = GetEntryScore(map_entries_.get_value(victim));
+    auto samples = 1;
+    for (auto i = map_entries_.get_value(victim).link_.next;
+         i != kIntrusiveListNull && samples < kGlyphCacheEvictionSamples;
+         i = map_entries_.get_value(i).link_.next, ++samples) {
+      auto& entry = map_entries_.get_value(i);
+      if (entry.last_used_counter_ == counter_) {
+        // Following glyphs are used in current cycle.
+        break;
+      }
+      auto score = GetEntryScore(entry);
+      if (score < victim_score) {
+        victim = i;
+        victim_score = score;
+      }
+    }
+    return victim;
+  }
+
+  // Eviction scores of a row and a glyph.
+  uint64_t GetRowScore(const GlyphCacheRow& row) const {
+    return EvictionPolicy::Score(row.get_last_used_counter(),
+                                 row.frequency_.Get(counter_),
+                                 row.get_size().x() * row.get_size().y());
+  }
+  uint64_t GetEntryScore(const GlyphCacheEntry& entry) const {
+    return EvictionPolicy::Score(
+        entry.last_used_counter_, entry.frequency_.Get(counter_),
+        (entry.get_size().x() + kGlyphCachePaddingX) *
+            (entry.get_size().y() + kGlyphCachePaddingY));
+  }
+
+  // Evict single glyph entry and return its area to the packer.
+  void EvictEntry(const GlyphCacheEntry::handle handle) {
+    auto entry = &map_entries_.get_value(handle);
+    eviction_policy_.OnEvict(
+        1, counter_ - entry->last_used_counter_ < kGlyphCacheRecentCycles,
+        entry->frequency_.Get(counter_));
+    auto req_size = entry->get_size() +
+                    mathfu::vec2i(kGlyphCachePaddingX, kGlyphCachePaddingY);
+    packers_[entry->page_]->Release(
+        entry->pos_ - mathfu::vec2i(0, entry->page_ * size_.y()), req_size);
+    AddUsedArea(entry->partition_, -1, -req_size.x() * req_size.y());
+    partition_stats_[entry->partition_].evictions++;
+    lru_entries_[entry->partition_].Remove(handle, EntryLinks(&map_entries_));
+    map_entries_.Erase(handle);
+    compacted_ = false;
 
     // Update cache revision.
-    revision_ = counter_;
+    UpdateRevision(false);
+
+    stats_.evictions++;
+  }
+
+  // Store given image into the buffer and update position, page and UV of
+  // the entry.
+  // stride: width of the source image buffer, 0 for the glyph width.
+  void Store(const mathfu::vec2i& pos, const T* const image,
+             GlyphCacheEntry* entry, const int32_t stride = 0) {
+    CopyImage(pos, image, entry, stride ? stride : entry->get_size().x());
+    compacted_ = false;
+    entry->pos_ = pos;
+    SetUV(entry);
+  }
 
-    // Create first (empty) row entry.
-    InsertNewRow(0, size_, list_row_.end());
+  // Update page and UV of the entry from its position.
+  void SetUV(GlyphCacheEntry* entry) {
+    entry->page_ = entry->pos_.y() / size_.y();
+    auto page_pos = entry->pos_ - mathfu::vec2i(0, entry->page_ * size_.y());
+    entry->set_uv(mathfu::vec4(
+        mathfu::vec2(page_pos) / mathfu::vec2(size_),
+        mathfu::vec2(page_pos + entry->get_size()) / mathfu::vec2(size_)));
+  }
+
+  // Update the cache revision.
+  // force: false updates the revision once a cycle. It's sufficient when
+  // entries are evicted because entries fetched after the eviction are still
+  // valid. true is needed when UVs of existing entries are changed.
+  void UpdateRevision(const bool force) {
+    if (force || revision_counter_ != counter_) {
+      revision_++;
+      revision_counter_ = counter_;
+    }
+  }
+
+  // Double the page size if it's smaller than the maximum size. The smaller
+  // dimension is enlarged first.
+  // Return value: true if the cache has grown.
+  bool Grow() {
+    auto size = size_;
+    if (size.x() < max_size_.x() &&
+        (size.x() <= size.y() || size.y() >= max_size_.y())) {
+      size.x() *= 2;
+    } else if (size.y() < max_size_.y()) {
+      size.y() *= 2;
+    } else {
+      return false;
+    }
 
-    dirty_ = false;
+    // Copy the pages to the enlarged buffer.
+    auto buffer = AllocateBuffer(size, num_pages_);
+    for (int32_t page = 0; page < num_pages_; ++page) {
+      for (int32_t y = 0; y < size_.y(); ++y) {
+        memcpy(buffer.get() + (page * size.y() + y) * size.x(),
+               buffer_.get() + (page * size_.y() + y) * size_.x(),
+               size_.x() * sizeof(T));
+      }
+    }
+    buffer_ = std::move(buffer);
+
+    // Relocate entries to the new page origins and rescale UVs.
+    auto old_size = size_;
+    size_ = size;
+    map_entries_.ForEach([this, &old_size](FlatHashMapHandle,
+                                           const GlyphKey&,
+                                           GlyphCacheEntry& entry) {
+      entry.pos_.y() += entry.page_ * (size_.y() - old_size.y());
+      SetUV(&entry);
+    });
+
+    if (packing_ != kGlyphCachePackingRow) {
+      for (auto& packer : packers_) {
+        packer->Grow(size_);
+      }
+    } else {
+      row_heights_.resize(size_.y() / kGlyphCacheHeightRound + 1);
+      rows_.reserve(num_pages_ * size_.y() / kGlyphCacheHeightRound);
+
+      // Relocate and widen rows and remember the last row of each page.
+      auto delta_width = size_.x() - old_size.x();
+      page_rows_.assign(num_pages_, kIntrusiveListNull);
+      for (auto i = list_row_.front(); i != kIntrusiveListNull;
+           i = rows_[i].link_.next) {
+        auto& row = rows_[i];
+        auto page = row.get_y_pos() / old_size.y();
+        row.set_y_pos(row.get_y_pos() + page * (size_.y() - old_size.y()));
+        row.set_size(mathfu::vec2i(size_.x(), row.get_size().y()));
+        row.remaining_width_ += delta_width;
+        page_rows_[page] = i;
+      }
 
+      // Add the area below existing rows of each page.
+      auto delta_height = size_.y() - old_size.y();
+      if (delta_height) {
+        for (int32_t page = 0; page < num_pages_; ++page) {
+          auto last = page_rows_[page];
+          if (rows_[last].get_num_glyphs() == 0) {
+            SetRowHeight(last, rows_[last].get_size().y() + delta_height);
+          } else {
+            InsertNewRow(page * size_.y() + old_size.y(),
+                         mathfu::vec2i(size_.x(), delta_height), last);
+          }
+        }
+      }
+    }
+
+    // Whole pages need to be uploaded again.
+    for (int32_t page = 0; page < num_pages_; ++page) {
+      SetPageDirty(page);
+    }
+    UpdateRevision(true);
+    shrink_check_cycles_ = 0;
+    stats_.grows++;
     return true;
   }
 
-  // Increment a cycle counter of the cache.
-  // Invoke this API for each rendering cycle.
-  // The counter is used to determine which cache entries can be evicted when
-  // cache entries are full.
-  void Update() { counter_++; }
+  // Halve the page size and store cached glyphs again.
+  // Glyphs that don't fit in the smaller cache are evicted.
+  void Shrink() {
+    auto size = size_;
+    if (size.x() > min_size_.x() &&
+        (size.x() >= size.y() || size.y() <= min_size_.y())) {
+      size.x() /= 2;
+    } else if (size.y() > min_size_.y()) {
+      size.y() /= 2;
+    } else {
+      return;
+    }
 
-  // Debug API to show cache statistics.
-  void Status() {
-#ifdef GLYPH_CACHE_STATS
-    LogInfo("Cache size: %dx%d", size_.x(), size_.y());
-    LogInfo("Cache hit: %d / %d", stats_hit_, stats_lookup_);
+    // Save the cached glyphs, most recently used ones last.
+    std::vector<std::pair<GlyphKey, GlyphCacheEntry>> entries;
+    entries.reserve(map_entries_.size());
+    map_entries_.ForEach([this, &entries](FlatHashMapHandle,
+                                          const GlyphKey& key,
+                                          GlyphCacheEntry& entry) {
+      entries.push_back(std::make_pair(key, entry));
+      entries.back().second.last_used_counter_ = GetLastUsedCounter(entry);
+    });
+    std::sort(entries.begin(), entries.end(),
+              [](const std::pair<GlyphKey, GlyphCacheEntry>& a,
+                 const std::pair<GlyphKey, GlyphCacheEntry>& b) {
+                return a.second.last_used_counter_ <
+                       b.second.last_used_counter_;
+              });
+    auto old_buffer = std::move(buffer_);
+    auto old_size = size_;
+
+    // Reset the cache with the new size.
+    size_ = size;
+    buffer_ = AllocateBuffer(size_, num_pages_);
+    if (packing_ == kGlyphCachePackingRow) {
+      row_heights_.resize(size_.y() / kGlyphCacheHeightRound + 1);
+    }
+    Reset();
+
+    // Store the glyphs again without growing the cache or adding pages.
+    auto max_size = max_size_;
+    auto max_pages = max_pages_;
+    max_size_ = size_;
+    max_pages_ = num_pages_;
+    // Pinned glyphs are stored first, glyphs that don't fit are skipped so
+    // that smaller ones still get stored.
+    for (auto pinned : {true, false}) {
+      for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        // Positions are rows of the whole old buffer, including the page.
+        auto& entry = it->second;
+        if (entry.pinned_ != pinned) {
+          continue;
+        }
+        auto pos = entry.get_pos();
+        auto handle =
+            SetEntry(old_buffer.get() + pos.x() + pos.y() * old_size.x(),
+                     it->first, entry, old_size.x());
+        if (handle == kInvalidFlatHashMapHandle) {
+          if (pinned) {
+            LogError("A pinned glyph doesn't fit in the shrunk glyph cache.");
+          }
+          continue;
+        }
+        if (pinned) {
+          pinned_entries_.push_back(handle);
+        }
+      }
+    }
+    max_size_ = max_size;
+    max_pages_ = max_pages;
 
-    auto total_glyph = 0;
-    for (auto row : list_row_) {
-      LogInfo("Row start:%d height:%d glyphs:%d counter:%d", row.get_y_pos(),
-              row.get_size().y(), row.get_num_glyphs(),
-              row.get_last_used_counter());
-      total_glyph += row.get_num_glyphs();
+    // Stored glyphs are marked as used in current cycle so that they don't
+    // evict each other, restore their LRU order afterwards.
+    RestoreLastUsedCounters(entries);
+
+    for (int32_t page = 0; page < num_pages_; ++page) {
+      SetPageDirty(page);
     }
-    LogInfo("Cached glyphs: %d", total_glyph);
-    LogInfo("Row flush: %d", stats_row_flush_);
-    LogInfo("Set fail: %d", stats_set_fail_);
-#endif
   }
 
-  // Getter/Setter of the counter.
-  uint32_t get_revision() const { return revision_; }
-  void set_revision(const uint32_t revision) { revision_ = revision; }
+  // Restore the last used counters of glyphs stored again by Shrink() and
+  // sort the LRU lists by the counters.
+  // entries: the saved glyphs, least recently used first.
+  void RestoreLastUsedCounters(
+      const std::vector<std::pair<GlyphKey, GlyphCacheEntry>>& entries) {
+    for (auto& it : entries) {
+      auto handle = map_entries_.Find(it.first);
+      if (handle == kInvalidFlatHashMapHandle) {
+        continue;
+      }
+      auto& entry = map_entries_.get_value(handle);
+      entry.last_used_counter_ = it.second.last_used_counter_;
+      if (packing_ != kGlyphCachePackingRow) {
+        lru_entries_[entry.partition_].MoveToBack(handle,
+                                                  EntryLinks(&map_entries_));
+      }
+    }
+    if (packing_ != kGlyphCachePackingRow) {
+      return;
+    }
 
-  // Getter/Setter of dirty state.
-  bool get_dirty_state() const { return dirty_; };
-  void set_dirty_state(const bool dirty) { dirty_ = dirty; }
+    // A row is as recent as its most recently used glyph.
+    std::vector<bool> counted(rows_.size(), false);
+    map_entries_.ForEach([this, &counted](FlatHashMapHandle, const GlyphKey&,
+                                          GlyphCacheEntry& entry) {
+      auto& row = rows_[entry.row_];
+      if (!counted[entry.row_] ||
+          counter_ - entry.last_used_counter_ <
+              counter_ - row.get_last_used_counter()) {
+        row.set_last_used_counter(entry.last_used_counter_);
+        counted[entry.row_] = true;
+      }
+    });
+    std::vector<IntrusiveListIndex> rows;
+    for (auto i = list_row_.front(); i != kIntrusiveListNull;
+         i = rows_[i].link_.next) {
+      rows.push_back(i);
+    }
+    std::stable_sort(rows.begin(), rows.end(),
+                     [this](IntrusiveListIndex a, IntrusiveListIndex b) {
+                       return counter_ - rows_[a].get_last_used_counter() >
+                              counter_ - rows_[b].get_last_used_counter();
+                     });
+    for (auto i : rows) {
+      lru_row_.MoveToBack(i, RowLruLinks(&rows_));
+    }
+  }
 
-  // Getter of dirty rect.
-  const mathfu::vec4i& get_dirty_rect() const { return dirty_rect_; }
+  // Retrieve the cycle counter when a glyph is used last time.
+  uint32_t GetLastUsedCounter(const GlyphCacheEntry& entry) const {
+    return packing_ != kGlyphCachePackingRow
+               ? entry.last_used_counter_
+               : rows_[entry.row_].get_last_used_counter();
+  }
 
-  // Getter of allocated glyph cache buffer.
-  const T* get_buffer() const { return buffer_.get(); }
+  // Retrieve a ratio of the buffer area occupied by glyphs used within
+  // |cycles| cycles.
+  float GetRecentOccupancy(const uint32_t cycles) {
+    int32_t area = 0;
+    map_entries_.ForEach([this, &area, cycles](FlatHashMapHandle,
+                                               const GlyphKey&,
+                                               GlyphCacheEntry& entry) {
+      if (counter_ - GetLastUsedCounter(entry) < cycles) {
+        area += (entry.get_size().x() + kGlyphCachePaddingX) *
+                (entry.get_size().y() + kGlyphCachePaddingY);
+      }
+    });
+    return static_cast<float>(area) /
+           static_cast<float>(size_.x() * size_.y() * num_pages_);
+  }
 
-  // Getter of the cache size.
-  const mathfu::vec2i& get_size() const { return size_; }
+  // Allocate a cleared buffer for pages.
+  static std::unique_ptr<T[]> AllocateBuffer(const mathfu::vec2i& size,
+                                             const int32_t num_pages) {
+    auto area = size.x() * size.y() * num_pages;
+    std::unique_ptr<T[]> buffer(new T[area]);
+    // A buffer format can be 8/32 bpp (32 bpp is mostly used for Emoji).
+    const int32_t kCacheClearValue = 0x0;
+    memset(buffer.get(), kCacheClearValue, area * sizeof(T));
+    return buffer;
+  }
+
+  // Allocate new page at the end of the buffer.
+  void AddPage() {
+    auto page_size = size_.x() * size_.y();
+    std::unique_ptr<T[]> buffer(new T[page_size * (num_pages_ + 1)]);
+    if (num_pages_) {
+      memcpy(buffer.get(), buffer_.get(), page_size * num_pages_ * sizeof(T));
+    }
+
+    // Clearing allocated page.
+    // A buffer format can be 8/32 bpp (32 bpp is mostly used for Emoji).
+    const int32_t kCacheClearValue = 0x0;
+    memset(buffer.get() + page_size * num_pages_, kCacheClearValue,
+           page_size * sizeof(T));
+    buffer_ = std::move(buffer);
+
+    dirty_rects_.resize(num_pages_ + 1);
+    dirty_rects_[num_pages_].clear();
+    switch (packing_) {
+      case kGlyphCachePackingRow:
+        // Reserve the row pool for the worst case so that the pool never
+        // reallocates afterwards.
+        rows_.reserve((num_pages_ + 1) * size_.y() / kGlyphCacheHeightRound);
+        break;
+      case kGlyphCachePackingSkyline:
+        packers_.push_back(
+            std::unique_ptr<GlyphCachePacker>(new SkylinePacker()));
+        break;
+      case kGlyphCachePackingGuillotine:
+        packers_.push_back(
+            std::unique_ptr<GlyphCachePacker>(new GuillotinePacker()));
+        break;
+    }
+    ResetPage(num_pages_++);
+  }
+
+  // Create first (empty) row entry of a page or reset the packer of a page.
+  void ResetPage(const int32_t page) {
+    if (packing_ != kGlyphCachePackingRow) {
+      packers_[page]->Reset(size_);
+    } else {
+      InsertNewRow(page * size_.y(), size_, list_row_.back());
+    }
+  }
 
- private:
   // Insert new row to the row list with a given size.
   // It tries to merge 2 rows if next row is also empty one.
   void InsertNewRow(const int32_t y_pos, const mathfu::vec2i& size,
-                    const GlyphCacheEntry::iterator_row pos) {
+                    const IntrusiveListIndex pos) {
     // First, check if we can merge the requested row with next row to free up
     // more spaces.
     // New row is always inserted right after valid row entry. So we don't have
-    // to check previous row entry to merge.
-    if (pos != list_row_.end()) {
-      auto next_entry = std::next(pos);
-      if (next_entry->get_num_glyphs() == 0) {
+    // to check previous row entry to merge. Rows in different pages are never
+    // merged.
+    if (pos != kIntrusiveListNull && (y_pos + size.y()) % size_.y()) {
+      auto next = rows_[pos].link_.next;
+      if (next != kIntrusiveListNull && rows_[next].get_num_glyphs() == 0) {
         // We can merge them.
-        mathfu::vec2i next_size = next_entry->get_size();
-        next_size.y() += size.y();
-        next_entry->set_y_pos(next_entry->get_y_pos() - size.y());
-        next_entry->set_size(next_size);
-        next_entry->set_last_used_counter(counter_);
+        auto& next_entry = rows_[next];
+        next_entry.set_y_pos(next_entry.get_y_pos() - size.y());
+        SetRowHeight(next, next_entry.get_size().y() + size.y());
+        next_entry.set_last_used_counter(counter_);
         return;
       }
     }
 
-    // Insert new row.
-    auto it = list_row_.insert(pos, GlyphCacheRow(y_pos, size));
-    auto it_lru_row = lru_row_.insert(lru_row_.end(), it);
-    auto it_map = map_row_.insert(
-        std::pair<int32_t, GlyphCacheEntry::iterator_row>(size.y(), it));
+    // Insert new row. A row is taken from the pool if available.
+    auto index = free_rows_.PopFront(RowLinks(&rows_));
+    if (index == kIntrusiveListNull) {
+      index = static_cast<IntrusiveListIndex>(rows_.size());
+      rows_.push_back(GlyphCacheRow());
+    }
+    rows_[index].Initialize(y_pos, size);
+    list_row_.InsertAfter(pos, index, RowLinks(&rows_));
+    lru_row_.PushBack(index, RowLruLinks(&rows_));
+    row_heights_[size.y() / kGlyphCacheHeightRound].PushBack(
+        index, RowHeightLinks(&rows_));
+  }
 
-    // Update a link.
-    it->set_it_lru_row(it_lru_row);
-    it->set_it_row_height_map(it_map);
+  // Update the height of a row and move it to the list of the new height.
+  void SetRowHeight(const IntrusiveListIndex index, const int32_t height) {
+    auto& row = rows_[index];
+    row_heights_[row.get_size().y() / kGlyphCacheHeightRound].Remove(
+        index, RowHeightLinks(&rows_));
+    row.set_size(mathfu::vec2i(row.get_size().x(), height));
+    row_heights_[height / kGlyphCacheHeightRound].PushBack(
+        index, RowHeightLinks(&rows_));
   }
 
-  void FlushRow(const GlyphCacheEntry::iterator_row row) {
+  void FlushRow(const IntrusiveListIndex index) {
+    auto& row = rows_[index];
+    if (row.get_num_glyphs()) {
+      eviction_policy_.OnEvict(
+          row.get_num_glyphs(),
+          counter_ - row.get_last_used_counter() < kGlyphCacheRecentCycles,
+          row.frequency_.Get(counter_));
+      partition_stats_[row.partition_].evictions++;
+    }
+
     // Erase cached glyphs from look-up map.
-    auto& entries = row->get_cached_entries();
-    for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
-      map_entries_.erase(*entry);
+    auto& entries = row.get_cached_entries();
+    for (auto handle = entries.front(); handle != kIntrusiveListNull;) {
+      auto& entry = map_entries_.get_value(handle);
+      auto next = entry.link_.next;
+      auto size = entry.get_size();
+      AddUsedArea(
+          row.partition_, -1,
+          -(size.x() + kGlyphCachePaddingX) * (size.y() + kGlyphCachePaddingY));
+      map_entries_.Erase(handle);
+      handle = next;
     }
+    entries.Clear();
+    compacted_ = false;
 
     // Update cache revision.
-    // It's setting revision equal to the current counter value so that it just
-    // change the revision once a rendering cycle even multiple cache flush
+    // The revision is updated once a rendering cycle even multiple cache flush
     // happens in a cycle.
-    revision_ = counter_;
+    UpdateRevision(false);
+
+    stats_.evictions++;
+  }
+
+  // Find adjacent rows in a page that are not used in current cycle and have
+  // enough height in total. Prefers rows with the lowest eviction score.
+  // partition: if not negative, only rows of the partition are evicted.
+  // Returns the first row and the number of rows, kIntrusiveListNull if no
+  // rows are found.
+  IntrusiveListIndex FindEvictableRows(const int32_t height,
+                                       const int32_t partition,
+                                       int32_t* count) {
+    auto best = kIntrusiveListNull;
+    uint64_t best_score = 0;
+    for (auto first = list_row_.front(); first != kIntrusiveListNull;
+         first = rows_[first].link_.next) {
+      auto page = rows_[first].get_y_pos() / size_.y();
+      auto total_height = 0;
+      uint64_t score = 0;
+      auto n = 0;
+      for (auto i = first; i != kIntrusiveListNull; i = rows_[i].link_.next) {
+        auto& row = rows_[i];
+        if (row.get_y_pos() / size_.y() != page ||
+            (row.get_num_glyphs() &&
+             (row.get_last_used_counter() == counter_ ||
+              (partition >= 0 && row.partition_ != partition)))) {
+          break;
+        }
+        if (row.get_num_glyphs()) {
+          score = EvictionPolicy::Combine(score, GetRowScore(row));
+        }
+        total_height += row.get_size().y();
+        n++;
+        if (total_height >= height) {
+          if (best == kIntrusiveListNull || score < best_score) {
+            best = first;
+            best_score = score;
+            *count = n;
+          }
+          break;
+        }
+      }
+    }
+    return best;
+  }
+
+  // Merge |count| adjacent empty rows starting from |first| into one row.
+  void MergeRows(const IntrusiveListIndex first, const int32_t count) {
+    auto height = rows_[first].get_size().y();
+    for (auto n = 1; n < count; ++n) {
+      auto next = rows_[first].link_.next;
+      assert(rows_[next].get_num_glyphs() == 0);
+      height += rows_[next].get_size().y();
+      list_row_.Remove(next, RowLinks(&rows_));
+      lru_row_.Remove(next, RowLruLinks(&rows_));
+      row_heights_[rows_[next].get_size().y() / kGlyphCacheHeightRound].Remove(
+          next, RowHeightLinks(&rows_));
+      free_rows_.PushBack(next, RowLinks(&rows_));
+    }
+    SetRowHeight(first, height);
+    auto& row = rows_[first];
+    row.Initialize(row.get_y_pos(), row.get_size());
+  }
+
+  // Find a row other than |source| in the same partition that has a room for
+  // a glyph, the shortest row first.
+  // simulate: use the planned remaining widths in compaction_widths_.
+  IntrusiveListIndex FindCompactionRow(const IntrusiveListIndex source,
+                                       const mathfu::vec2i& size,
+                                       const bool simulate) {
+    for (auto height = static_cast<size_t>(size.y() / kGlyphCacheHeightRound);
+         height < row_heights_.size(); ++height) {
+      for (auto i = row_heights_[height].front(); i != kIntrusiveListNull;
+           i = rows_[i].link_height_.next) {
+        // Empty rows are left for new glyphs.
+        if (i == source || !rows_[i].get_num_glyphs() ||
+            rows_[i].partition_ != rows_[source].partition_) {
+          continue;
+        }
+        auto width = simulate ? compaction_widths_[i]
+                              : rows_[i].get_remaining_width();
+        if (width >= size.x()) {
+          return i;
+        }
+      }
+    }
+    return kIntrusiveListNull;
+  }
+
+  // Required row area of a glyph with the row allocator.
+  static mathfu::vec2i GetRowRequestSize(const GlyphCacheEntry& entry) {
+    return mathfu::vec2i(entry.get_size().x() + kGlyphCachePaddingX,
+                         ((entry.get_size().y() + kGlyphCachePaddingY +
+                           (kGlyphCacheHeightRound - 1)) &
+                          ~(kGlyphCacheHeightRound - 1)));
+  }
+
+  // Compaction step of the row allocator.
+  bool CompactRows() {
+    // Candidates are rows using less than half of their width, sparsest
+    // first.
+    compaction_rows_.clear();
+    for (auto i = list_row_.front(); i != kIntrusiveListNull;
+         i = rows_[i].link_.next) {
+      auto& row = rows_[i];
+      if (row.get_num_glyphs() &&
+          row.get_remaining_width() * 2 >= row.get_size().x()) {
+        compaction_rows_.push_back(i);
+      }
+    }
+    std::sort(compaction_rows_.begin(), compaction_rows_.end(),
+              [this](IntrusiveListIndex a, IntrusiveListIndex b) {
+                return rows_[a].get_remaining_width() >
+                       rows_[b].get_remaining_width();
+              });
+
+    for (auto source : compaction_rows_) {
+      auto& row = rows_[source];
+      auto& entries = row.get_cached_entries();
+
+      // Make sure all glyphs in the row can be moved before moving any.
+      compaction_widths_.resize(rows_.size());
+      for (size_t i = 0; i < rows_.size(); ++i) {
+        compaction_widths_[i] = rows_[i].get_remaining_width();
+      }
+      auto movable = true;
+      for (auto handle = entries.front(); handle != kIntrusiveListNull && movable;
+           handle = map_entries_.get_value(handle).link_.next) {
+        auto size = GetRowRequestSize(map_entries_.get_value(handle));
+        auto dest = FindCompactionRow(source, size, true);
+        if (dest == kIntrusiveListNull) {
+          movable = false;
+        } else {
+          compaction_widths_[dest] -= size.x();
+        }
+      }
+      if (!movable) continue;
+
+      // Move the glyphs.
+      for (auto handle = entries.front(); handle != kIntrusiveListNull;) {
+        auto& entry = map_entries_.get_value(handle);
+        auto next = entry.link_.next;
+        auto size = GetRowRequestSize(entry);
+        auto dest = FindCompactionRow(source, size, false);
+        assert(dest != kIntrusiveListNull);
+        entries.Remove(handle, EntryLinks(&map_entries_));
+        auto& dest_row = rows_[dest];
+        auto pos = mathfu::vec2i(
+            dest_row.Reserve(handle, size, EntryLinks(&map_entries_)),
+            dest_row.get_y_pos());
+        dest_row.set_last_used_counter(std::max(
+            dest_row.get_last_used_counter(), row.get_last_used_counter()));
+        entry.row_ = dest;
+        MoveImage(pos, &entry);
+        handle = next;
+      }
 
-#ifdef GLYPH_CACHE_STATS
-    stats_row_flush_++;
-#endif
+      // Merge the emptied row with neighboring empty rows in the page.
+      row.Initialize(row.get_y_pos(), row.get_size());
+      auto page = row.get_y_pos() / size_.y();
+      auto first = source;
+      for (auto prev = row.link_.prev;
+           prev != kIntrusiveListNull && !rows_[prev].get_num_glyphs() &&
+           rows_[prev].get_y_pos() / size_.y() == page;
+           prev = rows_[prev].link_.prev) {
+        first = prev;
+      }
+      auto count = 0;
+      for (auto i = first; i != kIntrusiveListNull && !rows_[i].get_num_glyphs() &&
+                           rows_[i].get_y_pos() / size_.y() == page;
+           i = rows_[i].link_.next) {
+        count++;
+      }
+      MergeRows(first, count);
+      return true;
+    }
+    return false;
   }
 
-  // Copy glyph image into the buffer.
+  // Compaction step of the packer.
+  bool CompactPacked() {
+    // Find the glyph placed at the bottom most position of the buffer.
+    auto handle = kIntrusiveListNull;
+    auto bottom = 0;
+    for (auto& lru : lru_entries_) {
+      for (auto i = lru.front(); i != kIntrusiveListNull;
+           i = map_entries_.get_value(i).link_.next) {
+        auto& entry = map_entries_.get_value(i);
+        if (handle == kIntrusiveListNull ||
+            entry.pos_.y() + entry.size_.y() > bottom) {
+          handle = i;
+          bottom = entry.pos_.y() + entry.size_.y();
+        }
+      }
+    }
+    if (handle == kIntrusiveListNull) {
+      return false;
+    }
+
+    // Move the glyph if the packer finds a higher position for it.
+    auto& entry = map_entries_.get_value(handle);
+    auto req_size = entry.get_size() +
+                    mathfu::vec2i(kGlyphCachePaddingX, kGlyphCachePaddingY);
+    for (auto page = 0; page <= entry.page_; ++page) {
+      mathfu::vec2i pos;
+      if (!packers_[page]->Reserve(req_size, &pos)) continue;
+      if (page == entry.page_ &&
+          pos.y() >= entry.pos_.y() - page * size_.y()) {
+        packers_[page]->Release(pos, req_size);
+        return false;
+      }
+      packers_[entry.page_]->Release(
+          entry.pos_ - mathfu::vec2i(0, entry.page_ * size_.y()), req_size);
+      MoveImage(pos + mathfu::vec2i(0, page * size_.y()), &entry);
+      return true;
+    }
+    return false;
+  }
+
+  // Move the image of a cached glyph within the buffer and update the entry.
+  void MoveImage(const mathfu::vec2i& pos, GlyphCacheEntry* entry) {
+    auto from = entry->pos_;
+    Store(pos, buffer_.get() + from.x() + from.y() * size_.x(), entry,
+          size_.x());
+    stats_.compaction_moves++;
+  }
+
+  // Copy glyph image into the buffer, or clear the area if the image is
+  // nullptr.
   void CopyImage(const mathfu::vec2i& pos, const T* const image,
-                 const GlyphCacheEntry* entry) {
+                 const GlyphCacheEntry* entry, const int32_t stride) {
     auto buffer = buffer_.get();
     auto size = entry->get_size().x() * sizeof(T);
     for (int32_t y = 0; y < entry->get_size().y(); ++y) {
-      memcpy(buffer + pos.x() + (pos.y() + y) * size_.x(),
-             image + y * entry->get_size().x(), size);
+      auto dest = buffer + pos.x() + (pos.y() + y) * size_.x();
+      if (image != nullptr) {
+        memcpy(dest, image + y * stride, size);
+      } else {
+        memset(dest, 0, size);
+      }
     }
-    UpdateDirtyRect(mathfu::vec4i(pos, pos + entry->get_size()));
+    auto page = pos.y() / size_.y();
+    auto page_pos = pos - mathfu::vec2i(0, page * size_.y());
+    UpdateDirtyRect(page,
+                    mathfu::vec4i(page_pos, page_pos + entry->get_size()));
   }
 
-  // Update dirty rect.
-  void UpdateDirtyRect(const mathfu::vec4i& rect) {
-    if (!dirty_) {
-      // Initialize dirty rect.
-      dirty_rect_ = mathfu::vec4i(size_, mathfu::kZeros2i);
+  // Add a dirty rect to a page.
+  // The rect is merged with existing rects that are close enough, so that the
+  // list stays short and rects never overlap.
+  void UpdateDirtyRect(const int32_t page, const mathfu::vec4i& rect) {
+    dirty_ = true;
+    auto& rects = dirty_rects_[page];
+    auto dirty_rect = mathfu::vec4i(
+        rect.x() & ~(kGlyphCacheDirtyRectAlignX - 1),
+        rect.y(),
+        std::min((rect.z() + kGlyphCacheDirtyRectAlignX - 1) &
+                     ~(kGlyphCacheDirtyRectAlignX - 1),
+                 size_.x()),
+        rect.w());
+
+    // Merge the rect with existing rects until nothing can be merged. A merged
+    // rect can reach other rects, so the list is scanned again after a merge.
+    auto merged = true;
+    while (merged) {
+      merged = false;
+      for (size_t i = 0; i < rects.size(); ++i) {
+        auto bounds = GetBounds(rects[i], dirty_rect);
+        if (Overlaps(rects[i], dirty_rect) ||
+            GetArea(bounds) <= GetArea(rects[i]) + GetArea(dirty_rect) +
+                                   kGlyphCacheDirtyRectMergeSlack) {
+          dirty_rect = bounds;
+          rects[i] = rects.back();
+          rects.pop_back();
+          merged = true;
+          break;
+        }
+      }
     }
 
+    if (rects.size() >= kGlyphCacheMaxDirtyRects) {
+      // Too many rects, merge with the rect that grows least.
+      auto best = rects.begin();
+      auto best_cost = std::numeric_limits<int32_t>::max();
+      for (auto it = rects.begin(); it != rects.end(); ++it) {
+        auto cost = GetArea(GetBounds(*it, dirty_rect)) - GetArea(*it);
+        if (cost < best_cost) {
+          best = it;
+          best_cost = cost;
+        }
+      }
+      auto bounds = GetBounds(*best, dirty_rect);
+      rects.erase(best);
+      UpdateDirtyRect(page, bounds);
+      return;
+    }
+    rects.push_back(dirty_rect);
+  }
+
+  // Mark a whole page dirty.
+  void SetPageDirty(const int32_t page) {
     dirty_ = true;
-    dirty_rect_ =
-        mathfu::vec4i(mathfu::vec2i::Min(dirty_rect_.xy(), rect.xy()),
-                      mathfu::vec2i::Max(dirty_rect_.zw(), rect.zw()));
+    dirty_rects_[page].clear();
+    dirty_rects_[page].push_back(mathfu::vec4i(mathfu::kZeros2i, size_));
   }
 
-#ifdef GLYPH_CACHE_STATS
-  void ResetStats() {
-    // Initialize debug variables.
-    stats_hit_ = 0;
-    stats_lookup_ = 0;
-    stats_row_flush_ = 0;
-    stats_set_fail_ = 0;
+  // Helpers of dirty rect calculation.
+  static int32_t GetArea(const mathfu::vec4i& rect) {
+    return (rect.z() - rect.x()) * (rect.w() - rect.y());
+  }
+  static mathfu::vec4i GetBounds(const mathfu::vec4i& a,
+                                 const mathfu::vec4i& b) {
+    return mathfu::vec4i(mathfu::vec2i::Min(a.xy(), b.xy()),
+                         mathfu::vec2i::Max(a.zw(), b.zw()));
+  }
+  static bool Overlaps(const mathfu::vec4i& a, const mathfu::vec4i& b) {
+    return a.x() < b.z() && b.x() < a.z() && a.y() < b.w() && b.y() < a.w();
   }
-#endif
+
+  // Accessors of the intrusive links of rows and entries, used with
+  // IntrusiveList.
+  struct RowLinks {
+    explicit RowLinks(std::vector<GlyphCacheRow>* rows) : rows(rows) {}
+    IntrusiveLink& operator()(const IntrusiveListIndex i) const {
+      return (*rows)[i].link_;
+    }
+    std::vector<GlyphCacheRow>* rows;
+  };
+  struct RowLruLinks {
+    explicit RowLruLinks(std::vector<GlyphCacheRow>* rows) : rows(rows) {}
+    IntrusiveLink& operator()(const IntrusiveListIndex i) const {
+      return (*rows)[i].link_lru_;
+    }
+    std::vector<GlyphCacheRow>* rows;
+  };
+  struct RowHeightLinks {
+    explicit RowHeightLinks(std::vector<GlyphCacheRow>* rows) : rows(rows) {}
+    IntrusiveLink& operator()(const IntrusiveListIndex i) const {
+      return (*rows)[i].link_height_;
+    }
+    std::vector<GlyphCacheRow>* rows;
+  };
+  struct EntryLinks {
+    explicit EntryLinks(FlatHashMap<GlyphKey, GlyphCacheEntry, GlyphKey>* map)
+        : map(map) {}
+    IntrusiveLink& operator()(const IntrusiveListIndex i) const {
+      return map->get_value(i).link_;
+    }
+    FlatHashMap<GlyphKey, GlyphCacheEntry, GlyphKey>* map;
+  };
 
   // A time counter of the cache.
   // In each rendering cycle, the counter is incremented.
@@ -625,8 +2196,32 @@ class GlyphCache {
   // Size of the glyph cache. Rounded to power of 2.
   mathfu::vec2i size_;
 
-  // Cache buffer;
-  std::unique_ptr<T> buffer_;
+  // Range of the size while the cache grows and shrinks.
+  mathfu::vec2i min_size_;
+  mathfu::vec2i max_size_;
+
+  // Number of cycles since the last shrink check.
+  int32_t shrink_check_cycles_;
+
+  // Packing strategy of the cache.
+  GlyphCachePacking packing_;
+
+  // Packers used to place glyphs when the packing strategy is not
+  // kGlyphCachePackingRow, one per page. Empty with the row allocator.
+  std::vector<std::unique_ptr<GlyphCachePacker>> packers_;
+
+  // Number of allocated pages and the limit.
+  int32_t num_pages_;
+  int32_t max_pages_;
+
+  // LRU lists of the glyphs per partition. Used with the packer.
+  std::vector<IntrusiveList> lru_entries_;
+
+  // Area of the buffer occupied by glyph images including paddings.
+  int32_t used_area_;
+
+  // Cache buffer. Pages are stored one after another.
+  std::unique_ptr<T[]> buffer_;
 
   // Hash map to the cache entries
   // This map is the primary place to look up the cache entries.
@@ -634,21 +2229,25 @@ class GlyphCache {
   // id, glyph size etc.
   // Note that the code point is an index in the
   // font file and not a Unicode value.
-  std::unordered_map<GlyphKey, std::unique_ptr<GlyphCacheEntry>, GlyphKey>
-      map_entries_;
+  // Entries are stored inline in the map, pointers to them stay valid until
+  // they are evicted.
+  FlatHashMap<GlyphKey, GlyphCacheEntry, GlyphKey> map_entries_;
+
+  // Pool of rows. Rows are referenced by their index in the pool.
+  std::vector<GlyphCacheRow> rows_;
+
+  // Unused rows in the pool.
+  IntrusiveList free_rows_;
 
-  // list of rows in the cache.
-  std::list<GlyphCacheRow> list_row_;
+  // list of rows in the cache, in the order of the position in the buffer.
+  IntrusiveList list_row_;
 
-  // LRU entries of the row. Tracks iterator to list_row_.
-  std::list<GlyphCacheEntry::iterator_row> lru_row_;
+  // LRU list of the rows.
+  IntrusiveList lru_row_;
 
-  // Map to row entries to have O(log N) access to a row entry.
-  // Tracks iterator to list_row_.
-  // Using multimap because multiple rows can have same row height.
-  // Key: height of the row. With the map, an API can have quick access to a row
-  // with a given height.
-  std::multimap<int32_t, GlyphCacheEntry::iterator_row> map_row_;
+  // Lists of rows indexed by row height / kGlyphCacheHeightRound.
+  // With the lists, an API can have quick access to a row with a given height.
+  std::vector<IntrusiveList> row_heights_;
 
   // Revision of the buffer.
   // Each time one or more cache entry is evicted, a revision of the cache is
@@ -659,20 +2258,53 @@ class GlyphCache {
   // because existing entries are still valid in that case.
   uint32_t revision_;
 
+  // Counter value when the revision was updated by an eviction.
+  uint32_t revision_counter_;
+
   // Flag indicates if the cache is dirty. If it's dirty, corresponding font
   // atlas texture needs to be uploaded.
   bool dirty_;
 
-  // Dirty region in the buffer.
-  mathfu::vec4i dirty_rect_;
+  // Dirty regions of each page, relative to the page origin.
+  std::vector<std::vector<mathfu::vec4i>> dirty_rects_;
+
+  // Flag indicates that CompactStep() has nothing to do until the contents of
+  // the cache are changed.
+  bool compacted_;
+
+  // Last row of each page, used while growing the cache.
+  std::vector<IntrusiveListIndex> page_rows_;
+
+  // Work buffers of the compaction, kept to avoid reallocations.
+  std::vector<IntrusiveListIndex> compaction_rows_;
+  std::vector<int32_t> compaction_widths_;
+
+  // Partitions and their usage counters. The first one is the default
+  // partition.
+  std::vector<GlyphCachePartition> partitions_;
+  std::vector<GlyphCachePartitionStats> partition_stats_;
+
+  // Handles of pinned glyphs.
+  std::vector<FlatHashMapHandle> pinned_entries_;
+
+  // Work buffers to keep pinned glyphs while flushing the cache.
+  struct PinnedGlyph {
+    GlyphKey key;
+    GlyphCacheEntry entry;
+    size_t offset;
+  };
+  std::vector<PinnedGlyph> pinned_glyphs_;
+  std::vector<T> pinned_images_;
+
+  // Work buffers of snapshots.
+  std::vector<FlatHashMapHandle> snapshot_entries_;
+  std::vector<T> snapshot_image_;
+
+  // Usage counters.
+  GlyphCacheStats stats_;
 
-#ifdef GLYPH_CACHE_STATS
-  // Variables to track usage stats.
-  int32_t stats_lookup_;
-  int32_t stats_hit_;
-  int32_t stats_row_flush_;
-  int32_t stats_set_fail_;
-#endif
+  // Eviction policy.
+  EvictionPolicy eviction_policy_;
 };
 /// @endcond
 
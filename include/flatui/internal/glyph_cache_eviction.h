@@ -0,0 +1,170 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GLYPH_CACHE_EVICTION_H
+#define GLYPH_CACHE_EVICTION_H
+
+#include <algorithm>
+#include <cstdint>
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// Eviction policies of GlyphCache.
+//
+// A policy is a template parameter of GlyphCache and decides which eviction
+// candidate goes first. Candidates are rows with the row allocator and glyphs
+// with the packers (skyline/guillotine), where evicted areas are reused by the
+// packer. Regardless of the policy, rows and glyphs used in current cycle and
+// pinned glyphs are never evicted.
+//
+// A policy provides:
+// - kOrdered: true if the least recently used candidate always has the lowest
+// score, so that the cache can take the first candidate in LRU order without
+// scoring others.
+// - kTrackFrequency: true if the policy uses use frequencies, the cache counts
+// uses of rows and glyphs only when it's set.
+// - Score(): eviction score of a candidate, lower scores are evicted first.
+// - Combine(): score of adjacent rows evicted together.
+// - OnEvict(): bookkeeping of the counters.
+
+// kGlyphCacheAgingCycles: use frequencies are halved every the cycles, so that
+// glyphs heavily used in the past don't stay forever.
+// kGlyphCacheEvictionSamples: number of least recently used glyphs scored to
+// pick a victim with the packers, when the policy is not kOrdered.
+const uint32_t kGlyphCacheAgingCycles = 64;
+const int32_t kGlyphCacheEvictionSamples = 16;
+
+// Use frequency of a row or a glyph with lazy aging.
+class GlyphCacheFrequency {
+ public:
+  GlyphCacheFrequency() : count_(0), aged_counter_(0) {}
+
+  // Reset the frequency.
+  void Reset(const uint32_t counter) {
+    count_ = 0;
+    aged_counter_ = counter;
+  }
+
+  // Count a use in the cycle |counter|.
+  void Increment(const uint32_t counter) {
+    count_ = Get(counter) + 1;
+    aged_counter_ = counter;
+  }
+
+  // Getter of the aged frequency in the cycle |counter|.
+  uint32_t Get(const uint32_t counter) const {
+    auto periods = counter / kGlyphCacheAgingCycles -
+                   aged_counter_ / kGlyphCacheAgingCycles;
+    return periods >= 32 ? 0 : count_ >> periods;
+  }
+
+ private:
+  uint32_t count_;
+  uint32_t aged_counter_;
+};
+
+// Counters of evictions, to compare policies on a workload.
+struct GlyphCacheEvictionStats {
+  GlyphCacheEvictionStats()
+      : victims(0),
+        evicted_glyphs(0),
+        evicted_recent_glyphs(0),
+        evicted_frequency(0) {}
+  // Number of evicted rows or glyphs.
+  uint64_t victims;
+  // Number of evicted glyphs.
+  uint64_t evicted_glyphs;
+  // Number of evicted glyphs used within kGlyphCacheRecentCycles, which are
+  // likely to be needed (and rasterized) again soon.
+  uint64_t evicted_recent_glyphs;
+  // Sum of aged use frequencies of evicted rows or glyphs. Only counted with
+  // policies tracking frequencies.
+  uint64_t evicted_frequency;
+};
+
+// Base of the policies, keeps the counters.
+class GlyphCacheEvictionPolicy {
+ public:
+  // Count an eviction of a row or a glyph.
+  // recent: true if the victim has been used within kGlyphCacheRecentCycles.
+  void OnEvict(const size_t num_glyphs, const bool recent,
+               const uint32_t frequency) {
+    stats_.victims++;
+    stats_.evicted_glyphs += num_glyphs;
+    if (recent) {
+      stats_.evicted_recent_glyphs += num_glyphs;
+    }
+    stats_.evicted_frequency += frequency;
+  }
+
+  // Getter of the counters.
+  const GlyphCacheEvictionStats& get_stats() const { return stats_; }
+
+ private:
+  GlyphCacheEvictionStats stats_;
+};
+
+// Least recently used row or glyph first. The default policy.
+class LruEvictionPolicy : public GlyphCacheEvictionPolicy {
+ public:
+  static const bool kOrdered = true;
+  static const bool kTrackFrequency = false;
+  static uint64_t Score(const uint32_t last_used, const uint32_t /*frequency*/,
+                        const int32_t /*area*/) {
+    return last_used;
+  }
+  // A group of rows is as recent as its most recently used row.
+  static uint64_t Combine(const uint64_t a, const uint64_t b) {
+    return std::max(a, b);
+  }
+};
+
+// Least frequently used row or glyph first, frequencies are aged so that the
+// policy adapts to workload changes. Ties are broken by recency.
+class LfuEvictionPolicy : public GlyphCacheEvictionPolicy {
+ public:
+  static const bool kOrdered = false;
+  static const bool kTrackFrequency = true;
+  static uint64_t Score(const uint32_t last_used, const uint32_t frequency,
+                        const int32_t /*area*/) {
+    return static_cast<uint64_t>(frequency) << 32 | last_used;
+  }
+  static uint64_t Combine(const uint64_t a, const uint64_t b) { return a + b; }
+};
+
+// Row (or glyph) with the least uses per area first. Evicting a large row
+// holding a few hot glyphs frees more space for less re-rasterization than
+// evicting a small row full of hot glyphs. Ties are broken by recency.
+class FrequencyWeightedRowEvictionPolicy : public GlyphCacheEvictionPolicy {
+ public:
+  static const bool kOrdered = false;
+  static const bool kTrackFrequency = true;
+  static uint64_t Score(const uint32_t last_used, const uint32_t frequency,
+                        const int32_t area) {
+    // Uses per 64K pixels, in 16.16 fixed point.
+    const uint64_t kScale = static_cast<uint64_t>(1) << 32;
+    auto density = static_cast<uint64_t>(frequency) * kScale /
+                   static_cast<uint64_t>(std::max(area, 1));
+    return std::min(density, static_cast<uint64_t>(0xffffffff)) << 32 |
+           last_used;
+  }
+  static uint64_t Combine(const uint64_t a, const uint64_t b) { return a + b; }
+};
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // GLYPH_CACHE_EVICTION_H
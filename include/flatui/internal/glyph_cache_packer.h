@@ -0,0 +1,369 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GLYPH_CACHE_PACKER_H
+#define GLYPH_CACHE_PACKER_H
+
+#include <algorithm>
+#include <vector>
+
+#include "mathfu/constants.h"
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// Packing strategies of the glyph cache.
+// kGlyphCachePackingRow: Legacy row allocator. Glyphs are stored in full width
+// rows and a row is evicted at once. (See GlyphCacheRow.)
+// kGlyphCachePackingSkyline: Skyline bottom-left packer with a waste map.
+// Packs glyphs of mixed heights tightly, evicted glyph areas are recycled
+// through the waste map.
+// kGlyphCachePackingGuillotine: Guillotine packer with a best area fit and
+// free rectangle merging. Evicted glyph areas are returned to the free list.
+enum GlyphCachePacking {
+  kGlyphCachePackingRow = 0,
+  kGlyphCachePackingSkyline = 1,
+  kGlyphCachePackingGuillotine = 2,
+};
+
+// Interface of a rectangle packer used by GlyphCache.
+// A packer only tracks free/used space in the atlas, the glyph cache keeps
+// track of the cached images and decides which ones to evict.
+class GlyphCachePacker {
+ public:
+  virtual ~GlyphCachePacker() {}
+
+  // Reset the packer to an empty area of a given size.
+  virtual void Reset(const mathfu::vec2i& size) = 0;
+
+  // Extend the packing area to a larger size. The added area is free and
+  // existing reservations are kept.
+  virtual void Grow(const mathfu::vec2i& size) = 0;
+
+  // Reserve a rectangle of the given size.
+  // Returns false if there is no room for the request.
+  virtual bool Reserve(const mathfu::vec2i& size, mathfu::vec2i* pos) = 0;
+
+  // Return a rectangle reserved with Reserve() to the packer.
+  virtual void Release(const mathfu::vec2i& pos, const mathfu::vec2i& size) = 0;
+
+  // Total area that can still be reserved, in pixels.
+  virtual int32_t GetFreeArea() const = 0;
+
+  // Area of the largest rectangle that can be reserved, in pixels.
+  virtual int32_t GetLargestFreeArea() const = 0;
+};
+
+// Guillotine packer.
+// Free space is tracked as a list of disjoint rectangles. A reservation takes
+// the free rectangle with the best area fit and splits the remainder along
+// the shorter axis. Released rectangles are merged with neighbors sharing a
+// full edge so that a large glyph can fit again after evicting small ones.
+class GuillotinePacker : public GlyphCachePacker {
+ public:
+  GuillotinePacker() {}
+  explicit GuillotinePacker(const mathfu::vec2i& size) { Reset(size); }
+
+  virtual void Reset(const mathfu::vec2i& size) {
+    size_ = size;
+    free_rects_.clear();
+    free_rects_.push_back(mathfu::vec4i(mathfu::kZeros2i, size));
+  }
+
+  virtual void Grow(const mathfu::vec2i& size) {
+    auto old_size = size_;
+    size_ = size;
+    if (size.x() > old_size.x()) {
+      Release(mathfu::vec2i(old_size.x(), 0),
+              mathfu::vec2i(size.x() - old_size.x(), old_size.y()));
+    }
+    if (size.y() > old_size.y()) {
+      Release(mathfu::vec2i(0, old_size.y()),
+              mathfu::vec2i(size.x(), size.y() - old_size.y()));
+    }
+  }
+
+  // Remove all free rectangles. Used when the packer manages leftovers of
+  // another packer (e.g. a waste map of the skyline packer).
+  void Clear() {
+    size_ = mathfu::kZeros2i;
+    free_rects_.clear();
+  }
+
+  virtual bool Reserve(const mathfu::vec2i& size, mathfu::vec2i* pos) {
+    // Look for the best area fit. Free rectangles are stored as
+    // (x, y, width, height).
+    int32_t best = -1;
+    int32_t best_score = 0;
+    for (size_t i = 0; i < free_rects_.size(); ++i) {
+      auto& rect = free_rects_[i];
+      if (rect.z() < size.x() || rect.w() < size.y()) continue;
+      int32_t score = rect.z() * rect.w() - size.x() * size.y();
+      if (best < 0 || score < best_score) {
+        best = static_cast<int32_t>(i);
+        best_score = score;
+        if (score == 0) break;
+      }
+    }
+    if (best < 0) {
+      return false;
+    }
+
+    auto rect = free_rects_[best];
+    free_rects_[best] = free_rects_.back();
+    free_rects_.pop_back();
+    *pos = rect.xy();
+
+    // Split the remainder along the shorter leftover axis.
+    auto leftover = rect.zw() - size;
+    mathfu::vec4i right, bottom;
+    if (leftover.x() < leftover.y()) {
+      right = mathfu::vec4i(rect.x() + size.x(), rect.y(), leftover.x(),
+                            size.y());
+      bottom = mathfu::vec4i(rect.x(), rect.y() + size.y(), rect.z(),
+                             leftover.y());
+    } else {
+      right = mathfu::vec4i(rect.x() + size.x(), rect.y(), leftover.x(),
+                            rect.w());
+      bottom = mathfu::vec4i(rect.x(), rect.y() + size.y(), size.x(),
+                             leftover.y());
+    }
+    if (right.z() > 0 && right.w() > 0) free_rects_.push_back(right);
+    if (bottom.z() > 0 && bottom.w() > 0) free_rects_.push_back(bottom);
+    return true;
+  }
+
+  virtual void Release(const mathfu::vec2i& pos, const mathfu::vec2i& size) {
+    if (size.x() <= 0 || size.y() <= 0) return;
+    auto rect = mathfu::vec4i(pos, size);
+
+    // Merge the rectangle with neighbors sharing a full edge until no more
+    // merge is possible.
+    bool merged = true;
+    while (merged) {
+      merged = false;
+      for (size_t i = 0; i < free_rects_.size(); ++i) {
+        auto& other = free_rects_[i];
+        if (other.y() == rect.y() && other.w() == rect.w() &&
+            (other.x() + other.z() == rect.x() ||
+             rect.x() + rect.z() == other.x())) {
+          rect = mathfu::vec4i(std::min(rect.x(), other.x()), rect.y(),
+                               rect.z() + other.z(), rect.w());
+        } else if (other.x() == rect.x() && other.z() == rect.z() &&
+                   (other.y() + other.w() == rect.y() ||
+                    rect.y() + rect.w() == other.y())) {
+          rect = mathfu::vec4i(rect.x(), std::min(rect.y(), other.y()),
+                               rect.z(), rect.w() + other.w());
+        } else {
+          continue;
+        }
+        free_rects_[i] = free_rects_.back();
+        free_rects_.pop_back();
+        merged = true;
+        break;
+      }
+    }
+    free_rects_.push_back(rect);
+  }
+
+  virtual int32_t GetFreeArea() const {
+    int32_t area = 0;
+    for (auto& rect : free_rects_) {
+      area += rect.z() * rect.w();
+    }
+    return area;
+  }
+
+  virtual int32_t GetLargestFreeArea() const {
+    int32_t area = 0;
+    for (auto& rect : free_rects_) {
+      area = std::max(area, rect.z() * rect.w());
+    }
+    return area;
+  }
+
+ private:
+  // Size of the packing area.
+  mathfu::vec2i size_;
+
+  // Disjoint free rectangles as (x, y, width, height).
+  std::vector<mathfu::vec4i> free_rects_;
+};
+
+// Skyline packer.
+// Tracks the first free y position for each horizontal span of the atlas
+// (the skyline) and places a rectangle where its bottom edge ends up closest
+// to the top of the atlas (bottom-left rule). Areas trapped below a placed
+// rectangle and areas returned by Release() are handed to a guillotine waste
+// map that is looked up first, so the space is not lost.
+class SkylinePacker : public GlyphCachePacker {
+ public:
+  SkylinePacker() {}
+  explicit SkylinePacker(const mathfu::vec2i& size) { Reset(size); }
+
+  virtual void Reset(const mathfu::vec2i& size) {
+    size_ = size;
+    skyline_.clear();
+    skyline_.push_back(mathfu::vec3i(0, 0, size.x()));
+    waste_.Clear();
+  }
+
+  virtual void Grow(const mathfu::vec2i& size) {
+    // Added width is a new span at the top, added height extends the free
+    // space under every span.
+    if (size.x() > size_.x()) {
+      if (skyline_.back().y() == 0) {
+        skyline_.back().z() += size.x() - size_.x();
+      } else {
+        skyline_.push_back(mathfu::vec3i(size_.x(), 0, size.x() - size_.x()));
+      }
+    }
+    size_ = size;
+  }
+
+  virtual bool Reserve(const mathfu::vec2i& size, mathfu::vec2i* pos) {
+    // Try recycled space first.
+    if (waste_.Reserve(size, pos)) {
+      return true;
+    }
+
+    // Find the span where the rectangle's bottom edge is the closest to the
+    // top, prefer the narrower span on ties.
+    int32_t best = -1;
+    int32_t best_bottom = 0;
+    int32_t best_width = 0;
+    int32_t best_y = 0;
+    for (size_t i = 0; i < skyline_.size(); ++i) {
+      int32_t y;
+      if (!Fit(i, size, &y)) continue;
+      auto bottom = y + size.y();
+      if (best < 0 || bottom < best_bottom ||
+          (bottom == best_bottom && skyline_[i].z() < best_width)) {
+        best = static_cast<int32_t>(i);
+        best_bottom = bottom;
+        best_width = skyline_[i].z();
+        best_y = y;
+      }
+    }
+    if (best < 0) {
+      return false;
+    }
+
+    *pos = mathfu::vec2i(skyline_[best].x(), best_y);
+    AddLevel(best, *pos, size);
+    return true;
+  }
+
+  virtual void Release(const mathfu::vec2i& pos, const mathfu::vec2i& size) {
+    waste_.Release(pos, size);
+  }
+
+  virtual int32_t GetFreeArea() const {
+    int32_t area = waste_.GetFreeArea();
+    for (auto& node : skyline_) {
+      area += node.z() * (size_.y() - node.y());
+    }
+    return area;
+  }
+
+  virtual int32_t GetLargestFreeArea() const {
+    // Largest rectangle under the skyline. O(N^2) but only used for stats.
+    int32_t area = waste_.GetLargestFreeArea();
+    for (size_t i = 0; i < skyline_.size(); ++i) {
+      auto y = skyline_[i].y();
+      auto width = skyline_[i].z();
+      for (size_t j = i + 1; j < skyline_.size() && skyline_[j].y() <= y; ++j) {
+        width += skyline_[j].z();
+      }
+      for (size_t j = i; j > 0 && skyline_[j - 1].y() <= y; --j) {
+        width += skyline_[j - 1].z();
+      }
+      area = std::max(area, width * (size_.y() - y));
+    }
+    return area;
+  }
+
+ private:
+  // Check if the rectangle fits when its left edge is placed at the start of
+  // the span |index|. Returns the resulting y position.
+  bool Fit(size_t index, const mathfu::vec2i& size, int32_t* y) const {
+    auto x = skyline_[index].x();
+    if (x + size.x() > size_.x()) return false;
+    int32_t width_left = size.x();
+    int32_t top = skyline_[index].y();
+    while (width_left > 0) {
+      if (index >= skyline_.size()) return false;
+      top = std::max(top, skyline_[index].y());
+      if (top + size.y() > size_.y()) return false;
+      width_left -= skyline_[index].z();
+      ++index;
+    }
+    *y = top;
+    return true;
+  }
+
+  // Raise the skyline for a rectangle placed at the span |index|.
+  void AddLevel(size_t index, const mathfu::vec2i& pos,
+                const mathfu::vec2i& size) {
+    auto right = pos.x() + size.x();
+
+    // Spans covered by the rectangle are removed. The space between their
+    // level and the rectangle becomes waste.
+    size_t i = index;
+    while (i < skyline_.size() && skyline_[i].x() < right) {
+      auto& node = skyline_[i];
+      auto node_right = node.x() + node.z();
+      auto covered_right = std::min(node_right, right);
+      if (pos.y() > node.y()) {
+        waste_.Release(mathfu::vec2i(node.x(), node.y()),
+                       mathfu::vec2i(covered_right - node.x(),
+                                     pos.y() - node.y()));
+      }
+      if (node_right > right) {
+        // Partially covered, shrink it.
+        node.z() = node_right - right;
+        node.x() = right;
+        break;
+      }
+      skyline_.erase(skyline_.begin() + i);
+    }
+    skyline_.insert(skyline_.begin() + index,
+                    mathfu::vec3i(pos.x(), pos.y() + size.y(), size.x()));
+
+    // Merge neighbor spans at the same level.
+    for (size_t j = 0; j + 1 < skyline_.size();) {
+      if (skyline_[j].y() == skyline_[j + 1].y()) {
+        skyline_[j].z() += skyline_[j + 1].z();
+        skyline_.erase(skyline_.begin() + j + 1);
+      } else {
+        ++j;
+      }
+    }
+  }
+
+  // Size of the packing area.
+  mathfu::vec2i size_;
+
+  // Skyline spans as (x, y, width), sorted by x.
+  std::vector<mathfu::vec3i> skyline_;
+
+  // Areas below the skyline that can still be used.
+  GuillotinePacker waste_;
+};
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // GLYPH_CACHE_PACKER_H
@@ -0,0 +1,189 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef GLYPH_RASTERIZER_H
+#define GLYPH_RASTERIZER_H
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "distance_field.h"
+#include "flatui_util.h"
+#include "mathfu/constants.h"
+
+/// @cond FLATUI_INTERNAL
+// Forward decls for FreeType.
+typedef struct FT_LibraryRec_ *FT_Library;
+typedef struct FT_FaceRec_ *FT_Face;
+typedef struct FT_GlyphSlotRec_ *FT_GlyphSlot;
+/// @endcond
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// Metrics of a glyph image in pixels, kept apart from the glyph image so that
+// a layout doesn't depend on the glyph cache or on FreeType's glyph slot.
+struct GlyphMetrics {
+  GlyphMetrics() : left(0), top(0), width(0), rows(0), advance(0) {}
+
+  // Glyph origin relative to the top left corner of the image, as FreeType's
+  // bitmap_left and bitmap_top.
+  int32_t left;
+  int32_t top;
+
+  // Image size.
+  int32_t width;
+  int32_t rows;
+
+  // Horizontal advance in FreeType units.
+  int32_t advance;
+};
+
+// A glyph to be rasterized by GlyphRasterizer.
+struct GlyphRasterRequest {
+  GlyphRasterRequest()
+      : font_id(kNullHash),
+        font_data(nullptr),
+        font_data_size(0),
+        glyph_index(0),
+        ysize(0),
+        succeeded(false) {}
+
+  // Font of the glyph and the font file contents, which must stay valid
+  // until the font is removed with GlyphRasterizer::RemoveFont().
+  HashedId font_id;
+  const uint8_t *font_data;
+  size_t font_data_size;
+
+  // Glyph index in the font and the size in pixels.
+  uint32_t glyph_index;
+  int32_t ysize;
+
+  // Results. The image is |size| pixels without gaps between rows, the
+  // offset is the glyph origin relative to the top left corner of the image
+  // as FreeType's bitmap_left and bitmap_top. Distance field images are
+  // padded, the metrics are the metrics of the glyph itself.
+  bool succeeded;
+  mathfu::vec2i size;
+  mathfu::vec2i offset;
+  std::vector<uint8_t> image;
+  GlyphMetrics metrics;
+};
+
+// Retrieve the image size of a glyph outline loaded (not rendered) to a glyph
+// slot, and the glyph origin as FreeType's bitmap_left and bitmap_top.
+// Returns false if the glyph is not an outline and needs FT_Render_Glyph().
+bool GetGlyphOutlineBox(FT_GlyphSlot glyph, mathfu::vec2i *size,
+                        mathfu::vec2i *offset);
+
+// Retrieve metrics of a glyph loaded to a glyph slot. The glyph doesn't have
+// to be rendered, the metrics of an outline are the metrics of the image
+// FreeType renders.
+void GetGlyphSlotMetrics(FT_GlyphSlot glyph, GlyphMetrics *metrics);
+
+// Render a glyph outline loaded to a glyph slot into a cleared 8 bit image,
+// so that the glyph is rendered in place without FreeType's bitmap.
+// size, offset: the values from GetGlyphOutlineBox().
+// pitch: distance between rows of the image in bytes.
+bool RenderGlyphOutline(FT_Library library, FT_GlyphSlot glyph,
+                        const mathfu::vec2i &size,
+                        const mathfu::vec2i &offset, uint8_t *image,
+                        const int32_t pitch);
+
+// Rasterizer of glyph batches on worker threads.
+//
+// Each worker has its own FreeType library and face instances created over
+// the shared font file contents, because a FT_Face can't be used by multiple
+// threads at once. The calling thread works on the batch as well, so that a
+// batch is rasterized with (number of threads + 1) workers.
+// Results don't depend on the number of threads or on which worker processed
+// a glyph.
+class GlyphRasterizer {
+ public:
+  GlyphRasterizer();
+  ~GlyphRasterizer();
+
+  // Set the number of worker threads. 0 rasterizes batches on the calling
+  // thread only.
+  void SetNumThreads(const int32_t num_threads);
+  int32_t get_num_threads() const {
+    return static_cast<int32_t>(workers_.size()) - 1;
+  }
+
+  // Rasterize a batch of glyphs, returns when all glyphs are processed.
+  // sdf_spread: if not 0, signed distance fields padded by the spread are
+  // generated instead of coverage images (see DistanceFieldGenerator).
+  void Rasterize(std::vector<GlyphRasterRequest> *requests,
+                 const int32_t sdf_spread);
+
+  // Release face instances of a font, must be called before the font file
+  // contents are released.
+  void RemoveFont(const HashedId font_id);
+
+ private:
+  // State of a worker. Only the owning worker accesses it during a batch.
+  struct Worker {
+    Worker() : library(nullptr), generation(0) {}
+    FT_Library library;
+    // The last batch the worker has started.
+    uint32_t generation;
+    // Face instances per font id, with the current pixel size.
+    std::vector<std::pair<HashedId, std::pair<FT_Face, int32_t>>> faces;
+    DistanceFieldGenerator sdf_generator;
+    std::thread thread;
+  };
+
+  // Thread function of a worker.
+  void Run(Worker *worker);
+
+  // Rasterize glyphs of current batch until no glyphs are left.
+  void Process(Worker *worker);
+
+  // Rasterize a glyph with the faces of a worker.
+  void RasterizeGlyph(Worker *worker, GlyphRasterRequest *request);
+
+  // Release FreeType resources of a worker.
+  static void ReleaseWorker(Worker *worker);
+
+  // Workers. The first one is used by the calling thread.
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  // Current batch and the index of the next glyph to rasterize.
+  std::vector<GlyphRasterRequest> *requests_;
+  int32_t sdf_spread_;
+  std::atomic<size_t> next_request_;
+
+  // Synchronization of batches. |generation_| is incremented when a batch
+  // starts, |busy_workers_| counts worker threads still working on it.
+  std::mutex mutex_;
+  std::condition_variable start_condition_;
+  std::condition_variable done_condition_;
+  uint32_t generation_;
+  int32_t busy_workers_;
+  bool quit_;
+};
+
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // GLYPH_RASTERIZER_H
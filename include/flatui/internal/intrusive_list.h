@@ -0,0 +1,133 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INTRUSIVE_LIST_H
+#define INTRUSIVE_LIST_H
+
+#include <cassert>
+#include <cstdint>
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// Index of a node in an IntrusiveList.
+typedef uint32_t IntrusiveListIndex;
+const IntrusiveListIndex kIntrusiveListNull = 0xffffffff;
+
+// Links embedded in a node of an IntrusiveList.
+struct IntrusiveLink {
+  IntrusiveLink() : prev(kIntrusiveListNull), next(kIntrusiveListNull) {}
+  IntrusiveListIndex prev;
+  IntrusiveListIndex next;
+};
+
+// Doubly linked list of nodes that live in a pool (e.g. a vector or a
+// FlatHashMap) and are addressed by an index.
+// The list does not own the nodes nor allocate memory, the links are embedded
+// in the nodes. Each API takes a functor |links| that returns a reference to
+// the IntrusiveLink of a node for a given index, so that a node can be a
+// member of multiple lists at a time (e.g. a row list and an LRU list).
+class IntrusiveList {
+ public:
+  IntrusiveList()
+      : head_(kIntrusiveListNull), tail_(kIntrusiveListNull), size_(0) {}
+
+  // Insert a node at the end of the list.
+  template <typename Links>
+  void PushBack(const IntrusiveListIndex index, Links links) {
+    InsertAfter(tail_, index, links);
+  }
+
+  // Insert a node after |pos|. kIntrusiveListNull inserts at the front.
+  template <typename Links>
+  void InsertAfter(const IntrusiveListIndex pos, const IntrusiveListIndex index,
+                   Links links) {
+    auto& link = links(index);
+    link.prev = pos;
+    if (pos == kIntrusiveListNull) {
+      link.next = head_;
+      head_ = index;
+    } else {
+      link.next = links(pos).next;
+      links(pos).next = index;
+    }
+    if (link.next == kIntrusiveListNull) {
+      tail_ = index;
+    } else {
+      links(link.next).prev = index;
+    }
+    size_++;
+  }
+
+  // Unlink a node from the list.
+  template <typename Links>
+  void Remove(const IntrusiveListIndex index, Links links) {
+    assert(size_);
+    auto& link = links(index);
+    if (link.prev == kIntrusiveListNull) {
+      head_ = link.next;
+    } else {
+      links(link.prev).next = link.next;
+    }
+    if (link.next == kIntrusiveListNull) {
+      tail_ = link.prev;
+    } else {
+      links(link.next).prev = link.prev;
+    }
+    link.prev = link.next = kIntrusiveListNull;
+    size_--;
+  }
+
+  // Move a node in the list to the end of the list. Used to update LRU lists.
+  template <typename Links>
+  void MoveToBack(const IntrusiveListIndex index, Links links) {
+    if (tail_ == index) {
+      return;
+    }
+    Remove(index, links);
+    PushBack(index, links);
+  }
+
+  // Remove and return the first node, kIntrusiveListNull if the list is empty.
+  template <typename Links>
+  IntrusiveListIndex PopFront(Links links) {
+    auto index = head_;
+    if (index != kIntrusiveListNull) {
+      Remove(index, links);
+    }
+    return index;
+  }
+
+  // Forget all nodes. Links in the nodes are not touched.
+  void Clear() {
+    head_ = tail_ = kIntrusiveListNull;
+    size_ = 0;
+  }
+
+  IntrusiveListIndex front() const { return head_; }
+  IntrusiveListIndex back() const { return tail_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  IntrusiveListIndex head_;
+  IntrusiveListIndex tail_;
+  size_t size_;
+};
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // INTRUSIVE_LIST_H
@@ -0,0 +1,189 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LAYOUT_CACHE_H
+#define LAYOUT_CACHE_H
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+
+#include "flat_hash_map.h"
+#include "intrusive_list.h"
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// Usage counters of a layout cache.
+struct LayoutCacheStats {
+  LayoutCacheStats() : lookups(0), hits(0), evictions(0) {}
+  // Number of Find() calls and calls that found the layout.
+  uint64_t lookups;
+  uint64_t hits;
+  // Number of layouts evicted for the budget or the maximum age.
+  uint64_t evictions;
+};
+
+// LRU cache of layouts (FontBuffer or FontTexture) within a memory budget.
+//
+// Callers keep pointers to the layouts they look up until the frame is
+// rendered, so layouts used in the current frame are never evicted. The
+// budget can be exceeded within a frame, Update() evicts least recently used
+// layouts at the start of the next frame until the cache is within the
+// budget, as well as layouts unused for more than the maximum age.
+template <typename K, typename T, typename Hash>
+class LayoutCache {
+ public:
+  LayoutCache(const size_t budget, const uint32_t max_age)
+      : budget_(budget), max_age_(max_age), used_bytes_(0), frame_(0) {}
+
+  // Look up a layout, counting a use of it in the current frame.
+  // Returns nullptr if the layout is not cached.
+  T *Find(const K &key) {
+    stats_.lookups++;
+    auto handle = map_entries_.Find(key);
+    if (handle == kInvalidFlatHashMapHandle) {
+      return nullptr;
+    }
+    stats_.hits++;
+    map_entries_.get_value(handle).frame = frame_;
+    lru_entries_.MoveToBack(handle, EntryLinks(&map_entries_));
+    return map_entries_.get_value(handle).value.get();
+  }
+
+  // Look up a layout without counting a use of it, so that the layout is not
+  // protected in the current frame.
+  // age: if not nullptr, receives the number of frames since the last use.
+  // Returns nullptr if the layout is not cached.
+  T *Peek(const K &key, uint32_t *age) {
+    auto handle = map_entries_.Find(key);
+    if (handle == kInvalidFlatHashMapHandle) {
+      return nullptr;
+    }
+    auto &entry = map_entries_.get_value(handle);
+    if (age != nullptr) {
+      *age = frame_ - entry.frame;
+    }
+    return entry.value.get();
+  }
+
+  // Store a layout that is not cached, using |bytes| of memory, and evict
+  // layouts unused in the current frame to stay within the budget.
+  // Returns the stored layout.
+  T *Insert(const K &key, std::unique_ptr<T> value, const size_t bytes) {
+    Entry entry;
+    entry.value = std::move(value);
+    entry.bytes = bytes;
+    entry.frame = frame_;
+    auto insert = map_entries_.Insert(key, std::move(entry));
+    assert(insert.second);
+    auto handle = insert.first;
+    lru_entries_.PushBack(handle, EntryLinks(&map_entries_));
+    used_bytes_ += bytes;
+    Evict();
+    return map_entries_.get_value(handle).value.get();
+  }
+
+  // Start a new frame. Layouts unused for more than the maximum age are
+  // evicted, and the cache is trimmed to the budget.
+  void Update() {
+    frame_++;
+    Evict();
+  }
+
+  // Remove all layouts.
+  void Clear() {
+    map_entries_.Clear();
+    lru_entries_.Clear();
+    used_bytes_ = 0;
+  }
+
+  // Setter/Getter of the memory budget in bytes.
+  void set_budget(const size_t budget) {
+    budget_ = budget;
+    Evict();
+  }
+  size_t get_budget() const { return budget_; }
+
+  // Setter/Getter of the number of frames a layout is kept unused. 0 keeps
+  // layouts until they are evicted for the budget.
+  void set_max_age(const uint32_t max_age) {
+    max_age_ = max_age;
+    Evict();
+  }
+  uint32_t get_max_age() const { return max_age_; }
+
+  // Getter of the memory used by cached layouts in bytes.
+  size_t get_used_bytes() const { return used_bytes_; }
+
+  // Getter of the number of cached layouts.
+  size_t size() const { return map_entries_.size(); }
+
+  // Getter of the usage counters.
+  const LayoutCacheStats &get_stats() const { return stats_; }
+
+ private:
+  struct Entry {
+    std::unique_ptr<T> value;
+    size_t bytes;
+    // The last frame the layout was used in.
+    uint32_t frame;
+    // Link of the LRU list.
+    IntrusiveLink link;
+  };
+  typedef FlatHashMap<K, Entry, Hash> EntryMap;
+
+  // Functor returning the LRU link of an entry for IntrusiveList.
+  struct EntryLinks {
+    explicit EntryLinks(EntryMap *entries) : entries(entries) {}
+    IntrusiveLink &operator()(const IntrusiveListIndex index) const {
+      return entries->get_value(index).link;
+    }
+    EntryMap *entries;
+  };
+
+  // Evict least recently used layouts that are too old or exceed the budget,
+  // up to the first layout used in the current frame.
+  void Evict() {
+    while (!lru_entries_.empty()) {
+      auto handle = lru_entries_.front();
+      auto &entry = map_entries_.get_value(handle);
+      auto expired = max_age_ && frame_ - entry.frame > max_age_;
+      if (entry.frame == frame_ || (!expired && used_bytes_ <= budget_)) {
+        break;
+      }
+      lru_entries_.PopFront(EntryLinks(&map_entries_));
+      used_bytes_ -= entry.bytes;
+      map_entries_.Erase(handle);
+      stats_.evictions++;
+    }
+  }
+
+  EntryMap map_entries_;
+
+  // Layouts in LRU order, least recently used first.
+  IntrusiveList lru_entries_;
+
+  size_t budget_;
+  uint32_t max_age_;
+  size_t used_bytes_;
+  uint32_t frame_;
+  LayoutCacheStats stats_;
+};
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // LAYOUT_CACHE_H
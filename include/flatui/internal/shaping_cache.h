@@ -0,0 +1,261 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SHAPING_CACHE_H
+#define SHAPING_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "flat_hash_map.h"
+#include "flatui_util.h"
+#include "intrusive_list.h"
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// A glyph of a shaped run, the part of harfbuzz's glyph info and position
+// used by the layout.
+struct ShapedGlyph {
+  // Glyph index in the font.
+  uint32_t glyph_index;
+  // Byte offset of the first character of the glyph in the run.
+  uint32_t cluster;
+  // Advances in FreeType units.
+  int32_t x_advance;
+  int32_t y_advance;
+};
+
+// Usage counters of the shaping cache.
+struct ShapingCacheStats {
+  ShapingCacheStats() : lookups(0), hits(0), evictions(0) {}
+  // Number of Find() calls and calls that found the run.
+  uint64_t lookups;
+  uint64_t hits;
+  // Number of runs evicted to keep the cache within the budget.
+  uint64_t evictions;
+};
+
+// Key of a shaped run: the text and all settings that affect the shaping.
+class ShapingKey {
+ public:
+  ShapingKey()
+      : font_id_(kNullHash),
+        size_(0),
+        script_(0),
+        direction_(0),
+        language_(nullptr),
+        hash_(0) {}
+
+  // Set the key. The text is copied, reusing the allocated string.
+  void Set(const HashedId font_id, const int32_t size, const uint32_t script,
+           const int32_t direction, const void *language, const char *text,
+           const size_t length) {
+    font_id_ = font_id;
+    size_ = size;
+    script_ = script;
+    direction_ = direction;
+    language_ = language;
+    text_.assign(text, length);
+
+    // FNV-1a of the text, combined with other fields.
+    uint32_t hash = 0x811c9dc5;
+    for (size_t i = 0; i < length; ++i) {
+      hash = (hash ^ static_cast<uint8_t>(text[i])) * 0x01000193;
+    }
+    hash = HashCombine(HashCombine(hash, font_id), size);
+    hash = HashCombine(HashCombine(hash, script), direction);
+    hash_ = HashCombine(
+        hash, static_cast<uint32_t>(reinterpret_cast<size_t>(language)));
+  }
+
+  // Getter of the text.
+  const std::string &get_text() const { return text_; }
+
+  // Compare operator.
+  bool operator==(const ShapingKey &other) const {
+    return hash_ == other.hash_ && font_id_ == other.font_id_ &&
+           size_ == other.size_ && script_ == other.script_ &&
+           direction_ == other.direction_ && language_ == other.language_ &&
+           text_ == other.text_;
+  }
+
+  // Hash function. The hash is calculated when the key is set.
+  size_t operator()(const ShapingKey &key) const { return key.hash_; }
+
+ private:
+  HashedId font_id_;
+  int32_t size_;
+  uint32_t script_;
+  int32_t direction_;
+  // Interned harfbuzz language.
+  const void *language_;
+  std::string text_;
+  uint32_t hash_;
+};
+
+// A shaped run.
+class ShapedRun {
+ public:
+  ShapedRun() : width_(0), bytes_(0) {}
+
+  // Getter of the glyphs in the visual order of harfbuzz.
+  const std::vector<ShapedGlyph> &get_glyphs() const { return glyphs_; }
+
+  // Getter of the width of the run in FreeType units.
+  uint32_t get_width() const { return width_; }
+
+ private:
+  friend class ShapingCache;
+
+  std::vector<ShapedGlyph> glyphs_;
+  uint32_t width_;
+
+  // Memory used by the run and its key.
+  size_t bytes_;
+
+  // Link of the LRU list.
+  IntrusiveLink link_;
+};
+
+// LRU cache of shaped runs within a memory budget.
+//
+// A layout looks up a run with Find() and, when it missed, shapes the run and
+// stores the result with Set(). Runs are evicted in LRU order when the memory
+// used by the runs and their keys exceeds the budget.
+class ShapingCache {
+ public:
+  explicit ShapingCache(const size_t budget)
+      : budget_(budget), used_bytes_(0) {}
+
+  // Look up a run, counting a use of it.
+  // Returns nullptr if the run is not cached. The key is kept for Set().
+  const ShapedRun *Find(const HashedId font_id, const int32_t size,
+                        const uint32_t script, const int32_t direction,
+                        const void *language, const char *text,
+                        const size_t length) {
+    stats_.lookups++;
+    key_.Set(font_id, size, script, direction, language, text, length);
+    auto handle = map_runs_.Find(key_);
+    if (handle == kInvalidFlatHashMapHandle) {
+      return nullptr;
+    }
+    stats_.hits++;
+    lru_runs_.MoveToBack(handle, RunLinks(&map_runs_));
+    return &map_runs_.get_value(handle);
+  }
+
+  // Store the run of the last missed Find(). The glyphs are moved from
+  // |glyphs|, which is left empty.
+  // Returns the stored run. A run larger than the budget is not cached, the
+  // returned run is valid until the next Set() call then.
+  const ShapedRun *Set(std::vector<ShapedGlyph> *glyphs,
+                       const uint32_t width) {
+    auto bytes = sizeof(ShapedRun) + sizeof(ShapingKey) +
+                 key_.get_text().size() +
+                 glyphs->size() * sizeof(ShapedGlyph);
+    if (bytes > budget_) {
+      return SetUncached(glyphs, width);
+    }
+
+    Evict(bytes);
+    ShapedRun run;
+    run.glyphs_.swap(*glyphs);
+    run.width_ = width;
+    run.bytes_ = bytes;
+    auto handle = map_runs_.Insert(key_, std::move(run)).first;
+    lru_runs_.PushBack(handle, RunLinks(&map_runs_));
+    used_bytes_ += bytes;
+    return &map_runs_.get_value(handle);
+  }
+
+  // Store a run without caching it, e.g. a text unlikely to be laid out
+  // again. The returned run is valid until the next Set() or SetUncached()
+  // call.
+  const ShapedRun *SetUncached(std::vector<ShapedGlyph> *glyphs,
+                               const uint32_t width) {
+    uncached_run_.glyphs_.swap(*glyphs);
+    glyphs->clear();
+    uncached_run_.width_ = width;
+    return &uncached_run_;
+  }
+
+  // Remove all runs.
+  void Clear() {
+    map_runs_.Clear();
+    lru_runs_.Clear();
+    used_bytes_ = 0;
+  }
+
+  // Setter/Getter of the memory budget in bytes. Runs are evicted when the
+  // budget is reduced.
+  void set_budget(const size_t budget) {
+    budget_ = budget;
+    Evict(0);
+  }
+  size_t get_budget() const { return budget_; }
+
+  // Getter of the memory used by cached runs in bytes.
+  size_t get_used_bytes() const { return used_bytes_; }
+
+  // Getter of the number of cached runs.
+  size_t get_num_runs() const { return map_runs_.size(); }
+
+  // Getter of the usage counters.
+  const ShapingCacheStats &get_stats() const { return stats_; }
+
+ private:
+  typedef FlatHashMap<ShapingKey, ShapedRun, ShapingKey> RunMap;
+
+  // Functor returning the LRU link of a run for IntrusiveList.
+  struct RunLinks {
+    explicit RunLinks(RunMap *runs) : runs(runs) {}
+    IntrusiveLink &operator()(const IntrusiveListIndex index) const {
+      return runs->get_value(index).link_;
+    }
+    RunMap *runs;
+  };
+
+  // Evict least recently used runs until |bytes| more fit in the budget.
+  void Evict(const size_t bytes) {
+    while (used_bytes_ + bytes > budget_) {
+      auto handle = lru_runs_.PopFront(RunLinks(&map_runs_));
+      used_bytes_ -= map_runs_.get_value(handle).bytes_;
+      map_runs_.Erase(handle);
+      stats_.evictions++;
+    }
+  }
+
+  RunMap map_runs_;
+
+  // Runs in LRU order, least recently used first.
+  IntrusiveList lru_runs_;
+
+  // Key of the last Find() call.
+  ShapingKey key_;
+
+  // The last run that didn't fit in the budget.
+  ShapedRun uncached_run_;
+
+  size_t budget_;
+  size_t used_bytes_;
+  ShapingCacheStats stats_;
+};
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // SHAPING_CACHE_H
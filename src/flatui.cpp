@@ -178,6 +178,16 @@ class InternalState : public Group {
     assert(font_shader_);
     font_clipping_shader_ = matman_.LoadShader("shaders/font_clipping");
     assert(font_clipping_shader_);
+    if (fontman_.IsSDFEnabled()) {
+      font_sdf_shader_ = matman_.LoadShader("shaders/font_sdf");
+      assert(font_sdf_shader_);
+      font_clipping_sdf_shader_ =
+          matman_.LoadShader("shaders/font_clipping_sdf");
+      assert(font_clipping_sdf_shader_);
+    } else {
+      font_sdf_shader_ = nullptr;
+      font_clipping_sdf_shader_ = nullptr;
+    }
     color_shader_ = matman_.LoadShader("shaders/color");
     assert(color_shader_);
 
@@ -580,9 +590,59 @@ class InternalState : public Group {
     auto parameter = FontBufferParameters(
         fontman_.GetCurrentFace()->font_id_, HashId(text),
         static_cast<float>(size.y()), physical_label_size, false);
-    auto buffer = fontman_.GetBuffer(text, strlen(text), parameter);
-    assert(buffer);
-    Label(*buffer, parameter, vec4i(vec2i(0, 0), buffer->get_size()));
+    auto hash = parameter.get_text_id();
+    if (layout_pass_) {
+      // The layout needs the size of the label only, glyphs are rasterized
+      // when the label is rendered.
+      auto text_size = fontman_.MeasureText(text, strlen(text), parameter);
+      NewElement(text_size, hash);
+      Extend(text_size);
+    } else {
+      auto element = NextElement(hash);
+      if (element) {
+        // Labels outside of the scroll area don't use the glyph cache.
+        auto pos = Position(*element);
+        if (IsVisible(pos, element->size)) {
+          auto buffer = fontman_.GetBuffer(text, strlen(text), parameter);
+          assert(buffer);
+          RenderText(*buffer, parameter,
+                     vec4i(vec2i(0, 0), buffer->get_size()), pos);
+        }
+        Advance(element->size);
+      }
+    }
+  }
+
+  // Text label of a text changing frequently, laid out in a buffer of the id.
+  void DynamicLabel(const char *text, float ysize, const char *id) {
+    // Set text color.
+    renderer_.set_color(text_color_);
+
+    auto size = VirtualToPhysical(vec2(0, ysize));
+    auto parameter = FontBufferParameters(
+        fontman_.GetCurrentFace()->font_id_, HashId(text),
+        static_cast<float>(size.y()), size, false);
+    auto hash = HashId(id);
+    if (layout_pass_) {
+      auto buffer =
+          fontman_.GetDynamicBuffer(hash, text, strlen(text), parameter);
+      assert(buffer);
+      NewElement(buffer->get_size(), hash);
+      Extend(buffer->get_size());
+    } else {
+      auto element = NextElement(hash);
+      if (element) {
+        auto pos = Position(*element);
+        if (IsVisible(pos, element->size)) {
+          auto buffer =
+              fontman_.GetDynamicBuffer(hash, text, strlen(text), parameter);
+          assert(buffer);
+          RenderText(*buffer, parameter,
+                     vec4i(vec2i(0, 0), buffer->get_size()), pos);
+        }
+        Advance(element->size);
+      }
+    }
   }
 
   vec2i Label(const FontBuffer &buffer, const FontBufferParameters &parameter,
@@ -594,54 +654,87 @@ class InternalState : public Group {
       NewElement(size, hash);
       Extend(size);
     } else {
-      // Check if texture atlas needs to be updated.
-      if (buffer.get_pass() > 0) {
-        fontman_.StartRenderPass();
-      }
-
       auto element = NextElement(hash);
       if (element) {
-        fontman_.GetAtlasTexture()->Set(0);
+        pos = RenderText(buffer, parameter, window, Position(*element));
+        Advance(element->size);
+      }
+    }
+    return pos;
+  }
 
-        pos = Position(*element);
+  // Render a FontBuffer at the position of a label.
+  // Returns the position of the buffer, which is moved by the window offset
+  // when the window clips the buffer.
+  vec2i RenderText(const FontBuffer &buffer,
+                   const FontBufferParameters &parameter, const vec4i &window,
+                   vec2i pos) {
+    // Check if texture atlas needs to be updated. Glyphs rasterized in the
+    // render pass are uploaded before the buffer is rendered.
+    if (buffer.get_pass() > 0) {
+      fontman_.StartRenderPass();
+    } else {
+      fontman_.UpdateAtlas();
+    }
 
-        bool clipping = false;
-        if (window.z() && window.w()) {
-          clipping = window.x() || window.y() ||
-                     (buffer.get_size().x() > window.z()) ||
-                     (buffer.get_size().y() > window.w());
-        }
-        if (clipping) {
-          pos -= window.xy();
-
-          // Set a window to show a part of the label.
-          font_clipping_shader_->Set(renderer_);
-          font_clipping_shader_->SetUniform(
-              "pos_offset", vec3(static_cast<float>(pos.x()),
-                                 static_cast<float>(pos.y()), 0.0f));
-          auto start = vec2(position_ - pos);
-          auto end = start + vec2(window.zw());
-          font_clipping_shader_->SetUniform("clipping", vec4(start, end));
-        } else {
-          font_shader_->Set(renderer_);
-          font_shader_->SetUniform("pos_offset",
-                                   vec3(static_cast<float>(pos.x()),
-                                        static_cast<float>(pos.y()), 0.0f));
-        }
+    bool clipping = false;
+    if (window.z() && window.w()) {
+      clipping = window.x() || window.y() ||
+                 (buffer.get_size().x() > window.z()) ||
+                 (buffer.get_size().y() > window.w());
+    }
+    auto sdf = fontman_.IsSDFEnabled();
+    Shader *shader;
+    if (clipping) {
+      pos -= window.xy();
+
+      // Set a window to show a part of the label.
+      shader = sdf ? font_clipping_sdf_shader_ : font_clipping_shader_;
+      shader->Set(renderer_);
+      shader->SetUniform("pos_offset",
+                         vec3(static_cast<float>(pos.x()),
+                              static_cast<float>(pos.y()), 0.0f));
+      auto start = vec2(position_ - pos);
+      auto end = start + vec2(window.zw());
+      shader->SetUniform("clipping", vec4(start, end));
+    } else {
+      shader = sdf ? font_sdf_shader_ : font_shader_;
+      shader->Set(renderer_);
+      shader->SetUniform("pos_offset",
+                         vec3(static_cast<float>(pos.x()),
+                              static_cast<float>(pos.y()), 0.0f));
+    }
+    if (sdf) {
+      shader->SetUniform("smoothing",
+                         fontman_.GetSDFSmoothing(parameter.get_font_size()));
+    }
 
-        const fplbase::Attribute kFormat[] = {
-            fplbase::kPosition3f, fplbase::kTexCoord2f, fplbase::kEND};
-        Mesh::RenderArray(
-            Mesh::kTriangles, static_cast<int>(buffer.get_indices()->size()),
-            kFormat, sizeof(FontVertex),
-            reinterpret_cast<const char *>(buffer.get_vertices()->data()),
-            buffer.get_indices()->data());
-        Advance(element->size);
-      }
+    // Render glyphs in each glyph cache page with the page's atlas.
+    const fplbase::Attribute kFormat[] = {
+        fplbase::kPosition3f, fplbase::kTexCoord2f, fplbase::kEND};
+    for (int32_t page = 0; page < buffer.get_num_pages(); ++page) {
+      auto indices = buffer.get_indices(page);
+      auto atlas = fontman_.GetAtlasTexture(page);
+      if (indices->empty() || atlas == nullptr) continue;
+      atlas->Set(0);
+      Mesh::RenderArray(
+          Mesh::kTriangles, static_cast<int>(indices->size()), kFormat,
+          sizeof(FontVertex),
+          reinterpret_cast<const char *>(buffer.get_vertices()->data()),
+          indices->data());
     }
     return pos;
   }
 
+  // Check if an element overlaps the current scroll area in the render pass.
+  bool IsVisible(const vec2i &pos, const vec2i &size) const {
+    if (!clip_inside_) return true;
+    auto clip_end = clip_position_ + clip_size_;
+    return pos.x() < clip_end.x() && pos.y() < clip_end.y() &&
+           pos.x() + size.x() > clip_position_.x() &&
+           pos.y() + size.y() > clip_position_.y();
+  }
+
   // Custom element with user supplied renderer.
   void CustomElement(
       const vec2 &virtual_size, const char *id,
@@ -840,8 +933,8 @@ class InternalState : public Group {
         }
       }
       // Store size/position, so expensive rendering commands can choose to
-      // clip against the viewport.
-      // TODO: add culling code where appropriate.
+      // clip against the viewport (see IsVisible()).
+      clip_inside_ = true;
       clip_size_ = psize;
       clip_position_ = position_;
       // Start the rendering of this group at the offset before the start of
@@ -863,6 +956,7 @@ class InternalState : public Group {
       for (int i = 0; i <= pointer_max_active_index_; i++) {
         clip_mouse_inside_[i] = true;
       }
+      clip_inside_ = false;
       renderer_.ScissorOff();
     }
   }
@@ -1309,6 +1403,8 @@ class InternalState : public Group {
   Shader *image_shader_;
   Shader *font_shader_;
   Shader *font_clipping_shader_;
+  Shader *font_sdf_shader_;
+  Shader *font_clipping_sdf_shader_;
   Shader *color_shader_;
 
   // Expensive rendering commands can check if they're inside this rect to
@@ -1421,6 +1517,10 @@ void Label(const char *text, float font_size, const vec2 &size) {
   Gui()->Label(text, font_size, size);
 }
 
+void DynamicLabel(const char *text, float font_size, const char *id) {
+  Gui()->DynamicLabel(text, font_size, id);
+}
+
 bool Edit(float ysize, const mathfu::vec2 &size, const char *id,
           std::string *string) {
   return Gui()->Edit(ysize, size, id, string);
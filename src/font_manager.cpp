@@ -14,9 +14,13 @@
 
 #include "precompiled.h"
 
+#include <chrono>
+#include <limits>
+
 // Freetype2 header
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_SIZES_H
 
 // Harfbuzz header
 #include <hb.h>
@@ -43,6 +47,97 @@ namespace flatui {
 // The default script used for a layout.
 const hb_script_t kDefaultScript = HB_SCRIPT_LATIN;
 
+// Glyph cache file written by FontManager::SaveGlyphCache(). The file consists
+// of a header, a record per font and a snapshot of the glyph cache (see
+// GlyphCache::Save()).
+const uint32_t kGlyphCacheFileMagic = 0x46434746;  // 'FGCF'
+const uint32_t kGlyphCacheFileVersion = 1;
+
+struct GlyphCacheFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  // 1 if glyphs are signed distance fields.
+  uint32_t sdf;
+  uint32_t num_fonts;
+};
+
+struct GlyphCacheFileFont {
+  uint32_t font_id;
+  uint32_t content_hash;
+};
+
+// Glyph usage profile written by FontManager::SaveGlyphUsageProfile(). The
+// file consists of a header and a record per glyph.
+const uint32_t kGlyphUsageProfileMagic = 0x50554746;  // 'FGUP'
+const uint32_t kGlyphUsageProfileVersion = 1;
+
+struct GlyphUsageProfileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_glyphs;
+};
+
+struct GlyphUsageProfileGlyph {
+  uint32_t font_id;
+  uint32_t glyph_index;
+  uint32_t glyph_size;
+};
+
+// Code points of simple text laid out without harfbuzz, see
+// FaceData::BuildSimpleLayout().
+const uint32_t kSimpleCodePoints = 256;
+
+// States of a pair of simple code points in FaceData::ScaledSize.
+enum SimplePairState {
+  kSimplePairUnknown = 0,
+  kSimplePairPlain = 1,
+  kSimplePairAdjusted = 2,
+};
+
+// Advance of a simple glyph not retrieved yet.
+const int32_t kSimpleAdvanceUnknown = std::numeric_limits<int32_t>::min();
+
+// OpenType features harfbuzz applies to horizontal text by default.
+const hb_tag_t kDefaultFeatures[] = {
+    HB_TAG('a', 'b', 'v', 'm'), HB_TAG('b', 'l', 'w', 'm'),
+    HB_TAG('c', 'c', 'm', 'p'), HB_TAG('l', 'o', 'c', 'l'),
+    HB_TAG('m', 'a', 'r', 'k'), HB_TAG('m', 'k', 'm', 'k'),
+    HB_TAG('r', 'l', 'i', 'g'), HB_TAG('r', 'v', 'r', 'n'),
+    HB_TAG('c', 'a', 'l', 't'), HB_TAG('c', 'l', 'i', 'g'),
+    HB_TAG('c', 'u', 'r', 's'), HB_TAG('d', 'i', 's', 't'),
+    HB_TAG('k', 'e', 'r', 'n'), HB_TAG('l', 'i', 'g', 'a'),
+    HB_TAG('r', 'c', 'l', 't'), HB_TAG('l', 't', 'r', 'a'),
+    HB_TAG('l', 't', 'r', 'm'), HB_TAG('r', 'a', 'n', 'd'),
+    HB_TAG_NONE};
+
+// AAT layout tables, which harfbuzz applies instead of or on top of GSUB and
+// GPOS.
+const hb_tag_t kAatLayoutTables[] = {
+    HB_TAG('m', 'o', 'r', 'x'), HB_TAG('m', 'o', 'r', 't'),
+    HB_TAG('k', 'e', 'r', 'x'), HB_TAG('t', 'r', 'a', 'k')};
+
+// GPOS lookup types. Pair adjustments and mark attachments only adjust
+// glyphs next to each other in simple text, where no marks are skipped.
+const uint32_t kGposPairLookup = 2;
+const uint32_t kGposMarkToBaseLookup = 4;
+const uint32_t kGposMarkToMarkLookup = 6;
+const uint32_t kGposExtensionLookup = 9;
+
+// Size and metrics of a text measured by FontManager::MeasureText().
+struct FontManager::TextMeasurement {
+  vec2i size;
+  FontMetrics metrics;
+};
+
+// Buffer of a dynamic label laid out by FontManager::GetDynamicBuffer(), with
+// the text and the parameters of the layout.
+struct FontManager::DynamicBuffer {
+  FontBufferParameters parameters;
+  std::string text;
+  FontBuffer buffer;
+  std::vector<DynamicGlyph> glyphs;
+};
+
 // Singleton object of FreeType&Harfbuzz.
 FT_Library *FontManager::ft_;
 hb_buffer_t *FontManager::harfbuzz_buf_;
@@ -129,21 +224,30 @@ class WordEnumerator {
   bool single_line_;
 };
 
-FontManager::FontManager() {
+FontManager::FontManager()
+    : map_textures_(kTextureCacheBudget, kLayoutCacheMaxAge),
+      map_buffers_(kBufferCacheBudget, kLayoutCacheMaxAge) {
   // Initialize variables and libraries.
   Initialize();
 
-  // Initialize glyph cache.
-  glyph_cache_.reset(new GlyphCache<uint8_t>(
-      mathfu::vec2i(kGlyphCacheWidth, kGlyphCacheHeight)));
+  // Initialize glyph cache. The cache starts small and grows on demand.
+  glyph_cache_.reset(new FontGlyphCache(
+      mathfu::vec2i(kGlyphCacheInitialWidth, kGlyphCacheInitialHeight),
+      kGlyphCachePackingRow, kGlyphCacheMaxPages));
+  glyph_cache_->set_max_size(
+      mathfu::vec2i(kGlyphCacheWidth, kGlyphCacheHeight));
 }
 
-FontManager::FontManager(const mathfu::vec2i &cache_size) {
+FontManager::FontManager(const mathfu::vec2i &cache_size,
+                         GlyphCachePacking packing)
+    : map_textures_(kTextureCacheBudget, kLayoutCacheMaxAge),
+      map_buffers_(kBufferCacheBudget, kLayoutCacheMaxAge) {
   // Initialize variables and libraries.
   Initialize();
 
   // Initialize glyph cache.
-  glyph_cache_.reset(new GlyphCache<uint8_t>(cache_size));
+  glyph_cache_.reset(
+      new FontGlyphCache(cache_size, packing, kGlyphCacheMaxPages));
 }
 
 FontManager::~FontManager() {}
@@ -153,11 +257,18 @@ void FontManager::Initialize() {
   renderer_ = nullptr;
   face_initialized_ = false;
   current_atlas_revision_ = 0;
+  compaction_budget_ = 0.0f;
+  prewarm_index_ = 0;
+  record_glyph_usage_ = false;
+  atlas_texture_size_ = mathfu::kZeros2i;
   current_pass_ = 0;
   script_ = kDefaultScript;
   language_ = kDefaultLanguage;
+  harfbuzz_language_ = hb_language_from_string(kDefaultLanguage, -1);
+  locale_id_ = HashId(kDefaultLanguage);
   layout_direction_ = TextLayoutDirectionLTR;
   line_height_ = kLineHeightDefault;
+  sdf_ = false;
 
   if (ft_ == nullptr) {
     ft_ = new FT_Library;
@@ -173,6 +284,8 @@ void FontManager::Initialize() {
     // Create a buffer for harfbuzz.
     harfbuzz_buf_ = hb_buffer_create();
   }
+  shaping_cache_.reset(new ShapingCache(kShapingCacheBudget));
+  cache_shaping_ = true;
 
 #ifdef FLATUI_USE_LIBUNIBREAK
   // Initialize libunibreak
@@ -194,15 +307,38 @@ void FontManager::Terminate() {
 void FontManager::SetRenderer(fplbase::Renderer &renderer) {
   renderer_ = &renderer;
 
-  // Initialize the font atlas texture.
-  atlas_texture_.reset(new Texture(nullptr, fplbase::kFormatLuminance, false));
-  atlas_texture_.get()->LoadFromMemory(glyph_cache_->get_buffer(),
-                                       glyph_cache_->get_size(), false);
-  atlas_texture_.get()->Set(0);
+  // Initialize the font atlas textures.
+  atlas_textures_.clear();
+  UpdateAtlasTextures();
+}
+
+int32_t FontManager::UpdateAtlasTextures() {
+  // Recreate all textures when the glyph cache has grown or shrunk.
+  auto &size = glyph_cache_->get_size();
+  if (size.x() != atlas_texture_size_.x() ||
+      size.y() != atlas_texture_size_.y()) {
+    atlas_textures_.clear();
+    atlas_texture_size_ = size;
+  }
+  auto num_textures = static_cast<int32_t>(atlas_textures_.size());
+
+  // Create textures for glyph cache pages allocated since the last update.
+  for (auto page = num_textures;
+       page < glyph_cache_->get_num_pages(); ++page) {
+    auto texture = new Texture(nullptr, fplbase::kFormatLuminance, false);
+    texture->LoadFromMemory(glyph_cache_->get_buffer(page),
+                            glyph_cache_->get_size(), false);
+    atlas_textures_.push_back(std::unique_ptr<Texture>(texture));
+    counters_.uploaded_bytes += size.x() * size.y();
+  }
+  atlas_textures_[0]->Set(0);
+  return num_textures;
 }
 
-FontBuffer *FontManager::GetBuffer(const char *text, const size_t length,
-                                   const FontBufferParameters &parameter) {
+FontBuffer *FontManager::GetBuffer(
+    const char *text, const size_t length,
+    const FontBufferParameters &original_parameter) {
+  auto parameter = GetLayoutParameters(original_parameter);
   auto buffer = CreateBuffer(text, length, parameter);
   if (buffer == nullptr) {
     // Flush glyph cache & Upload a texture
@@ -220,51 +356,151 @@ FontBuffer *FontManager::GetBuffer(const char *text, const size_t length,
   return buffer;
 }
 
+FontBufferParameters FontManager::GetLayoutParameters(
+    const FontBufferParameters &parameters) const {
+  auto layout_parameters = parameters;
+  layout_parameters.SetLayoutSettings(layout_direction_, script_, locale_id_,
+                                      line_height_);
+  return layout_parameters;
+}
+
+// Retrieve the memory used by a FontBuffer and its key in bytes. Glyph pages
+// are not exposed and are counted as one more code point array.
+static size_t GetBufferBytes(const FontBuffer &buffer) {
+  auto bytes = sizeof(FontBuffer) + sizeof(FontBufferParameters) +
+               buffer.get_vertices()->capacity() * sizeof(FontVertex) +
+               buffer.get_code_points()->capacity() * sizeof(uint32_t) * 2 +
+               buffer.GetCaretPositions().capacity() * sizeof(mathfu::vec2i);
+  for (int32_t page = 0; page < buffer.get_num_pages(); ++page) {
+    bytes += buffer.get_indices(page)->capacity() * sizeof(uint16_t);
+  }
+  return bytes;
+}
+
 FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
                                       const FontBufferParameters &parameters) {
   // Adjust y size if the size selector is set.
   auto ysize = static_cast<int32_t>(parameters.get_font_size());
-  auto size = parameters.get_size();
   auto caret_info = parameters.get_caret_info_flag();
-  int32_t converted_ysize = ConvertSize(ysize);
-  float scale = ysize / static_cast<float>(converted_ysize);
-  bool multi_line = size.y() == 0 || size.y() > ysize;
+  int32_t converted_ysize = ConvertGlyphSize(ysize);
 
   // Check cache if we already have a FontBuffer generated.
-  auto it = map_buffers_.find(parameters);
-  if (it != map_buffers_.end()) {
+  auto cached_buffer = map_buffers_.Find(parameters);
+  if (cached_buffer != nullptr) {
     // Update current pass.
     if (current_pass_ != kRenderPass) {
-      it->second->set_pass(current_pass_);
+      cached_buffer->set_pass(current_pass_);
     }
 
     // Update UV of the buffer
-    auto ret = UpdateUV(converted_ysize, it->second.get());
+    auto ret = UpdateUV(converted_ysize, cached_buffer);
     return ret;
   }
 
   // Otherwise, create new FontBuffer.
 
   // Set freetype settings.
-  FT_Set_Pixel_Sizes(current_face_->face_, 0, converted_ysize);
+  SetFaceSize(current_face_, converted_ysize);
 
   // Create FontBuffer with derived string length.
   std::unique_ptr<FontBuffer> buffer(new FontBuffer(length, caret_info));
+  vec2i buffer_size;
+  FontMetrics metrics;
+  if (!LayoutBuffer(text, length, parameters, buffer.get(), &buffer_size,
+                    &metrics, nullptr)) {
+    return nullptr;
+  }
+
+  // Setup size.
+  buffer->set_size(buffer_size);
+
+  // Setup font metrics.
+  buffer->set_metrics(metrics);
+
+  // Construct indices arrays of each glyph cache page.
+  buffer->UpdateIndices();
+
+  // Set current pass.
+  if (current_pass_ != kRenderPass) {
+    buffer->set_pass(current_pass_);
+  }
+
+  // Verify the buffer.
+  assert(buffer->Verify());
+
+  // Insert the created entry to the cache.
+  auto bytes = GetBufferBytes(*buffer);
+  return map_buffers_.Insert(parameters, std::move(buffer), bytes);
+}
+
+vec2i FontManager::MeasureText(const char *text, const size_t length,
+                               const FontBufferParameters &original_parameters,
+                               FontMetrics *metrics) {
+  auto parameters = GetLayoutParameters(original_parameters);
+
+  // A FontBuffer of the text has the measurement already. The look up is not
+  // a use of the buffer, so that its age tells when it was last rendered.
+  uint32_t age = 0;
+  auto buffer = map_buffers_.Peek(parameters, &age);
+  if (buffer != nullptr) {
+    if (age <= 1 && current_pass_ != kRenderPass) {
+      // Rendered in the last frame.
+      PrefetchBuffer(parameters, buffer);
+    }
+    if (metrics != nullptr) {
+      *metrics = buffer->metrics();
+    }
+    return buffer->get_size();
+  }
+
+  auto handle = map_measurements_.Find(parameters);
+  if (handle == kInvalidFlatHashMapHandle) {
+    if (map_measurements_.size() >= kMeasurementCacheCapacity) {
+      map_measurements_.Clear();
+    }
+    auto ysize = static_cast<int32_t>(parameters.get_font_size());
+    SetFaceSize(current_face_, ConvertGlyphSize(ysize));
+    std::unique_ptr<TextMeasurement> measurement(new TextMeasurement);
+    LayoutBuffer(text, static_cast<uint32_t>(length), parameters, nullptr,
+                 &measurement->size, &measurement->metrics, nullptr);
+    handle = map_measurements_.Insert(parameters, std::move(measurement)).first;
+  }
+  auto measurement = map_measurements_.get_value(handle).get();
+  if (metrics != nullptr) {
+    *metrics = measurement->metrics;
+  }
+  return measurement->size;
+}
+
+bool FontManager::LayoutBuffer(const char *text, const uint32_t length,
+                               const FontBufferParameters &parameters,
+                               FontBuffer *buffer, vec2i *buffer_size,
+                               FontMetrics *metrics,
+                               std::vector<DynamicGlyph> *dynamic_glyphs) {
+  auto ysize = static_cast<int32_t>(parameters.get_font_size());
+  auto size = parameters.get_size();
+  auto caret_info = parameters.get_caret_info_flag();
+  auto add_carets = caret_info && buffer != nullptr;
+  int32_t converted_ysize = ConvertGlyphSize(ysize);
+  float scale = ysize / static_cast<float>(converted_ysize);
+  bool multi_line = size.y() == 0 || size.y() > ysize;
 
   // Retrieve word breaking information using libunibreak.
+  wordbreak_info_.resize(length);
   if (length) {
-    wordbreak_info_.resize(length);
     set_linebreaks_utf8(reinterpret_cast<const utf8_t *>(text), length,
                         language_.c_str(), &wordbreak_info_[0]);
   }
   WordEnumerator word_enum(wordbreak_info_, !multi_line);
 
-  // Initialize font metrics parameters.
-  int32_t base_line = ysize * current_face_->face_->ascender /
-                      current_face_->face_->units_per_EM;
-  if (base_line > ysize) {
-    base_line = ysize;
+  // Rasterize missing glyphs in parallel before the layout.
+  if (buffer != nullptr && rasterizer_ != nullptr &&
+      rasterizer_->get_num_threads() > 0) {
+    RasterizeGlyphs(text, length, converted_ysize, multi_line);
   }
+
+  // Initialize font metrics parameters.
+  auto base_line = GetBaseLine(ysize);
   FontMetrics initial_metrics(base_line, 0, base_line, base_line - ysize, 0);
 
   float pos_start = 0;
@@ -273,7 +509,6 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
     pos_start = static_cast<float>(size.x());
   }
   mathfu::vec2 pos(pos_start, 0);
-  FT_GlyphSlot glyph = current_face_->face_->glyph;
 
   uint32_t line_width = 0;
   uint32_t max_line_width = 0;
@@ -283,12 +518,52 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
   bool first_character = true;
   auto line_height = ysize * line_height_;
 
+  // The paragraph of the current word, shaped once for all words in it, and
+  // the index of the first glyph of the current word in logical order.
+  const ShapedRun *paragraph = nullptr;
+  uint32_t paragraph_start = 0;
+  uint32_t paragraph_end = 0;
+  size_t word_glyph = 0;
+  auto idx_advance = layout_direction_ == TextLayoutDirectionRTL ? -1 : 1;
+
+  // Glyph cache revision the UVs of the laid out glyphs are fetched in.
+  auto revision = glyph_cache_->get_revision();
+
   // Find words and layout them.
   while (word_enum.Advance()) {
+    auto word_start = static_cast<uint32_t>(word_enum.GetCurrentWordIndex());
+    auto word_end =
+        word_start + static_cast<uint32_t>(word_enum.GetCurrentWordLength());
+    if (word_start >= paragraph_end) {
+      paragraph_start = word_start;
+      paragraph_end = GetParagraphEnd(word_start, length, multi_line);
+      paragraph = LayoutText(text + paragraph_start,
+                             paragraph_end - paragraph_start);
+      word_glyph = 0;
+    }
+
+    // Glyphs of the word are the glyphs with clusters in the word. Harfbuzz
+    // stores glyphs of RTL text in the reverse order.
+    auto glyphs = paragraph->get_glyphs().data();
+    auto paragraph_glyph_count = paragraph->get_glyphs().size();
+    auto glyph_index = [&](size_t logical_index) {
+      return idx_advance > 0 ? logical_index
+                             : paragraph_glyph_count - 1 - logical_index;
+    };
+    auto first_glyph = word_glyph;
+    uint32_t word_advance = 0;
+    while (word_glyph < paragraph_glyph_count &&
+           paragraph_start + glyphs[glyph_index(word_glyph)].cluster <
+               word_end) {
+      word_advance += glyphs[glyph_index(word_glyph)].x_advance;
+      word_glyph++;
+    }
+    auto glyph_count = static_cast<uint32_t>(word_glyph - first_glyph);
+
     if (!multi_line) {
       // Single line text.
       // In this mode, it layouts all string into single line.
-      max_line_width = static_cast<uint32_t>(LayoutText(text, length) * scale);
+      max_line_width = static_cast<uint32_t>(word_advance * scale);
       if (layout_direction_ == TextLayoutDirectionRTL && size.x() == 0) {
         pos.x() = static_cast<float>(max_line_width / kFreeTypeUnit);
       }
@@ -297,11 +572,9 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
       // In this mode, it layouts every single word in the order of the text and
       // performs a line break if either current word exceeds the max line
       // width or indicated a line break must happen due to a line break
-      // character etc.
-      uint32_t word_width = static_cast<uint32_t>(
-          LayoutText(text + word_enum.GetCurrentWordIndex(),
-                     word_enum.GetCurrentWordLength()) *
-          scale);
+      // character etc. Advances of words include the kerning with the next
+      // word, as paragraphs are shaped as a whole.
+      uint32_t word_width = static_cast<uint32_t>(word_advance * scale);
       if (lastline_must_break || (line_width + word_width) / kFreeTypeUnit >
                                      static_cast<uint32_t>(size.x())) {
         // Line break.
@@ -312,9 +585,6 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
             !caret_info) {
           // The text size exceeds given size.
           // For now, we just don't render the rest of strings.
-
-          // Cleanup buffer contents.
-          hb_buffer_clear_contents(harfbuzz_buf_);
           break;
         }
 
@@ -335,39 +605,33 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
     }
 
     // Update the first caret position.
-    if (caret_info && first_character) {
+    if (add_carets && first_character) {
       buffer->AddCaretPosition(pos + vec2(0, base_line * scale));
       first_character = false;
     }
 
-    // Retrieve layout info.
-    uint32_t glyph_count;
-    auto glyph_info = hb_buffer_get_glyph_infos(harfbuzz_buf_, &glyph_count);
-    auto glyph_pos = hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
-
-    auto idx = 0;
-    auto idx_advance = 1;
-    if (layout_direction_ == TextLayoutDirectionRTL) {
-      idx = glyph_count - 1;
-      idx_advance = -1;
-    }
-
-    for (size_t i = 0; i < glyph_count; ++i, idx += idx_advance) {
-      auto code_point = glyph_info[idx].codepoint;
+    for (size_t i = 0; i < glyph_count; ++i) {
+      auto idx = glyph_index(first_glyph + i);
+      auto code_point = glyphs[idx].glyph_index;
       if (!code_point) {
         total_glyph_count--;
         continue;
       }
-      auto cache = GetCachedEntry(code_point, converted_ysize);
-      if (cache == nullptr) {
-        // Cleanup buffer contents.
-        hb_buffer_clear_contents(harfbuzz_buf_);
-        return nullptr;
+      // Glyphs are rasterized only when they are laid out to a buffer, the
+      // layout uses the glyph metrics.
+      const GlyphCacheEntry *cache = nullptr;
+      if (buffer != nullptr) {
+        cache = GetCachedEntry(code_point, converted_ysize);
+        if (cache == nullptr) {
+          return false;
+        }
       }
+      GlyphMetrics glyph_metrics;
+      GetGlyphMetrics(code_point, converted_ysize, &glyph_metrics);
 
       auto pos_advance =
-          mathfu::vec2(static_cast<float>(glyph_pos[idx].x_advance),
-                       static_cast<float>(-glyph_pos[idx].y_advance)) *
+          mathfu::vec2(static_cast<float>(glyphs[idx].x_advance),
+                       static_cast<float>(-glyphs[idx].y_advance)) *
           scale / static_cast<float>(kFreeTypeUnit);
       // Advance positions before rendering in RTL.
       if (layout_direction_ == TextLayoutDirectionRTL) {
@@ -375,36 +639,37 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
       }
 
       // Register vertices only when the glyph has a size.
-      if (cache->get_size().x() && cache->get_size().y()) {
-        // Add the code point to the buffer. This information is used when
-        // re-fetching UV information when the texture atlas is updated.
-        buffer->get_code_points()->push_back(code_point);
-
+      if (glyph_metrics.width && glyph_metrics.rows) {
         // Calculate internal/external leading value and expand a buffer if
         // necessary.
         FontMetrics new_metrics;
-        if (UpdateMetrics(glyph, initial_metrics, &new_metrics)) {
+        if (UpdateMetrics(glyph_metrics.top, glyph_metrics.rows,
+                          initial_metrics, &new_metrics)) {
           initial_metrics = new_metrics;
         }
 
-        // Construct indices array.
-        const uint16_t kIndices[] = {0, 1, 2, 1, 3, 2};
-        for (size_t j = 0; j < FPL_ARRAYSIZE(kIndices); ++j) {
-          auto index = kIndices[j];
-          buffer->get_indices()->push_back(
-              static_cast<unsigned short>(index + (total_glyph_count + i) * 4));
+        if (buffer != nullptr) {
+          // Add the code point to the buffer. This information is used when
+          // re-fetching UV information when the texture atlas is updated.
+          buffer->get_code_points()->push_back(code_point);
+
+          // Construct intermediate vertices array.
+          // The vertices array is update in the render pass with correct
+          // glyph size & glyph cache entry information.
+
+          // Update vertices.
+          buffer->AddVertices(pos, base_line, scale, *cache);
+          if (dynamic_glyphs != nullptr) {
+            DynamicGlyph glyph = {paragraph_start + glyphs[idx].cluster, pos};
+            dynamic_glyphs->push_back(glyph);
+          }
+
+          // Update UV and the glyph cache page.
+          buffer->UpdateUV(static_cast<int32_t>(total_glyph_count + i),
+                           cache->get_uv());
+          buffer->SetGlyphPage(static_cast<int32_t>(total_glyph_count + i),
+                               cache->get_page());
         }
-
-        // Construct intermediate vertices array.
-        // The vertices array is update in the render pass with correct
-        // glyph size & glyph cache entry information.
-
-        // Update vertices.
-        buffer->AddVertices(pos, base_line, scale, *cache);
-
-        // Update UV.
-        buffer->UpdateUV(static_cast<int32_t>(total_glyph_count + i),
-                         cache->get_uv());
       } else {
         total_glyph_count--;
       }
@@ -416,17 +681,21 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
 
       // Update caret information if it has been requested.
       bool end_of_line = lastline_must_break == true && i == glyph_count - 1;
-      if (caret_info && end_of_line == false) {
+      if (add_carets && end_of_line == false) {
         // Is the current glyph a ligature?
         // We are not using hb_ot_layout_get_ligature_carets() as the API barely
         // work with existing fonts.
         // https://bugs.freedesktop.org/show_bug.cgi?id=90962 tracks a request
         // for the issue.
-        auto carets = GetCaretPosCount(word_enum, glyph_info,
-                                       static_cast<int32_t>(glyph_count),
-                                       static_cast<int32_t>(idx));
-
-        auto scaled_offset = cache->get_offset().x() * scale;
+        auto cluster_end =
+            i + 1 < glyph_count
+                ? paragraph_start +
+                      glyphs[glyph_index(first_glyph + i + 1)].cluster
+                : word_end;
+        auto carets = GetCaretPosCount(paragraph_start + glyphs[idx].cluster,
+                                       cluster_end);
+
+        auto scaled_offset = glyph_metrics.left * scale;
         float scaled_base_line = base_line * scale;
         // Add caret points
         for (auto caret = 1; caret <= carets; ++caret) {
@@ -438,70 +707,298 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
       }
     }
 
-    // Set buffer revision using glyph cache revision.
-    buffer->set_revision(glyph_cache_->get_revision());
-
     // Update total number of glyphs.
     total_glyph_count += glyph_count;
+  }
 
-    // Cleanup buffer contents.
-    hb_buffer_clear_contents(harfbuzz_buf_);
+  // Set buffer revision using glyph cache revision. The glyph cache grows
+  // when a glyph doesn't fit, which moves the glyphs laid out before it.
+  if (buffer != nullptr) {
+    if (glyph_cache_->get_revision() == revision) {
+      buffer->set_revision(revision);
+    } else if (!FetchUV(converted_ysize, buffer)) {
+      return false;
+    }
   }
 
   // Add the last caret.
-  if (caret_info) {
+  if (add_carets) {
     buffer->AddCaretPosition(pos + vec2(0, base_line * scale));
   }
 
-  // Setup size.
-  buffer->set_size(vec2i(max_line_width / kFreeTypeUnit, total_height));
+  *buffer_size = vec2i(max_line_width / kFreeTypeUnit, total_height);
+  *metrics = initial_metrics;
+  return true;
+}
 
-  // Setup font metrics.
-  buffer->set_metrics(initial_metrics);
+int32_t FontManager::GetBaseLine(const int32_t ysize) const {
+  auto face = current_face_->face_;
+  return std::min(ysize * face->ascender / face->units_per_EM, ysize);
+}
+
+FontBuffer *FontManager::GetDynamicBuffer(
+    const HashedId id, const char *text, const size_t length,
+    const FontBufferParameters &original_parameters) {
+  auto parameters = GetLayoutParameters(original_parameters);
+  auto buffer = UpdateDynamicBuffer(id, text, length, parameters);
+  if (buffer == nullptr) {
+    // Flush glyph cache & Upload a texture
+    FlushAndUpdate();
+
+    // Try to lay out the buffer again.
+    buffer = UpdateDynamicBuffer(id, text, length, parameters);
+    if (buffer == nullptr) {
+      LogError("The given text '%s' with size:%d does not fit a glyph cache.\n",
+               text, parameters.get_size().y());
+    }
+  }
+  return buffer;
+}
+
+void FontManager::ReleaseDynamicBuffer(const HashedId id) {
+  auto handle = map_dynamic_buffers_.Find(id);
+  if (handle != kInvalidFlatHashMapHandle) {
+    map_dynamic_buffers_.Erase(handle);
+  }
+}
+
+FontBuffer *FontManager::UpdateDynamicBuffer(
+    const HashedId id, const char *text, const size_t length,
+    const FontBufferParameters &parameters) {
+  auto ysize = static_cast<int32_t>(parameters.get_font_size());
+  int32_t converted_ysize = ConvertGlyphSize(ysize);
+  auto handle = map_dynamic_buffers_.Find(id);
+  if (handle == kInvalidFlatHashMapHandle) {
+    handle = map_dynamic_buffers_
+                 .Insert(id, std::unique_ptr<DynamicBuffer>(new DynamicBuffer))
+                 .first;
+  }
+  auto dynamic = map_dynamic_buffers_.get_value(handle).get();
+  auto buffer = &dynamic->buffer;
+
+  // Parameters of the current layout with the new text.
+  auto layout_parameters = parameters;
+  layout_parameters.set_text_id(dynamic->parameters.get_text_id());
+  auto same_layout = layout_parameters == dynamic->parameters;
+  auto same_text =
+      same_layout &&
+      parameters.get_text_id() == dynamic->parameters.get_text_id() &&
+      dynamic->text.compare(0, std::string::npos, text, length) == 0;
+  if (!same_text &&
+      (!same_layout ||
+       !UpdateDynamicDigits(dynamic, text, length, parameters))) {
+    // Lay out the buffer again. The buffer is invalid until the layout
+    // succeeds.
+    dynamic->parameters = FontBufferParameters();
+    SetFaceSize(current_face_, converted_ysize);
+    if (!same_layout) {
+      // Rasterize digits of the new font settings, so that updates of numbers
+      // don't rasterize glyphs.
+      for (auto c = '0'; c <= '9'; ++c) {
+        auto glyph_index = FT_Get_Char_Index(current_face_->face_, c);
+        if (glyph_index) {
+          GetCachedEntry(glyph_index, converted_ysize);
+        }
+      }
+    }
+
+    vec2i buffer_size;
+    FontMetrics metrics;
+    buffer->Clear(static_cast<uint32_t>(length),
+                  parameters.get_caret_info_flag());
+    dynamic->glyphs.clear();
+    cache_shaping_ = false;
+    auto laid_out = LayoutBuffer(text, static_cast<uint32_t>(length),
+                                 parameters, buffer, &buffer_size, &metrics,
+                                 &dynamic->glyphs);
+    cache_shaping_ = true;
+    if (!laid_out) {
+      return nullptr;
+    }
+    buffer->set_size(buffer_size);
+    buffer->set_metrics(metrics);
+    buffer->UpdateIndices();
+    assert(buffer->Verify());
+    dynamic->parameters = parameters;
+    dynamic->text.assign(text, length);
+  }
 
-  // Set current pass.
   if (current_pass_ != kRenderPass) {
     buffer->set_pass(current_pass_);
   }
+  return UpdateUV(converted_ysize, buffer);
+}
 
-  // Verify the buffer.
-  assert(buffer->Verify());
+bool FontManager::UpdateDynamicDigits(DynamicBuffer *dynamic,
+                                      const char *text, const size_t length,
+                                      const FontBufferParameters &parameters) {
+  auto &old_text = dynamic->text;
+  if (old_text.size() != length || parameters.get_caret_info_flag() ||
+      layout_direction_ != TextLayoutDirectionLTR) {
+    return false;
+  }
+  auto ysize = static_cast<int32_t>(parameters.get_font_size());
+  int32_t converted_ysize = ConvertGlyphSize(ysize);
+  SetFaceSize(current_face_, converted_ysize);
+  auto face = current_face_;
+  if (face->simple_glyphs_.empty() ||
+      (script_ != HB_SCRIPT_LATIN && script_ != HB_SCRIPT_COMMON) ||
+      face->sizes_.empty() || face->sizes_.back().ysize != face->ysize_) {
+    return false;
+  }
 
-  // Insert the created entry to the hash map.
-  auto insert = map_buffers_.insert(
-      std::pair<FontBufferParameters, std::unique_ptr<FontBuffer>>(
-          parameters, std::move(buffer)));
-  return insert.first->second.get();
-}
-
-int32_t FontManager::GetCaretPosCount(const WordEnumerator &word_enum,
-                                      const hb_glyph_info_t *glyph_info,
-                                      int32_t glyph_count, int32_t index) {
-  // Retrieve a byte range for the glyph in the wordbreak buffer from harfbuzz
-  // buffer.
-  auto byte_index = glyph_info[index].cluster;
-  auto byte_size = 0;
-  auto direction = layout_direction_ == TextLayoutDirectionLTR ? 1 : -1;
-
-  if (index >= -direction && index < glyph_count - direction) {
-    // Has next word. Calculate a difference between them.
-    byte_size = glyph_info[index + direction].cluster - byte_index;
-  } else {
-    // Up until end of the buffer.
-    byte_size = static_cast<int>(word_enum.GetCurrentWordLength() - byte_index);
+  // Check that the layout of the new text only differs in the glyphs of the
+  // changed digits: the digits are simple glyphs with the same advance that
+  // aren't adjusted by the characters next to them, and that fit in the
+  // initial metrics of the buffer.
+  auto base_line = GetBaseLine(ysize);
+  FontMetrics initial_metrics(base_line, 0, base_line, base_line - ysize, 0);
+  auto is_digit = [](const uint32_t code_point) {
+    return code_point >= '0' && code_point <= '9';
+  };
+  auto is_simple = [&](const uint32_t code_point) {
+    return code_point < 0x80 && face->simple_glyphs_[code_point] != 0;
+  };
+  auto is_unchanged_glyph = [&](const uint32_t code_point) {
+    GlyphMetrics metrics;
+    FontMetrics new_metrics;
+    return GetGlyphMetrics(face->simple_glyphs_[code_point], converted_ysize,
+                           &metrics) &&
+           metrics.width && metrics.rows &&
+           !UpdateMetrics(metrics.top, metrics.rows, initial_metrics,
+                          &new_metrics);
+  };
+  auto changed = false;
+  for (size_t i = 0; i < length; ++i) {
+    uint32_t old_code_point = static_cast<uint8_t>(old_text[i]);
+    uint32_t code_point = static_cast<uint8_t>(text[i]);
+    if (old_code_point == code_point) {
+      continue;
+    }
+    if (!is_digit(old_code_point) || !is_digit(code_point) ||
+        !is_simple(old_code_point) || !is_simple(code_point) ||
+        GetSimpleAdvance(old_code_point) != GetSimpleAdvance(code_point) ||
+        !is_unchanged_glyph(old_code_point) ||
+        !is_unchanged_glyph(code_point)) {
+      return false;
+    }
+    if (i > 0) {
+      uint32_t previous = static_cast<uint8_t>(text[i - 1]);
+      uint32_t old_previous = static_cast<uint8_t>(old_text[i - 1]);
+      if (!is_simple(previous) || !IsSimplePair(previous, code_point) ||
+          !IsSimplePair(old_previous, old_code_point)) {
+        return false;
+      }
+    }
+    if (i + 1 < length) {
+      uint32_t next = static_cast<uint8_t>(text[i + 1]);
+      uint32_t old_next = static_cast<uint8_t>(old_text[i + 1]);
+      if (!is_simple(next) || !IsSimplePair(code_point, next) ||
+          !IsSimplePair(old_code_point, old_next)) {
+        return false;
+      }
+    }
+    changed = true;
+  }
+  if (!changed) {
+    // Only the text hash differs.
+    dynamic->parameters = parameters;
+    return true;
+  }
+
+  // Rewrite the vertices of the changed digits.
+  auto buffer = &dynamic->buffer;
+  auto scale = ysize / static_cast<float>(converted_ysize);
+  auto code_points = buffer->get_code_points();
+  auto revision = glyph_cache_->get_revision();
+  bool page_changed = false;
+  for (size_t i = 0; i < dynamic->glyphs.size(); ++i) {
+    auto &glyph = dynamic->glyphs[i];
+    uint32_t code_point = static_cast<uint8_t>(text[glyph.offset]);
+    if (code_point == static_cast<uint8_t>(old_text[glyph.offset])) {
+      continue;
+    }
+    auto glyph_index = face->simple_glyphs_[code_point];
+    auto cache = GetCachedEntry(glyph_index, converted_ysize);
+    if (cache == nullptr) {
+      dynamic->parameters = FontBufferParameters();
+      return false;
+    }
+    auto index = static_cast<int32_t>(i);
+    buffer->SetVertices(index, glyph.position, base_line, scale, *cache);
+    buffer->UpdateUV(index, cache->get_uv());
+    page_changed |= buffer->SetGlyphPage(index, cache->get_page());
+    (*code_points)[i] = glyph_index;
+  }
+  if (page_changed) {
+    buffer->UpdateIndices();
+  }
+
+  // Glyphs of the changed digits may have grown the glyph cache, which moves
+  // the other glyphs of the buffer.
+  if (glyph_cache_->get_revision() != revision &&
+      !FetchUV(converted_ysize, buffer)) {
+    dynamic->parameters = FontBufferParameters();
+    return false;
+  }
+  dynamic->parameters = parameters;
+  old_text.assign(text, length);
+  return true;
+}
+
+bool FontManager::GetGlyphMetrics(const uint32_t glyph_index,
+                                  const int32_t ysize, GlyphMetrics *metrics) {
+  GlyphKey key(current_face_->font_id_, glyph_index, ysize);
+  auto handle = map_glyph_metrics_.Find(key);
+  if (handle != kInvalidFlatHashMapHandle) {
+    *metrics = map_glyph_metrics_.get_value(handle);
+    return true;
   }
 
+  // Load the glyph without rendering it.
+  if (FT_Load_Glyph(current_face_->face_, glyph_index, FT_LOAD_DEFAULT)) {
+    *metrics = GlyphMetrics();
+    return false;
+  }
+  GetGlyphSlotMetrics(current_face_->face_->glyph, metrics);
+  SetGlyphMetrics(key, *metrics);
+  return true;
+}
+
+void FontManager::SetGlyphMetrics(const GlyphKey &key,
+                                  const GlyphMetrics &metrics) {
+  if (map_glyph_metrics_.size() >= kGlyphMetricsCacheCapacity) {
+    map_glyph_metrics_.Clear();
+  }
+  map_glyph_metrics_.Insert(key, metrics);
+}
+
+int32_t FontManager::GetCaretPosCount(const uint32_t start,
+                                      const uint32_t end) {
   // Count the number of characters in the given range in the wordbreak bufer.
   auto num_characters = 0;
-  for (auto i = 0; i < byte_size; ++i) {
-    if (word_enum.GetBuffer()->at(word_enum.GetCurrentWordIndex() + byte_index +
-                                  i) != LINEBREAK_INSIDEACHAR) {
+  for (auto i = start; i < end; ++i) {
+    if (wordbreak_info_[i] != LINEBREAK_INSIDEACHAR) {
       num_characters++;
     }
   }
   return num_characters;
 }
 
+uint32_t FontManager::GetParagraphEnd(const uint32_t start,
+                                      const uint32_t length,
+                                      const bool multi_line) {
+  if (!multi_line) {
+    return length;
+  }
+  // A paragraph ends with a mandatory line break.
+  auto end = start;
+  while (end < length && wordbreak_info_[end] != LINEBREAK_MUSTBREAK) {
+    end++;
+  }
+  return std::min(end + 1, length);
+}
+
 FontBuffer *FontManager::UpdateUV(const int32_t ysize, FontBuffer *buffer) {
   if (buffer->get_revision() != current_atlas_revision_) {
     // Cache revision has been updated.
@@ -510,24 +1007,55 @@ FontBuffer *FontManager::UpdateUV(const int32_t ysize, FontBuffer *buffer) {
     // layout information.
 
     // Set freetype settings.
-    FT_Set_Pixel_Sizes(current_face_->face_, 0, ysize);
+    SetFaceSize(current_face_, ysize);
+    if (!FetchUV(ysize, buffer)) {
+      return nullptr;
+    }
+  }
+  return buffer;
+}
 
-    auto code_points = buffer->get_code_points();
+bool FontManager::FetchUV(const int32_t ysize, FontBuffer *buffer) {
+  auto code_points = buffer->get_code_points();
+  bool page_changed = false;
+  uint32_t revision;
+  do {
+    revision = glyph_cache_->get_revision();
     for (size_t i = 0; i < code_points->size(); ++i) {
       auto code_point = code_points->at(i);
       auto cache = GetCachedEntry(code_point, ysize);
       if (cache == nullptr) {
-        return nullptr;
+        return false;
       }
 
-      // Update UV.
+      // Update UV and the glyph cache page.
       buffer->UpdateUV(static_cast<int32_t>(i), cache->get_uv());
+      page_changed |=
+          buffer->SetGlyphPage(static_cast<int32_t>(i), cache->get_page());
+    }
+  } while (glyph_cache_->get_revision() != revision);
+
+  // Update revision.
+  buffer->set_revision(revision);
+  if (page_changed) {
+    buffer->UpdateIndices();
+  }
+  return true;
+}
 
-      // Update revision.
-      buffer->set_revision(glyph_cache_->get_revision());
+void FontManager::PrefetchBuffer(const FontBufferParameters &parameters,
+                                  FontBuffer *buffer) {
+  auto ysize = static_cast<int32_t>(parameters.get_font_size());
+  int32_t converted_ysize = ConvertGlyphSize(ysize);
+  buffer->set_pass(current_pass_);
+  if (UpdateUV(converted_ysize, buffer) == nullptr) {
+    FlushAndUpdate();
+    buffer->set_pass(current_pass_);
+    if (UpdateUV(converted_ysize, buffer) == nullptr) {
+      LogError("The glyphs of a FontBuffer with size:%d do not fit a glyph "
+               "cache.\n", ysize);
     }
   }
-  return buffer;
 }
 
 FontTexture *FontManager::GetTexture(const char *text, const uint32_t length,
@@ -535,44 +1063,56 @@ FontTexture *FontManager::GetTexture(const char *text, const uint32_t length,
   // Round up y size if the size selector is set.
   int32_t ysize = ConvertSize(static_cast<int32_t>(original_ysize));
 
-  auto parameter =
+  auto parameter = GetLayoutParameters(
       FontBufferParameters(GetCurrentFace()->font_id_, flatui::HashId(text),
-                           static_cast<float>(ysize), mathfu::kZeros2i, false);
+                           static_cast<float>(ysize), mathfu::kZeros2i, false));
 
   // Check cache if we already have a texture.
-  auto it = map_textures_.find(parameter);
-  if (it != map_textures_.end()) {
-    return it->second.get();
+  auto cached_texture = map_textures_.Find(parameter);
+  if (cached_texture != nullptr) {
+    return cached_texture;
   }
 
   // Otherwise, create new texture.
 
   // Set freetype settings.
-  FT_Set_Pixel_Sizes(current_face_->face_, 0, ysize);
+  SetFaceSize(current_face_, ysize);
 
   // Layout text.
-  auto string_width = LayoutText(text, length) / kFreeTypeUnit;
+  auto run = LayoutText(text, length);
+  auto string_width = run->get_width() / kFreeTypeUnit;
 
   // Retrieve layout info.
-  uint32_t glyph_count;
-  hb_glyph_info_t *glyph_info =
-      hb_buffer_get_glyph_infos(harfbuzz_buf_, &glyph_count);
-  hb_glyph_position_t *glyph_pos =
-      hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
-
-  // Calculate texture size. The texture may be expanded later depending on
-  // glyph sizes.
-  int32_t width = RoundUpToPowerOf2(string_width);
-  int32_t height = RoundUpToPowerOf2(ysize);
+  auto glyphs = run->get_glyphs().data();
+  auto glyph_count = run->get_glyphs().size();
 
   // Initialize font metrics parameters.
-  int32_t base_line = ysize * current_face_->face_->ascender /
-                      current_face_->face_->units_per_EM;
-  if (base_line > ysize) {
-    base_line = ysize;
-  }
+  auto base_line = GetBaseLine(ysize);
   FontMetrics initial_metrics(base_line, 0, base_line, base_line - ysize, 0);
 
+  // Calculate internal/external leading values from the glyph metrics before
+  // rendering glyphs, so that the texture is allocated with its final size.
+  for (size_t i = 0; i < glyph_count; ++i) {
+    auto code_point = glyphs[i].glyph_index;
+    if (!code_point) continue;
+    GlyphMetrics glyph_metrics;
+    if (!GetGlyphMetrics(code_point, ysize, &glyph_metrics)) {
+      // Error. This could happen typically the loaded font does not support
+      // particular glyph.
+      LogInfo("Can't load glyph %c\n", text[i]);
+      return nullptr;
+    }
+    FontMetrics new_metrics;
+    if (UpdateMetrics(glyph_metrics.top, glyph_metrics.rows, initial_metrics,
+                      &new_metrics)) {
+      initial_metrics = new_metrics;
+    }
+  }
+
+  // Calculate texture size.
+  int32_t width = RoundUpToPowerOf2(string_width);
+  int32_t height = RoundUpToPowerOf2(initial_metrics.total());
+
   // rasterized image format in FreeType is 8 bit gray scale format.
   std::unique_ptr<uint8_t[]> image(new uint8_t[width * height]);
   memset(image.get(), 0, width * height);
@@ -583,7 +1123,7 @@ FontTexture *FontManager::GetTexture(const char *text, const uint32_t length,
   FT_GlyphSlot glyph = current_face_->face_->glyph;
 
   for (size_t i = 0; i < glyph_count; ++i) {
-    auto code_point = glyph_info[i].codepoint;
+    auto code_point = glyphs[i].glyph_index;
     if (!code_point) continue;
     FT_Error err =
         FT_Load_Glyph(current_face_->face_, code_point, FT_LOAD_RENDER);
@@ -597,19 +1137,6 @@ FontTexture *FontManager::GetTexture(const char *text, const uint32_t length,
       return nullptr;
     }
 
-    // Calculate internal/external leading value and expand a buffer if
-    // necessary.
-    FontMetrics new_metrics;
-    if (UpdateMetrics(glyph, initial_metrics, &new_metrics)) {
-      if (new_metrics.total() != initial_metrics.total()) {
-        // Expand buffer and update height if necessary.
-        if (ExpandBuffer(width, height, initial_metrics, new_metrics, &image)) {
-          height = RoundUpToPowerOf2(new_metrics.total());
-        }
-      }
-      initial_metrics = new_metrics;
-    }
-
     if (i == 0 && glyph->bitmap_left < 0) {
       // Slightly shift all text to right.
       pos.x() = static_cast<float>(-glyph->bitmap_left);
@@ -625,8 +1152,8 @@ FontTexture *FontManager::GetTexture(const char *text, const uint32_t length,
     }
 
     // Advance positions.
-    pos += mathfu::vec2(static_cast<float>(glyph_pos[i].x_advance),
-                        static_cast<float>(-glyph_pos[i].y_advance)) /
+    pos += mathfu::vec2(static_cast<float>(glyphs[i].x_advance),
+                        static_cast<float>(-glyphs[i].y_advance)) /
            static_cast<float>(kFreeTypeUnit);
   }
 
@@ -637,64 +1164,13 @@ FontTexture *FontManager::GetTexture(const char *text, const uint32_t length,
   // Setup font metrics.
   tex->set_metrics(initial_metrics);
 
-  // Cleanup buffer contents.
-  hb_buffer_clear_contents(harfbuzz_buf_);
-
-  // Put to the dic.
-  map_textures_[parameter].reset(tex);
+  // Put to the cache. Glyph images are 8 bit.
+  map_textures_.Insert(parameter, std::unique_ptr<FontTexture>(tex),
+                       sizeof(FontTexture) + width * height);
 
   return tex;
 }
 
-bool FontManager::ExpandBuffer(const int32_t width, const int32_t height,
-                               const FontMetrics &original_metrics,
-                               const FontMetrics &new_metrics,
-                               std::unique_ptr<uint8_t[]> *image) {
-  // Returns immediately if the size has not been changed.
-  if (original_metrics.total() == new_metrics.total()) {
-    return false;
-  }
-
-  int32_t new_height = RoundUpToPowerOf2(new_metrics.total());
-  int32_t internal_leading_change =
-      new_metrics.internal_leading() - original_metrics.internal_leading();
-  // Internal leading tracks max value of it in rendering glyphs, so we can
-  // assume internal_leading_change >= 0.
-  assert(internal_leading_change >= 0);
-
-  if (height != new_height) {
-    // Reallocate buffer.
-    std::unique_ptr<uint8_t[]> old_image = std::move(*image);
-    image->reset(new uint8_t[width * new_height]);
-
-    // Copy existing contents.
-    memcpy(&(*image)[width * internal_leading_change], old_image.get(),
-           width * original_metrics.total());
-
-    // Clear top.
-    memset(image->get(), 0, width * internal_leading_change);
-
-    // Clear bottom.
-    int32_t clear_offset = original_metrics.total() + internal_leading_change;
-    memset(&(*image)[width * clear_offset], 0,
-           width * (new_height - clear_offset));
-    return true;
-  } else {
-    if (internal_leading_change > 0) {
-      // Move existing contents down and make a space for additional internal
-      // leading.
-      memcpy(&(*image)[width * internal_leading_change], image->get(),
-             width * original_metrics.total());
-
-      // Clear the top
-      memset(image->get(), 0, width * internal_leading_change);
-    }
-    // Bottom doesn't have to be cleared since the part is already clean.
-  }
-
-  return false;
-}
-
 bool FontManager::Open(const char *font_name) {
   auto it = map_faces_.find(font_name);
   if (it != map_faces_.end()) {
@@ -735,6 +1211,7 @@ bool FontManager::Open(const char *font_name) {
   }
 
   face->font_id_ = HashId(font_name);
+  face->BuildSimpleLayout();
 
   // Set first opened font as a default font.
   if (!face_initialized_) {
@@ -742,6 +1219,11 @@ bool FontManager::Open(const char *font_name) {
   }
 
   face_initialized_ = true;
+
+  // Restore glyphs of the font from the glyph cache file.
+  if (!glyph_cache_file_.empty()) {
+    RestoreGlyphCache();
+  }
   return true;
 }
 
@@ -752,10 +1234,17 @@ bool FontManager::Close(const char *font_name) {
   }
 
   // Clean up face instance data.
+  if (rasterizer_ != nullptr) {
+    rasterizer_->RemoveFont(it->second->font_id_);
+  }
   it->second->Close();
 
-  map_textures_.clear();
-  map_buffers_.clear();
+  map_textures_.Clear();
+  map_buffers_.Clear();
+  map_measurements_.Clear();
+  map_dynamic_buffers_.Clear();
+  map_glyph_metrics_.Clear();
+  shaping_cache_->Clear();
 
   map_faces_.erase(it);
 
@@ -778,25 +1267,178 @@ bool FontManager::SelectFont(const char *font_name) {
 void FontManager::StartLayoutPass() {
   // Reset pass.
   current_pass_ = 0;
+
+  // Update frame stats.
+  auto total = GetTotalCounters();
+  frame_counters_.glyph_hits =
+      total.glyph_hits - frame_start_counters_.glyph_hits;
+  frame_counters_.glyph_misses =
+      total.glyph_misses - frame_start_counters_.glyph_misses;
+  frame_counters_.rasterizations =
+      total.rasterizations - frame_start_counters_.rasterizations;
+  frame_counters_.evictions = total.evictions - frame_start_counters_.evictions;
+  frame_counters_.evicted_glyphs =
+      total.evicted_glyphs - frame_start_counters_.evicted_glyphs;
+  frame_counters_.evicted_recent_glyphs =
+      total.evicted_recent_glyphs - frame_start_counters_.evicted_recent_glyphs;
+  frame_counters_.flushes = total.flushes - frame_start_counters_.flushes;
+  frame_counters_.subpasses = total.subpasses - frame_start_counters_.subpasses;
+  frame_counters_.uploaded_bytes =
+      total.uploaded_bytes - frame_start_counters_.uploaded_bytes;
+  frame_counters_.face_resizes =
+      total.face_resizes - frame_start_counters_.face_resizes;
+  frame_counters_.face_resizes_avoided =
+      total.face_resizes_avoided - frame_start_counters_.face_resizes_avoided;
+  frame_counters_.shaping_hits =
+      total.shaping_hits - frame_start_counters_.shaping_hits;
+  frame_counters_.shaping_misses =
+      total.shaping_misses - frame_start_counters_.shaping_misses;
+  frame_counters_.simple_layouts =
+      total.simple_layouts - frame_start_counters_.simple_layouts;
+  frame_counters_.buffer_evictions =
+      total.buffer_evictions - frame_start_counters_.buffer_evictions;
+  frame_counters_.texture_evictions =
+      total.texture_evictions - frame_start_counters_.texture_evictions;
+  frame_start_counters_ = total;
+
+  // Evict buffers and textures unused for a while or over the budgets.
+  map_buffers_.Update();
+  map_textures_.Update();
+}
+
+FontManagerCounters FontManager::GetTotalCounters() const {
+  auto &cache_stats = glyph_cache_->get_stats();
+  auto counters = counters_;
+  counters.glyph_hits = cache_stats.hits;
+  counters.glyph_misses = cache_stats.lookups - cache_stats.hits;
+  counters.evictions = cache_stats.evictions;
+  auto &eviction_stats = glyph_cache_->get_eviction_policy().get_stats();
+  counters.evicted_glyphs = eviction_stats.evicted_glyphs;
+  counters.evicted_recent_glyphs = eviction_stats.evicted_recent_glyphs;
+  counters.flushes = cache_stats.flushes;
+  auto &shaping_stats = shaping_cache_->get_stats();
+  counters.shaping_hits = shaping_stats.hits;
+  counters.shaping_misses = shaping_stats.lookups - shaping_stats.hits;
+  counters.buffer_evictions = map_buffers_.get_stats().evictions;
+  counters.texture_evictions = map_textures_.get_stats().evictions;
+  return counters;
+}
+
+FontManagerStats FontManager::GetStats() const {
+  FontManagerStats stats;
+  stats.frame = frame_counters_;
+  stats.total = GetTotalCounters();
+  stats.occupancy_percent = glyph_cache_->GetOccupancy() * 100.0f;
+  stats.fragmentation_percent = glyph_cache_->GetFragmentation() * 100.0f;
+  stats.pinned_glyphs = static_cast<int32_t>(glyph_cache_->get_num_pinned());
+  auto &size = glyph_cache_->get_size();
+  stats.pinned_percent =
+      glyph_cache_->GetPinnedArea() * 100.0f /
+      static_cast<float>(size.x() * size.y() * glyph_cache_->get_num_pages());
+  stats.cached_buffers = static_cast<int32_t>(map_buffers_.size());
+  stats.buffer_cache_bytes = map_buffers_.get_used_bytes();
+  stats.cached_textures = static_cast<int32_t>(map_textures_.size());
+  stats.texture_cache_bytes = map_textures_.get_used_bytes();
+  return stats;
+}
+
+bool FontManager::PinGlyph(uint32_t code_point, float ysize) {
+  auto converted_ysize = ConvertGlyphSize(static_cast<int32_t>(ysize));
+  SetFaceSize(current_face_, converted_ysize);
+  auto glyph_index = FT_Get_Char_Index(current_face_->face_, code_point);
+  if (!glyph_index) {
+    return false;
+  }
+  return PinGlyphIndex(glyph_index, converted_ysize);
+}
+
+bool FontManager::PinText(const char *text, float ysize) {
+  auto converted_ysize = ConvertGlyphSize(static_cast<int32_t>(ysize));
+  SetFaceSize(current_face_, converted_ysize);
+  auto run = LayoutText(text, strlen(text));
+
+  auto ret = true;
+  for (auto &glyph : run->get_glyphs()) {
+    if (glyph.glyph_index) {
+      ret &= PinGlyphIndex(glyph.glyph_index, converted_ysize);
+    }
+  }
+  return ret;
+}
+
+bool FontManager::PinGlyphIndex(const uint32_t glyph_index,
+                                const int32_t ysize) {
+  if (GetCachedEntry(glyph_index, ysize) == nullptr) {
+    return false;
+  }
+  return glyph_cache_->Pin(
+      GlyphKey(current_face_->font_id_, glyph_index, ysize));
+}
+
+void FontManager::FlushLayout() {
+  map_buffers_.Clear();
+  map_measurements_.Clear();
+  map_dynamic_buffers_.Clear();
+}
+
+void FontManager::UpdateAtlas() {
+  // Glyphs of the next subpass are uploaded when the subpass starts.
+  if (!glyph_cache_->get_dirty_state() || current_pass_ > 0) {
+    return;
+  }
+
+  // Newly allocated pages (or all pages when the glyph cache has been
+  // resized) are uploaded as a whole.
+  auto num_textures = UpdateAtlasTextures();
+
+  auto pitch = glyph_cache_->get_size().x();
+  for (int32_t page = 0; page < num_textures; ++page) {
+    if (!glyph_cache_->IsPageDirty(page)) continue;
+    atlas_textures_[page]->Set(0);
+    for (auto &rect : glyph_cache_->get_dirty_rects(page)) {
+      auto width = rect.z() - rect.x();
+      auto height = rect.w() - rect.y();
+      auto data = glyph_cache_->get_buffer(page) + pitch * rect.y() + rect.x();
+      if (width != pitch) {
+        // Texture uploads take tightly packed rows, copy the rect to the
+        // staging buffer.
+        upload_buffer_.resize(width * height);
+        for (int32_t y = 0; y < height; ++y) {
+          memcpy(&upload_buffer_[width * y], data + pitch * y, width);
+        }
+        data = upload_buffer_.data();
+      }
+      Texture::UpdateTexture(fplbase::kFormatLuminance, rect.x(), rect.y(),
+                             width, height, data);
+      counters_.uploaded_bytes += width * height;
+    }
+  }
+  current_atlas_revision_ = glyph_cache_->get_revision();
+  glyph_cache_->set_dirty_state(false);
 }
 
 void FontManager::UpdatePass(const bool start_subpass) {
   // Increment a cycle counter in glyph cache.
   glyph_cache_->Update();
 
-  if (glyph_cache_->get_dirty_state() && current_pass_ <= 0) {
-    auto rect = glyph_cache_->get_dirty_rect();
-    atlas_texture_.get()->Set(0);
-    Texture::UpdateTexture(fplbase::kFormatLuminance, 0, rect.y(),
-                           glyph_cache_.get()->get_size().x(),
-                           rect.w() - rect.y(),
-                           glyph_cache_.get()->get_buffer() +
-                               glyph_cache_.get()->get_size().x() * rect.y());
-    current_atlas_revision_ = glyph_cache_->get_revision();
-    glyph_cache_->set_dirty_state(false);
+  if (!start_subpass && current_pass_ == 0 && compaction_budget_ > 0.0f) {
+    // Defragment the glyph cache within the budget before the upload.
+    auto start = std::chrono::steady_clock::now();
+    auto budget = std::chrono::duration<float, std::milli>(compaction_budget_);
+    while (glyph_cache_->CompactStep() &&
+           std::chrono::steady_clock::now() - start < budget) {
+    }
   }
 
-  if (start_subpass) {
+  UpdateAtlas();
+
+  if (start_subpass && current_pass_ == kRenderPass) {
+    // Buffers rendered so far have been drawn with the uploaded atlas, the
+    // following ones are uploaded by UpdateAtlas() before they are rendered.
+    glyph_cache_->Flush();
+    current_atlas_revision_ = glyph_cache_->get_revision();
+    counters_.subpasses++;
+  } else if (start_subpass) {
     if (current_pass_ > 0) {
       LogInfo(
           "Multiple subpasses in one rendering pass is not supported. "
@@ -807,51 +1449,214 @@ void FontManager::UpdatePass(const bool start_subpass) {
     glyph_cache_->Flush();
     current_atlas_revision_ = glyph_cache_->get_revision();
     current_pass_++;
+    counters_.subpasses++;
   } else {
     // Reset pass.
     current_pass_ = kRenderPass;
   }
 }
 
-uint32_t FontManager::LayoutText(const char *text, const size_t length) {
-  SetLanguageSettings();
-  hb_buffer_set_language(
-      harfbuzz_buf_, hb_language_from_string(text, static_cast<int>(length)));
+const ShapedRun *FontManager::LayoutText(const char *text,
+                                         const size_t length) {
+  if (cache_shaping_) {
+    auto run = shaping_cache_->Find(
+        current_face_->font_id_, current_face_->ysize_, script_,
+        layout_direction_, harfbuzz_language_, text, length);
+    if (run != nullptr) {
+      return run;
+    }
+  }
+
+  uint32_t string_width = 0;
+  if (LayoutSimpleText(text, length, &string_width)) {
+    counters_.simple_layouts++;
+#if FLATUI_VALIDATE_SIMPLE_LAYOUT
+    if (!MatchesShapedText(text, length)) {
+      LogError("Simple layout differs from harfbuzz: '%.*s'\n",
+               static_cast<int>(length), text);
+      assert(0);
+    }
+#endif  // FLATUI_VALIDATE_SIMPLE_LAYOUT
+  } else {
+    // Layout the text.
+    ShapeText(text, length);
+
+    // Retrieve layout info.
+    uint32_t glyph_count;
+    auto glyph_info = hb_buffer_get_glyph_infos(harfbuzz_buf_, &glyph_count);
+    auto glyph_pos =
+        hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+
+    // Store the glyphs and retrieve a width of the string.
+    shaped_glyphs_.resize(glyph_count);
+    for (uint32_t i = 0; i < glyph_count; ++i) {
+      auto &glyph = shaped_glyphs_[i];
+      glyph.glyph_index = glyph_info[i].codepoint;
+      glyph.cluster = glyph_info[i].cluster;
+      glyph.x_advance = glyph_pos[i].x_advance;
+      glyph.y_advance = glyph_pos[i].y_advance;
+      string_width += glyph_pos[i].x_advance;
+    }
+
+    // Cleanup buffer contents.
+    hb_buffer_clear_contents(harfbuzz_buf_);
+  }
+  return cache_shaping_
+             ? shaping_cache_->Set(&shaped_glyphs_, string_width)
+             : shaping_cache_->SetUncached(&shaped_glyphs_, string_width);
+}
 
-  // Layout the text.
+void FontManager::ShapeText(const char *text, const size_t length) {
+  SetLanguageSettings();
+  hb_buffer_set_language(harfbuzz_buf_, harfbuzz_language_);
   hb_buffer_add_utf8(harfbuzz_buf_, text, static_cast<unsigned int>(length), 0,
                      static_cast<int>(length));
   hb_shape(current_face_->harfbuzz_font_, harfbuzz_buf_, nullptr, 0);
+}
 
-  // Retrieve layout info.
+bool FontManager::LayoutSimpleText(const char *text, const size_t length,
+                                   uint32_t *width) {
+  auto face = current_face_;
+  if (face->simple_glyphs_.empty() ||
+      layout_direction_ == TextLayoutDirectionRTL ||
+      (script_ != HB_SCRIPT_LATIN && script_ != HB_SCRIPT_COMMON) ||
+      face->sizes_.empty() || face->sizes_.back().ysize != face->ysize_) {
+    return false;
+  }
+
+  shaped_glyphs_.clear();
+  *width = 0;
+  uint32_t previous = 0;
+  for (size_t i = 0; i < length;) {
+    // Decode ASCII and 2 byte UTF-8 sequences of Latin-1 code points.
+    auto c = static_cast<uint8_t>(text[i]);
+    uint32_t code_point = c;
+    size_t bytes = 1;
+    if (c >= 0x80) {
+      if ((c != 0xc2 && c != 0xc3) || i + 1 >= length ||
+          (static_cast<uint8_t>(text[i + 1]) & 0xc0) != 0x80) {
+        return false;
+      }
+      code_point = (c & 0x1f) << 6 | (static_cast<uint8_t>(text[i + 1]) & 0x3f);
+      bytes = 2;
+    }
+    auto glyph_index = face->simple_glyphs_[code_point];
+    if (!glyph_index || (i && !IsSimplePair(previous, code_point))) {
+      return false;
+    }
+
+    ShapedGlyph glyph;
+    glyph.glyph_index = glyph_index;
+    glyph.cluster = static_cast<uint32_t>(i);
+    glyph.x_advance = GetSimpleAdvance(code_point);
+    glyph.y_advance = 0;
+    shaped_glyphs_.push_back(glyph);
+    *width += glyph.x_advance;
+    previous = code_point;
+    i += bytes;
+  }
+  return true;
+}
+
+bool FontManager::MatchesShapedText(const char *text, const size_t length) {
+  ShapeText(text, length);
   uint32_t glyph_count;
-  hb_glyph_position_t *glyph_pos =
-      hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+  auto glyph_info = hb_buffer_get_glyph_infos(harfbuzz_buf_, &glyph_count);
+  auto glyph_pos = hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+  auto identical = glyph_count == shaped_glyphs_.size();
+  for (uint32_t i = 0; identical && i < glyph_count; ++i) {
+    auto &glyph = shaped_glyphs_[i];
+    identical = glyph.glyph_index == glyph_info[i].codepoint &&
+                glyph.cluster == glyph_info[i].cluster &&
+                glyph.x_advance == glyph_pos[i].x_advance &&
+                glyph.y_advance == glyph_pos[i].y_advance &&
+                !glyph_pos[i].x_offset && !glyph_pos[i].y_offset;
+  }
+  hb_buffer_clear_contents(harfbuzz_buf_);
+  return identical;
+}
 
-  // Retrieve a width of the string.
-  uint32_t string_width = 0;
-  for (uint32_t i = 0; i < glyph_count; ++i) {
-    string_width += glyph_pos[i].x_advance;
+int32_t FontManager::GetSimpleAdvance(const uint32_t code_point) {
+  auto face = current_face_;
+  auto &size = face->sizes_.back();
+  if (size.simple_advances.empty()) {
+    size.simple_advances.assign(kSimpleCodePoints, kSimpleAdvanceUnknown);
+  }
+  auto &advance = size.simple_advances[code_point];
+  if (advance == kSimpleAdvanceUnknown) {
+    advance = hb_font_get_glyph_h_advance(face->harfbuzz_font_,
+                                          face->simple_glyphs_[code_point]);
   }
-  return string_width;
+  return advance;
 }
 
-bool FontManager::UpdateMetrics(const FT_GlyphSlot g,
+bool FontManager::IsSimplePair(const uint32_t first, const uint32_t second) {
+  auto face = current_face_;
+  if (!face->simple_paired_glyphs_[first] &&
+      !face->simple_paired_glyphs_[second]) {
+    return true;
+  }
+
+  auto &size = face->sizes_.back();
+  if (size.simple_pairs.empty() || size.simple_pairs_script != script_ ||
+      size.simple_pairs_language != harfbuzz_language_) {
+    size.simple_pairs.assign(kSimpleCodePoints * kSimpleCodePoints / 4,
+                             kSimplePairUnknown);
+    size.simple_pairs_script = script_;
+    size.simple_pairs_language = harfbuzz_language_;
+  }
+  auto index = first * kSimpleCodePoints + second;
+  auto shift = (index & 3) * 2;
+  auto &states = size.simple_pairs[index >> 2];
+  auto state = (states >> shift) & 3;
+  if (state != kSimplePairUnknown) {
+    return state == kSimplePairPlain;
+  }
+
+  // Shape the pair and compare it with the glyphs laid out alone.
+  char pair[4];
+  size_t length = 0;
+  for (auto code_point : {first, second}) {
+    if (code_point < 0x80) {
+      pair[length++] = static_cast<char>(code_point);
+    } else {
+      pair[length++] = static_cast<char>(0xc0 | code_point >> 6);
+      pair[length++] = static_cast<char>(0x80 | (code_point & 0x3f));
+    }
+  }
+  ShapeText(pair, length);
+  uint32_t glyph_count;
+  auto glyph_info = hb_buffer_get_glyph_infos(harfbuzz_buf_, &glyph_count);
+  auto glyph_pos = hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+  auto plain = glyph_count == 2;
+  const uint32_t code_points[] = {first, second};
+  for (uint32_t i = 0; plain && i < glyph_count; ++i) {
+    plain = glyph_info[i].codepoint == face->simple_glyphs_[code_points[i]] &&
+            glyph_pos[i].x_advance == GetSimpleAdvance(code_points[i]) &&
+            !glyph_pos[i].y_advance && !glyph_pos[i].x_offset &&
+            !glyph_pos[i].y_offset;
+  }
+  hb_buffer_clear_contents(harfbuzz_buf_);
+
+  state = plain ? kSimplePairPlain : kSimplePairAdjusted;
+  states |= static_cast<uint8_t>(state << shift);
+  return plain;
+}
+
+bool FontManager::UpdateMetrics(const int32_t top, const int32_t rows,
                                 const FontMetrics &current_metrics,
                                 FontMetrics *new_metrics) {
   // Calculate internal/external leading value and expand a buffer if
   // necessary.
-  if (g->bitmap_top > current_metrics.ascender() ||
-      static_cast<int32_t>(g->bitmap_top - g->bitmap.rows) <
-          current_metrics.descender()) {
+  if (top > current_metrics.ascender() ||
+      top - rows < current_metrics.descender()) {
     *new_metrics = current_metrics;
     new_metrics->set_internal_leading(
         std::max(current_metrics.internal_leading(),
-                 g->bitmap_top - current_metrics.ascender()));
+                 top - current_metrics.ascender()));
     new_metrics->set_external_leading(
         std::min(current_metrics.external_leading(),
-                 static_cast<int32_t>(g->bitmap_top - g->bitmap.rows -
-                                      current_metrics.descender())));
+                 top - rows - current_metrics.descender()));
     new_metrics->set_base_line(new_metrics->internal_leading() +
                                new_metrics->ascender());
 
@@ -884,7 +1689,9 @@ void FontManager::SetLocale(const char *locale) {
     SetLayoutDirection(layout_info->direction);
     SetScript(layout_info->script);
   }
+  harfbuzz_language_ = hb_language_from_string(locale, -1);
   locale_ = locale;
+  locale_id_ = HashId(locale);
 }
 
 void FontManager::SetScript(const char *script) {
@@ -908,12 +1715,18 @@ const GlyphCacheEntry *FontManager::GetCachedEntry(const uint32_t code_point,
                                                    const int32_t ysize) {
   GlyphKey key(current_face_->font_id_, code_point, ysize);
   auto cache = glyph_cache_->Find(key);
+  if (record_glyph_usage_ && glyph_usage_map_.Insert(key, true).second) {
+    glyph_usage_.push_back(key);
+  }
 
   if (cache == nullptr) {
     // Load glyph using harfbuzz layout information.
     // Note that harfbuzz takes care of ligatures.
-    FT_Error err =
-        FT_Load_Glyph(current_face_->face_, code_point, FT_LOAD_RENDER);
+    // Outlines are rendered straight into the glyph cache, distance fields
+    // are generated from FreeType's bitmap.
+    FT_Error err = FT_Load_Glyph(current_face_->face_, code_point,
+                                 sdf_ ? FT_LOAD_RENDER : FT_LOAD_DEFAULT);
+    counters_.rasterizations++;
     if (err) {
       // Error. This could happen typically the loaded font does not support
       // particular glyph.
@@ -925,11 +1738,63 @@ const GlyphCacheEntry *FontManager::GetCachedEntry(const uint32_t code_point,
     FT_GlyphSlot g = current_face_->face_->glyph;
     GlyphCacheEntry entry;
     entry.set_code_point(code_point);
-    entry.set_size(vec2i(g->bitmap.width, g->bitmap.rows));
-    entry.set_offset(vec2i(g->bitmap_left, g->bitmap_top));
+    GlyphKey new_key(current_face_->font_id_, code_point, ysize);
+    vec2i size;
+    vec2i offset;
+    if (!sdf_ && GetGlyphOutlineBox(g, &size, &offset)) {
+      GlyphMetrics metrics;
+      GetGlyphSlotMetrics(g, &metrics);
+      SetGlyphMetrics(new_key, metrics);
+
+      // Reserve the area in the glyph cache and render the glyph there.
+      entry.set_size(size);
+      entry.set_offset(offset);
+      cache = glyph_cache_->Set(nullptr, new_key, entry);
+      if (cache == nullptr) {
+        // Glyph cache need to be flushed.
+        // Returning nullptr here for a retry.
+        LogInfo("Glyph cache is full. Need to flush and re-create.\n");
+        return nullptr;
+      }
+      if (RenderGlyphOutline(*ft_, g, size, offset,
+                             glyph_cache_->GetImage(cache),
+                             glyph_cache_->get_size().x())) {
+        return cache;
+      }
+
+      // Don't keep the blank area cached, render FreeType's bitmap instead.
+      LogInfo("Can't render glyph %c in place\n", code_point);
+      glyph_cache_->Remove(new_key);
+    }
+    if (g->format != FT_GLYPH_FORMAT_BITMAP) {
+      err = FT_Render_Glyph(g, FT_RENDER_MODE_NORMAL);
+      if (err) {
+        LogInfo("Can't render glyph %c FT_Error:%d\n", code_point, err);
+        return nullptr;
+      }
+    }
+    GlyphMetrics metrics;
+    GetGlyphSlotMetrics(g, &metrics);
+    SetGlyphMetrics(new_key, metrics);
+
+    const uint8_t *image = g->bitmap.buffer;
+    auto stride = g->bitmap.pitch;
+    if (sdf_ && g->bitmap.width && g->bitmap.rows) {
+      // Store the distance field of the glyph, padded by the spread.
+      image = sdf_generator_.Generate(
+          g->bitmap.buffer, g->bitmap.width, g->bitmap.rows, g->bitmap.pitch,
+          kSDFSpread);
+      stride = 0;
+      entry.set_size(vec2i(g->bitmap.width + kSDFSpread * 2,
+                           g->bitmap.rows + kSDFSpread * 2));
+      entry.set_offset(
+          vec2i(g->bitmap_left - kSDFSpread, g->bitmap_top + kSDFSpread));
+    } else {
+      entry.set_size(vec2i(g->bitmap.width, g->bitmap.rows));
+      entry.set_offset(vec2i(g->bitmap_left, g->bitmap_top));
+    }
 
-    GlyphKey new_key(current_face_->font_id_, entry.get_code_point(), ysize);
-    cache = glyph_cache_->Set(g->bitmap.buffer, new_key, entry);
+    cache = glyph_cache_->Set(image, new_key, entry, stride);
 
     if (cache == nullptr) {
       // Glyph cache need to be flushed.
@@ -941,6 +1806,74 @@ const GlyphCacheEntry *FontManager::GetCachedEntry(const uint32_t code_point,
   return cache;
 }
 
+void FontManager::RasterizeGlyphs(const char *text, const uint32_t length,
+                                  const int32_t ysize, const bool multi_line) {
+  // Collect missing glyphs of the paragraphs in the order of their first
+  // appearance. The paragraphs are shaped as the layout shapes them, so that
+  // the layout finds them in the shaping cache.
+  raster_requests_.clear();
+  raster_request_map_.Clear();
+  for (uint32_t start = 0, end = 0; start < length; start = end) {
+    end = GetParagraphEnd(start, length, multi_line);
+    auto run = LayoutText(text + start, end - start);
+    for (auto &glyph : run->get_glyphs()) {
+      auto code_point = glyph.glyph_index;
+      GlyphKey key(current_face_->font_id_, code_point, ysize);
+      if (!code_point || glyph_cache_->Contains(key) ||
+          !raster_request_map_.Insert(key, true).second) {
+        continue;
+      }
+      GlyphRasterRequest request;
+      request.font_id = current_face_->font_id_;
+      request.font_data = reinterpret_cast<const uint8_t *>(
+          current_face_->font_data_.c_str());
+      request.font_data_size = current_face_->font_data_.size();
+      request.glyph_index = code_point;
+      request.ysize = ysize;
+      raster_requests_.push_back(std::move(request));
+    }
+  }
+  if (raster_requests_.size() < static_cast<size_t>(kGlyphRasterizerMinBatch)) {
+    return;
+  }
+
+  rasterizer_->Rasterize(&raster_requests_, sdf_ ? kSDFSpread : 0);
+
+  // Commit the glyphs in the order of the text. When the cache is full, the
+  // rest is left to GetCachedEntry(), which starts a sub pass.
+  for (auto &request : raster_requests_) {
+    if (!request.succeeded) {
+      // The glyph is loaded again by GetCachedEntry() to report the error.
+      continue;
+    }
+    counters_.rasterizations++;
+    GlyphCacheEntry entry;
+    entry.set_code_point(request.glyph_index);
+    entry.set_size(request.size);
+    entry.set_offset(request.offset);
+    GlyphKey key(request.font_id, request.glyph_index, ysize);
+    SetGlyphMetrics(key, request.metrics);
+    if (glyph_cache_->Set(request.image.data(), key, entry) == nullptr) {
+      break;
+    }
+  }
+}
+
+void FontManager::SetRasterizerThreads(int32_t num_threads) {
+  if (rasterizer_ == nullptr) {
+    rasterizer_.reset(new GlyphRasterizer());
+  }
+  rasterizer_->SetNumThreads(num_threads);
+}
+
+void FontManager::SetFaceSize(FaceData *face, const int32_t ysize) {
+  if (face->SetSize(ysize)) {
+    counters_.face_resizes++;
+  } else {
+    counters_.face_resizes_avoided++;
+  }
+}
+
 int32_t FontManager::ConvertSize(const int32_t original_ysize) {
   if (size_selector_ != nullptr) {
     return size_selector_(original_ysize);
@@ -949,8 +1882,338 @@ int32_t FontManager::ConvertSize(const int32_t original_ysize) {
   }
 }
 
+int32_t FontManager::ConvertGlyphSize(const int32_t original_ysize) {
+  auto ysize = ConvertSize(original_ysize);
+  if (sdf_) {
+    // Use the reference size of the bucket the size belongs to.
+    ysize = std::min(RoundUpToPowerOf2(std::max(ysize, kSDFMinReferenceSize)),
+                     kSDFMaxReferenceSize);
+  }
+  return ysize;
+}
+
+void FontManager::EnableSDF(bool enable) {
+  if (sdf_ == enable) {
+    return;
+  }
+  sdf_ = enable;
+
+  // Cached glyphs and layouts are not compatible with the new mode.
+  glyph_cache_->Flush();
+  current_atlas_revision_ = glyph_cache_->get_revision();
+  FlushLayout();
+}
+
+void FontManager::SetGlyphCachePartitions(
+    const std::vector<GlyphCachePartition> &partitions) {
+  // The glyph cache is flushed, rows are not shared between partitions.
+  glyph_cache_->SetPartitions(partitions);
+  current_atlas_revision_ = glyph_cache_->get_revision();
+  FlushLayout();
+}
+
+bool FontManager::SaveGlyphCache(const char *file_name) {
+  GlyphCacheFileHeader header = {kGlyphCacheFileMagic, kGlyphCacheFileVersion,
+                                 sdf_ ? 1u : 0u,
+                                 static_cast<uint32_t>(map_faces_.size())};
+  std::vector<GlyphCacheFileFont> fonts;
+  for (auto &it : map_faces_) {
+    GlyphCacheFileFont font = {it.second->font_id_,
+                               GetFontContentHash(it.second.get())};
+    fonts.push_back(font);
+  }
+  std::vector<uint8_t> snapshot;
+  glyph_cache_->Save(&snapshot);
+
+  auto file = fopen(file_name, "wb");
+  if (file == nullptr) {
+    LogError("Can't open the glyph cache file: %s\n", file_name);
+    return false;
+  }
+  auto written =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(fonts.data(), sizeof(GlyphCacheFileFont), fonts.size(), file) ==
+          fonts.size() &&
+      fwrite(snapshot.data(), 1, snapshot.size(), file) == snapshot.size();
+  if (fclose(file) != 0 || !written) {
+    LogError("Failed to write the glyph cache file: %s\n", file_name);
+    return false;
+  }
+  return true;
+}
+
+bool FontManager::LoadGlyphCache(const char *file_name) {
+  auto file = fopen(file_name, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  auto size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  glyph_cache_file_.resize(size > 0 ? size : 0);
+  auto read = size > 0 && fread(glyph_cache_file_.data(), 1, size, file) ==
+                              static_cast<size_t>(size);
+  fclose(file);
+  if (!read) {
+    glyph_cache_file_.clear();
+    return false;
+  }
+  return RestoreGlyphCache();
+}
+
+bool FontManager::RestoreGlyphCache() {
+  auto data = glyph_cache_file_.data();
+  auto size = glyph_cache_file_.size();
+  GlyphCacheFileHeader header;
+  if (size < sizeof(header)) {
+    glyph_cache_file_.clear();
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != kGlyphCacheFileMagic ||
+      header.version != kGlyphCacheFileVersion ||
+      header.num_fonts > (size - sizeof(header)) / sizeof(GlyphCacheFileFont)) {
+    glyph_cache_file_.clear();
+    return false;
+  }
+  if (header.sdf != (sdf_ ? 1u : 0u)) {
+    // The glyph images are not compatible with current mode.
+    glyph_cache_file_.clear();
+    return true;
+  }
+
+  // Check which fonts are opened with the same contents.
+  enum FontState { kFontValid, kFontChanged, kFontNotOpened };
+  std::vector<std::pair<HashedId, FontState>> fonts;
+  for (uint32_t i = 0; i < header.num_fonts; ++i) {
+    GlyphCacheFileFont font;
+    memcpy(&font, data + sizeof(header) + sizeof(font) * i, sizeof(font));
+    auto state = kFontNotOpened;
+    for (auto &it : map_faces_) {
+      auto face = it.second.get();
+      if (face->font_id_ == font.font_id && face->face_ != nullptr) {
+        state = GetFontContentHash(face) == font.content_hash ? kFontValid
+                                                              : kFontChanged;
+        break;
+      }
+    }
+    fonts.push_back(std::make_pair(font.font_id, state));
+  }
+
+  auto pending = 0;
+  auto offset = sizeof(header) + sizeof(GlyphCacheFileFont) * header.num_fonts;
+  auto restored = glyph_cache_->Restore(
+      data + offset, size - offset, [&fonts, &pending](const GlyphKey &key) {
+        for (auto &font : fonts) {
+          if (font.first == key.get_font_id()) {
+            pending += font.second == kFontNotOpened;
+            return font.second == kFontValid;
+          }
+        }
+        return false;
+      });
+  if (restored < 0) {
+    glyph_cache_file_.clear();
+    return false;
+  }
+  if (!pending) {
+    glyph_cache_file_.clear();
+  }
+  return true;
+}
+
+uint32_t FontManager::GetFontContentHash(FaceData *face) {
+  if (face->content_hash_ == 0) {
+    // Hash 4 bytes at a time, then remaining bytes.
+    auto &data = face->font_data_;
+    auto hash = HashMix(static_cast<uint32_t>(data.size()));
+    size_t i = 0;
+    for (; i + sizeof(uint32_t) <= data.size(); i += sizeof(uint32_t)) {
+      uint32_t value;
+      memcpy(&value, &data[i], sizeof(value));
+      hash = HashCombine(hash, value);
+    }
+    for (; i < data.size(); ++i) {
+      hash = HashCombine(hash, static_cast<uint8_t>(data[i]));
+    }
+    face->content_hash_ = hash ? hash : 1;
+  }
+  return face->content_hash_;
+}
+
+FaceData *FontManager::FindFace(HashedId font_id) {
+  for (auto &it : map_faces_) {
+    if (it.second->font_id_ == font_id && it.second->face_ != nullptr) {
+      return it.second.get();
+    }
+  }
+  return nullptr;
+}
+
+bool FontManager::PrewarmText(const char *font_name, const char *text,
+                              float ysize) {
+  auto it = map_faces_.find(font_name);
+  if (it == map_faces_.end()) {
+    return false;
+  }
+  auto face = current_face_;
+  current_face_ = it->second.get();
+  auto converted_ysize = ConvertGlyphSize(static_cast<int32_t>(ysize));
+  SetFaceSize(current_face_, converted_ysize);
+  auto run = LayoutText(text, strlen(text));
+
+  for (auto &glyph : run->get_glyphs()) {
+    if (glyph.glyph_index) {
+      prewarm_queue_.push_back(GlyphKey(current_face_->font_id_,
+                                        glyph.glyph_index, converted_ysize));
+    }
+  }
+  current_face_ = face;
+  return true;
+}
+
+bool FontManager::PrewarmCodePoints(const char *font_name,
+                                    const uint32_t *code_points, size_t count,
+                                    float ysize) {
+  auto it = map_faces_.find(font_name);
+  if (it == map_faces_.end()) {
+    return false;
+  }
+  auto face = it->second.get();
+  auto converted_ysize = ConvertGlyphSize(static_cast<int32_t>(ysize));
+  for (size_t i = 0; i < count; ++i) {
+    auto glyph_index = FT_Get_Char_Index(face->face_, code_points[i]);
+    if (glyph_index) {
+      prewarm_queue_.push_back(
+          GlyphKey(face->font_id_, glyph_index, converted_ysize));
+    }
+  }
+  return true;
+}
+
+size_t FontManager::Prewarm(float milliseconds) {
+  auto start = std::chrono::steady_clock::now();
+  auto budget = std::chrono::duration<float, std::milli>(milliseconds);
+  auto face = current_face_;
+
+  // Prewarmed glyphs are not used by layouts.
+  auto record_glyph_usage = record_glyph_usage_;
+  record_glyph_usage_ = false;
+  while (prewarm_index_ < prewarm_queue_.size() &&
+         std::chrono::steady_clock::now() - start < budget) {
+    auto &key = prewarm_queue_[prewarm_index_];
+    auto prewarm_face = FindFace(key.get_font_id());
+    if (prewarm_face == nullptr) {
+      // The font is not opened.
+      prewarm_index_++;
+      continue;
+    }
+    current_face_ = prewarm_face;
+    SetFaceSize(prewarm_face, static_cast<int32_t>(key.get_glyph_size()));
+    auto set_fails = glyph_cache_->get_stats().set_fails;
+    if (GetCachedEntry(key.get_code_point(),
+                       static_cast<int32_t>(key.get_glyph_size())) == nullptr &&
+        glyph_cache_->get_stats().set_fails != set_fails) {
+      // The glyph cache is full, resume in the next call.
+      break;
+    }
+    prewarm_index_++;
+  }
+  current_face_ = face;
+  record_glyph_usage_ = record_glyph_usage;
+  if (prewarm_index_ == prewarm_queue_.size()) {
+    prewarm_queue_.clear();
+    prewarm_index_ = 0;
+  }
+  return prewarm_queue_.size() - prewarm_index_;
+}
+
+void FontManager::ClearGlyphUsageProfile() {
+  glyph_usage_.clear();
+  glyph_usage_map_.Clear();
+}
+
+bool FontManager::SaveGlyphUsageProfile(const char *file_name) {
+  GlyphUsageProfileHeader header = {kGlyphUsageProfileMagic,
+                                    kGlyphUsageProfileVersion,
+                                    static_cast<uint32_t>(glyph_usage_.size())};
+  std::vector<GlyphUsageProfileGlyph> glyphs;
+  glyphs.reserve(glyph_usage_.size());
+  for (auto &key : glyph_usage_) {
+    GlyphUsageProfileGlyph glyph = {key.get_font_id(), key.get_code_point(),
+                                    key.get_glyph_size()};
+    glyphs.push_back(glyph);
+  }
+
+  auto file = fopen(file_name, "wb");
+  if (file == nullptr) {
+    LogError("Can't open the glyph usage profile: %s\n", file_name);
+    return false;
+  }
+  auto written =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(glyphs.data(), sizeof(GlyphUsageProfileGlyph), glyphs.size(),
+             file) == glyphs.size();
+  if (fclose(file) != 0 || !written) {
+    LogError("Failed to write the glyph usage profile: %s\n", file_name);
+    return false;
+  }
+  return true;
+}
+
+bool FontManager::LoadGlyphUsageProfile(const char *file_name) {
+  auto file = fopen(file_name, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  GlyphUsageProfileHeader header;
+  auto valid = fread(&header, sizeof(header), 1, file) == 1 &&
+               header.magic == kGlyphUsageProfileMagic &&
+               header.version == kGlyphUsageProfileVersion;
+  std::vector<GlyphUsageProfileGlyph> glyphs;
+  if (valid) {
+    fseek(file, 0, SEEK_END);
+    auto size = ftell(file);
+    valid = size >= 0 &&
+            header.num_glyphs <= (static_cast<size_t>(size) - sizeof(header)) /
+                                     sizeof(GlyphUsageProfileGlyph);
+  }
+  if (valid) {
+    fseek(file, sizeof(header), SEEK_SET);
+    glyphs.resize(header.num_glyphs);
+    valid = fread(glyphs.data(), sizeof(GlyphUsageProfileGlyph), glyphs.size(),
+                  file) == glyphs.size();
+  }
+  fclose(file);
+  if (!valid) {
+    return false;
+  }
+  for (auto &glyph : glyphs) {
+    prewarm_queue_.push_back(
+        GlyphKey(glyph.font_id, glyph.glyph_index, glyph.glyph_size));
+  }
+  return true;
+}
+
+float FontManager::GetSDFSmoothing(float ysize) {
+  // The distance field changes by 0.5 / kSDFSpread per texel and a texel
+  // covers |scale| pixels on the screen. Smooth the edge over a pixel.
+  auto scale =
+      ysize / static_cast<float>(ConvertGlyphSize(static_cast<int32_t>(ysize)));
+  return 0.25f / (static_cast<float>(kSDFSpread) * scale);
+}
+
 void FontBuffer::AddVertices(const vec2 &pos, const int32_t base_line,
                              const float scale, const GlyphCacheEntry &entry) {
+  auto index = static_cast<int32_t>(vertices_.size()) / kVerticesPerCodePoint;
+  vertices_.resize(vertices_.size() + kVerticesPerCodePoint,
+                   FontVertex(0.0f, 0.0f, 0.0f, 0.0f, 0.0f));
+  SetVertices(index, pos, base_line, scale, entry);
+}
+
+void FontBuffer::SetVertices(const int32_t index, const vec2 &pos,
+                             const int32_t base_line, const float scale,
+                             const GlyphCacheEntry &entry) {
   mathfu::vec2i rounded_pos = mathfu::vec2i(pos);
   auto scaled_offset = mathfu::vec2(entry.get_offset()) * scale;
   auto scaled_size = mathfu::vec2(entry.get_size()) * scale;
@@ -958,14 +2221,15 @@ void FontBuffer::AddVertices(const vec2 &pos, const int32_t base_line,
 
   auto x = rounded_pos.x() + scaled_offset.x();
   auto y = rounded_pos.y() + scaled_base_line - scaled_offset.y();
-  vertices_.push_back(FontVertex(x, y, 0.0f, 0.0f, 0.0f));
+  auto vertices = &vertices_[index * kVerticesPerCodePoint];
+  vertices[0] = FontVertex(x, y, 0.0f, 0.0f, 0.0f);
 
-  vertices_.push_back(FontVertex(x, y + scaled_size.y(), 0.0f, 0.0f, 0.0f));
+  vertices[1] = FontVertex(x, y + scaled_size.y(), 0.0f, 0.0f, 0.0f);
 
-  vertices_.push_back(FontVertex(x + scaled_size.x(), y, 0.0f, 0.0f, 0.0f));
+  vertices[2] = FontVertex(x + scaled_size.x(), y, 0.0f, 0.0f, 0.0f);
 
-  vertices_.push_back(
-      FontVertex(x + scaled_size.x(), y + scaled_size.y(), 0.0f, 0.0f, 0.0f));
+  vertices[3] =
+      FontVertex(x + scaled_size.x(), y + scaled_size.y(), 0.0f, 0.0f, 0.0f);
 }
 
 void FontBuffer::UpdateUV(const int32_t index, const vec4 &uv) {
@@ -975,6 +2239,51 @@ void FontBuffer::UpdateUV(const int32_t index, const vec4 &uv) {
   vertices_[index * 4 + 3].uv_ = uv.zw();
 }
 
+bool FontBuffer::SetGlyphPage(const int32_t index, const int32_t page) {
+  if (index >= static_cast<int32_t>(glyph_pages_.size())) {
+    glyph_pages_.resize(index + 1, page);
+    return true;
+  }
+  if (glyph_pages_[index] == page) {
+    return false;
+  }
+  glyph_pages_[index] = page;
+  return true;
+}
+
+void FontBuffer::UpdateIndices() {
+  for (auto &indices : indices_) {
+    indices.clear();
+  }
+  const uint16_t kIndices[] = {0, 1, 2, 1, 3, 2};
+  for (size_t i = 0; i < glyph_pages_.size(); ++i) {
+    auto indices = get_indices(glyph_pages_[i]);
+    for (size_t j = 0; j < FPL_ARRAYSIZE(kIndices); ++j) {
+      indices->push_back(static_cast<uint16_t>(kIndices[j] + i * 4));
+    }
+  }
+}
+
+void FontBuffer::Clear(uint32_t size, bool caret_info) {
+  for (auto &indices : indices_) {
+    indices.clear();
+  }
+  vertices_.clear();
+  code_points_.clear();
+  glyph_pages_.clear();
+  caret_positions_.clear();
+  vertices_.reserve(size * kVerticesPerCodePoint);
+  code_points_.reserve(size);
+  glyph_pages_.reserve(size);
+  if (caret_info) {
+    caret_positions_.reserve(size + 1);
+  } else if (caret_positions_.capacity()) {
+    // A buffer without caret positions has no caret array allocated, see
+    // HasCaretPositions().
+    std::vector<mathfu::vec2i>().swap(caret_positions_);
+  }
+}
+
 void FontBuffer::AddCaretPosition(const vec2 &pos) {
   mathfu::vec2i rounded_pos = mathfu::vec2i(pos);
   AddCaretPosition(rounded_pos.x(), rounded_pos.y());
@@ -989,6 +2298,178 @@ void FaceData::Close() {
   hb_font_destroy(harfbuzz_font_);
   FT_Done_Face(face_);
   font_data_.clear();
+  content_hash_ = 0;
+  sizes_.clear();
+  simple_glyphs_.clear();
+  simple_paired_glyphs_.clear();
+  ysize_ = 0;
+}
+
+bool FaceData::SetSize(int32_t ysize) {
+  ysize_ = ysize;
+  if (!sizes_.empty() && sizes_.back().ysize == ysize) {
+    return false;
+  }
+
+  // Activate a scaled size.
+  for (auto it = sizes_.begin(); it != sizes_.end(); ++it) {
+    if (it->ysize == ysize) {
+      auto size = std::move(*it);
+      sizes_.erase(it);
+      sizes_.push_back(std::move(size));
+      auto &active = sizes_.back();
+      FT_Activate_Size(active.size);
+      hb_font_set_scale(harfbuzz_font_, active.harfbuzz_x_scale,
+                        active.harfbuzz_y_scale);
+      hb_font_set_ppem(harfbuzz_font_, ysize, ysize);
+      return false;
+    }
+  }
+
+  // Scale a new size object, or the least recently used one when the cache
+  // is full.
+  ScaledSize size;
+  size.ysize = ysize;
+  if (sizes_.size() >= kFaceSizeCacheCapacity ||
+      FT_New_Size(face_, &size.size) != FT_Err_Ok) {
+    if (sizes_.empty()) {
+      // Failed to allocate a size object, scale the active size.
+      FT_Set_Pixel_Sizes(face_, 0, ysize);
+      return true;
+    }
+    size.size = sizes_.front().size;
+    sizes_.erase(sizes_.begin());
+  }
+  FT_Activate_Size(size.size);
+  FT_Set_Pixel_Sizes(face_, 0, ysize);
+
+  // Same scale as hb_ft_font_create() sets.
+  auto &metrics = face_->size->metrics;
+  size.harfbuzz_x_scale = static_cast<int32_t>(
+      (static_cast<uint64_t>(metrics.x_scale) * face_->units_per_EM +
+       (1u << 15)) >> 16);
+  size.harfbuzz_y_scale = static_cast<int32_t>(
+      (static_cast<uint64_t>(metrics.y_scale) * face_->units_per_EM +
+       (1u << 15)) >> 16);
+  sizes_.push_back(size);
+  hb_font_set_scale(harfbuzz_font_, size.harfbuzz_x_scale,
+                    size.harfbuzz_y_scale);
+  hb_font_set_ppem(harfbuzz_font_, ysize, ysize);
+  return true;
+}
+
+// Check if a face has an OpenType table.
+static bool HasOpenTypeTable(hb_face_t *face, const hb_tag_t tag) {
+  auto blob = hb_face_reference_table(face, tag);
+  auto length = hb_blob_get_length(blob);
+  hb_blob_destroy(blob);
+  return length != 0;
+}
+
+// Read a big-endian 16 bit value of an OpenType table, 0 past the end.
+static uint32_t ReadOpenTypeUint16(const uint8_t *data, const size_t size,
+                                   const size_t offset) {
+  if (offset + 2 > size) {
+    return 0;
+  }
+  return static_cast<uint32_t>(data[offset]) << 8 | data[offset + 1];
+}
+
+// Retrieve the type of a GPOS lookup, resolving extension lookups.
+// Returns 0 if the table is malformed.
+static uint32_t GetGposLookupType(const uint8_t *data, const size_t size,
+                                  const uint32_t lookup_index) {
+  auto lookup_list = ReadOpenTypeUint16(data, size, 8);
+  if (!lookup_list ||
+      lookup_index >= ReadOpenTypeUint16(data, size, lookup_list)) {
+    return 0;
+  }
+  size_t lookup = lookup_list + ReadOpenTypeUint16(data, size, lookup_list +
+                                                   2 + lookup_index * 2);
+  auto type = ReadOpenTypeUint16(data, size, lookup);
+  if (type == kGposExtensionLookup) {
+    // All subtables of an extension lookup have the same type.
+    if (!ReadOpenTypeUint16(data, size, lookup + 4)) {
+      return 0;
+    }
+    auto subtable = lookup + ReadOpenTypeUint16(data, size, lookup + 6);
+    type = ReadOpenTypeUint16(data, size, subtable + 2);
+  }
+  return type;
+}
+
+void FaceData::BuildSimpleLayout() {
+  simple_glyphs_.clear();
+  simple_paired_glyphs_.clear();
+  auto face = hb_font_get_face(harfbuzz_font_);
+  for (auto tag : kAatLayoutTables) {
+    if (HasOpenTypeTable(face, tag)) {
+      return;
+    }
+  }
+
+  // Collect glyphs substituted or positioned by default features. Glyphs of
+  // lookups that only adjust glyphs next to each other are checked per pair,
+  // other glyphs need harfbuzz.
+  auto lookups = hb_set_create();
+  auto excluded = hb_set_create();
+  auto paired = hb_set_create();
+  hb_ot_layout_collect_lookups(face, HB_OT_TAG_GSUB, nullptr, nullptr,
+                               kDefaultFeatures, lookups);
+  for (hb_codepoint_t lookup = HB_SET_VALUE_INVALID;
+       hb_set_next(lookups, &lookup);) {
+    hb_ot_layout_lookup_collect_glyphs(face, HB_OT_TAG_GSUB, lookup, excluded,
+                                       excluded, excluded, excluded);
+  }
+  hb_set_clear(lookups);
+  hb_ot_layout_collect_lookups(face, HB_OT_TAG_GPOS, nullptr, nullptr,
+                               kDefaultFeatures, lookups);
+  auto gpos = hb_face_reference_table(face, HB_OT_TAG_GPOS);
+  unsigned int gpos_size;
+  auto gpos_data =
+      reinterpret_cast<const uint8_t *>(hb_blob_get_data(gpos, &gpos_size));
+  for (hb_codepoint_t lookup = HB_SET_VALUE_INVALID;
+       hb_set_next(lookups, &lookup);) {
+    auto type = GetGposLookupType(gpos_data, gpos_size, lookup);
+    auto glyphs = type == kGposPairLookup || (type >= kGposMarkToBaseLookup &&
+                                              type <= kGposMarkToMarkLookup)
+                      ? paired
+                      : excluded;
+    hb_ot_layout_lookup_collect_glyphs(face, HB_OT_TAG_GPOS, lookup, glyphs,
+                                       glyphs, glyphs, glyphs);
+  }
+  hb_blob_destroy(gpos);
+
+  // Harfbuzz applies the legacy kerning table when the font has no GPOS.
+  auto legacy_kerning = !hb_ot_layout_has_positioning(face) &&
+                        HasOpenTypeTable(face, HB_TAG('k', 'e', 'r', 'n'));
+
+  // Printable Latin-1 characters except the soft hyphen.
+  simple_glyphs_.assign(kSimpleCodePoints, 0);
+  simple_paired_glyphs_.assign(kSimpleCodePoints, legacy_kerning);
+  for (uint32_t code_point = 0x20; code_point < kSimpleCodePoints;
+       ++code_point) {
+    if ((code_point >= 0x7f && code_point < 0xa0) || code_point == 0xad) {
+      continue;
+    }
+    hb_codepoint_t glyph_index;
+    if (!hb_font_get_glyph(harfbuzz_font_, code_point, 0, &glyph_index) ||
+        !glyph_index || hb_set_has(excluded, glyph_index)) {
+      continue;
+    }
+    auto glyph_class = hb_ot_layout_get_glyph_class(face, glyph_index);
+    if (glyph_class != HB_OT_LAYOUT_GLYPH_CLASS_UNCLASSIFIED &&
+        glyph_class != HB_OT_LAYOUT_GLYPH_CLASS_BASE_GLYPH) {
+      continue;
+    }
+    simple_glyphs_[code_point] = glyph_index;
+    if (hb_set_has(paired, glyph_index)) {
+      simple_paired_glyphs_[code_point] = true;
+    }
+  }
+  hb_set_destroy(paired);
+  hb_set_destroy(excluded);
+  hb_set_destroy(lookups);
 }
 
 }  // namespace flatui
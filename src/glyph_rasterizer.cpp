@@ -0,0 +1,284 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+
+// Freetype2 header
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_OUTLINE_H
+
+#include "flatui/internal/glyph_rasterizer.h"
+
+namespace flatui {
+
+bool GetGlyphOutlineBox(FT_GlyphSlot glyph, mathfu::vec2i *size,
+                        mathfu::vec2i *offset) {
+  if (glyph->format != FT_GLYPH_FORMAT_OUTLINE) {
+    return false;
+  }
+  // Round the control box to pixels as FreeType's renderer does.
+  FT_BBox box;
+  FT_Outline_Get_CBox(&glyph->outline, &box);
+  auto x_min = static_cast<int32_t>(box.xMin & ~63);
+  auto y_min = static_cast<int32_t>(box.yMin & ~63);
+  auto x_max = static_cast<int32_t>((box.xMax + 63) & ~63);
+  auto y_max = static_cast<int32_t>((box.yMax + 63) & ~63);
+  *size = mathfu::vec2i((x_max - x_min) >> 6, (y_max - y_min) >> 6);
+  *offset = mathfu::vec2i(x_min >> 6, y_max >> 6);
+  return true;
+}
+
+void GetGlyphSlotMetrics(FT_GlyphSlot glyph, GlyphMetrics *metrics) {
+  mathfu::vec2i size;
+  mathfu::vec2i offset;
+  if (!GetGlyphOutlineBox(glyph, &size, &offset)) {
+    size = mathfu::vec2i(glyph->bitmap.width, glyph->bitmap.rows);
+    offset = mathfu::vec2i(glyph->bitmap_left, glyph->bitmap_top);
+  }
+  metrics->left = offset.x();
+  metrics->top = offset.y();
+  metrics->width = size.x();
+  metrics->rows = size.y();
+  metrics->advance = static_cast<int32_t>(glyph->advance.x);
+}
+
+bool RenderGlyphOutline(FT_Library library, FT_GlyphSlot glyph,
+                        const mathfu::vec2i &size,
+                        const mathfu::vec2i &offset, uint8_t *image,
+                        const int32_t pitch) {
+  if (!size.x() || !size.y()) {
+    return true;
+  }
+  FT_Bitmap bitmap;
+  memset(&bitmap, 0, sizeof(bitmap));
+  bitmap.rows = size.y();
+  bitmap.width = size.x();
+  bitmap.pitch = pitch;
+  bitmap.buffer = image;
+  bitmap.num_grays = 256;
+  bitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+
+  // Move the bottom left corner of the image to the origin while rendering.
+  auto x_shift = -offset.x() * 64;
+  auto y_shift = -(offset.y() - size.y()) * 64;
+  FT_Outline_Translate(&glyph->outline, x_shift, y_shift);
+  auto err = FT_Outline_Get_Bitmap(library, &glyph->outline, &bitmap);
+  FT_Outline_Translate(&glyph->outline, -x_shift, -y_shift);
+  return err == FT_Err_Ok;
+}
+
+GlyphRasterizer::GlyphRasterizer()
+    : requests_(nullptr),
+      sdf_spread_(0),
+      next_request_(0),
+      generation_(0),
+      busy_workers_(0),
+      quit_(false) {
+  // The worker of the calling thread.
+  workers_.push_back(std::unique_ptr<Worker>(new Worker));
+}
+
+GlyphRasterizer::~GlyphRasterizer() {
+  SetNumThreads(0);
+  ReleaseWorker(workers_[0].get());
+}
+
+void GlyphRasterizer::SetNumThreads(const int32_t num_threads) {
+  if (num_threads == get_num_threads()) {
+    return;
+  }
+
+  // Stop current threads.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  start_condition_.notify_all();
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    workers_[i]->thread.join();
+    ReleaseWorker(workers_[i].get());
+  }
+  workers_.resize(1);
+  quit_ = false;
+
+  // Start new threads.
+  for (int32_t i = 0; i < num_threads; ++i) {
+    workers_.push_back(std::unique_ptr<Worker>(new Worker));
+    auto worker = workers_.back().get();
+    worker->generation = generation_;
+    worker->thread = std::thread(&GlyphRasterizer::Run, this, worker);
+  }
+}
+
+void GlyphRasterizer::Rasterize(std::vector<GlyphRasterRequest> *requests,
+                                const int32_t sdf_spread) {
+  requests_ = requests;
+  sdf_spread_ = sdf_spread;
+  next_request_ = 0;
+  if (workers_.size() > 1 && requests->size() > 1) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      generation_++;
+      busy_workers_ = static_cast<int32_t>(workers_.size()) - 1;
+    }
+    start_condition_.notify_all();
+    Process(workers_[0].get());
+
+    // Wait for the threads so that the batch is complete and no worker
+    // touches the requests afterwards.
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_condition_.wait(lock, [this]() { return busy_workers_ == 0; });
+  } else {
+    Process(workers_[0].get());
+  }
+  requests_ = nullptr;
+}
+
+void GlyphRasterizer::RemoveFont(const HashedId font_id) {
+  // Workers are idle between batches.
+  for (auto &worker : workers_) {
+    auto &faces = worker->faces;
+    for (auto it = faces.begin(); it != faces.end(); ++it) {
+      if (it->first == font_id) {
+        FT_Done_Face(it->second.first);
+        faces.erase(it);
+        break;
+      }
+    }
+  }
+}
+
+void GlyphRasterizer::Run(Worker *worker) {
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_condition_.wait(lock, [this, worker]() {
+        return quit_ || generation_ != worker->generation;
+      });
+      if (quit_) {
+        return;
+      }
+      worker->generation = generation_;
+    }
+    Process(worker);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      busy_workers_--;
+    }
+    done_condition_.notify_one();
+  }
+}
+
+void GlyphRasterizer::Process(Worker *worker) {
+  for (;;) {
+    auto index = next_request_++;
+    if (index >= requests_->size()) {
+      break;
+    }
+    RasterizeGlyph(worker, &(*requests_)[index]);
+  }
+}
+
+void GlyphRasterizer::RasterizeGlyph(Worker *worker,
+                                     GlyphRasterRequest *request) {
+  request->succeeded = false;
+  if (worker->library == nullptr &&
+      FT_Init_FreeType(&worker->library) != FT_Err_Ok) {
+    worker->library = nullptr;
+    return;
+  }
+
+  // Find or create the face instance of the worker.
+  std::pair<FT_Face, int32_t> *face = nullptr;
+  for (auto &it : worker->faces) {
+    if (it.first == request->font_id) {
+      face = &it.second;
+      break;
+    }
+  }
+  if (face == nullptr) {
+    FT_Face ft_face;
+    if (FT_New_Memory_Face(worker->library, request->font_data,
+                           static_cast<FT_Long>(request->font_data_size), 0,
+                           &ft_face) != FT_Err_Ok) {
+      return;
+    }
+    worker->faces.push_back(
+        std::make_pair(request->font_id, std::make_pair(ft_face, 0)));
+    face = &worker->faces.back().second;
+  }
+  if (face->second != request->ysize) {
+    FT_Set_Pixel_Sizes(face->first, 0, request->ysize);
+    face->second = request->ysize;
+  }
+
+  // Outlines are rendered straight into the request image, distance fields
+  // are generated from FreeType's bitmap.
+  if (FT_Load_Glyph(face->first, request->glyph_index,
+                    sdf_spread_ ? FT_LOAD_RENDER : FT_LOAD_DEFAULT) !=
+      FT_Err_Ok) {
+    return;
+  }
+  auto g = face->first->glyph;
+  if (!sdf_spread_ &&
+      GetGlyphOutlineBox(g, &request->size, &request->offset)) {
+    request->image.assign(request->size.x() * request->size.y(), 0);
+    GetGlyphSlotMetrics(g, &request->metrics);
+    request->succeeded =
+        RenderGlyphOutline(worker->library, g, request->size, request->offset,
+                           request->image.data(), request->size.x());
+    return;
+  }
+  if (g->format != FT_GLYPH_FORMAT_BITMAP &&
+      FT_Render_Glyph(g, FT_RENDER_MODE_NORMAL) != FT_Err_Ok) {
+    return;
+  }
+  GetGlyphSlotMetrics(g, &request->metrics);
+  auto width = static_cast<int32_t>(g->bitmap.width);
+  auto height = static_cast<int32_t>(g->bitmap.rows);
+  if (sdf_spread_ && width && height) {
+    // Store the distance field of the glyph, padded by the spread.
+    auto field = worker->sdf_generator.Generate(
+        g->bitmap.buffer, width, height, g->bitmap.pitch, sdf_spread_);
+    request->size = mathfu::vec2i(width + sdf_spread_ * 2,
+                                  height + sdf_spread_ * 2);
+    request->offset = mathfu::vec2i(g->bitmap_left - sdf_spread_,
+                                    g->bitmap_top + sdf_spread_);
+    request->image.assign(field,
+                          field + request->size.x() * request->size.y());
+  } else {
+    request->size = mathfu::vec2i(width, height);
+    request->offset = mathfu::vec2i(g->bitmap_left, g->bitmap_top);
+    request->image.resize(width * height);
+    for (int32_t y = 0; y < height; ++y) {
+      memcpy(request->image.data() + y * width,
+             g->bitmap.buffer + y * g->bitmap.pitch, width);
+    }
+  }
+  request->succeeded = true;
+}
+
+void GlyphRasterizer::ReleaseWorker(Worker *worker) {
+  for (auto &it : worker->faces) {
+    FT_Done_Face(it.second.first);
+  }
+  worker->faces.clear();
+  if (worker->library != nullptr) {
+    FT_Done_FreeType(worker->library);
+    worker->library = nullptr;
+  }
+}
+
+}  // namespace flatui
@@ -0,0 +1,350 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Randomized checks of the internal containers against reference models:
+// - FlatHashMap against std::map, with a well mixed and a colliding hash.
+// - GuillotinePacker and SkylinePacker against an occupancy grid.
+// - LayoutCache against a list based LRU model.
+// Runs without a display, seeds are fixed so that failures reproduce.
+
+#include <cstdio>
+#include <iterator>
+#include <list>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "flatui/internal/flat_hash_map.h"
+#include "flatui/internal/glyph_cache_packer.h"
+#include "flatui/internal/layout_cache.h"
+
+using flatui::FlatHashMap;
+using flatui::FlatHashMapHandle;
+using flatui::GlyphCachePacker;
+using flatui::GuillotinePacker;
+using flatui::LayoutCache;
+using flatui::SkylinePacker;
+using flatui::kInvalidFlatHashMapHandle;
+using mathfu::vec2i;
+
+static int failures = 0;
+
+#define CHECK(condition)                                                 \
+  do {                                                                   \
+    if (!(condition)) {                                                  \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+              #condition);                                               \
+      failures++;                                                        \
+      return;                                                            \
+    }                                                                    \
+  } while (0)
+
+// Hashers of the test keys.
+struct MixedHash {
+  size_t operator()(const uint32_t key) const { return flatui::HashMix(key); }
+};
+
+// Puts all keys in 4 probe sequences, so that lookups and backward shift
+// deletion walk long clusters that wrap around the bucket array.
+struct CollidingHash {
+  size_t operator()(const uint32_t key) const {
+    return (key & 3) * 0x40000000u;
+  }
+};
+
+template <typename Hash>
+void TestFlatHashMap(uint32_t seed, uint32_t key_range) {
+  std::mt19937 random(seed);
+  FlatHashMap<uint32_t, uint32_t, Hash> map;
+  std::map<uint32_t, uint32_t> reference;
+  std::map<uint32_t, FlatHashMapHandle> handles;
+
+  for (int i = 0; i < 20000; ++i) {
+    auto key = random() % key_range;
+    auto op = random() % 16;
+    if (op < 7) {
+      auto value = static_cast<uint32_t>(random());
+      auto insert = map.Insert(key, value);
+      auto found = reference.find(key);
+      CHECK(insert.second == (found == reference.end()));
+      if (insert.second) {
+        reference[key] = value;
+        handles[key] = insert.first;
+      } else {
+        // An existing entry is not overwritten and keeps its handle.
+        CHECK(insert.first == handles[key]);
+        CHECK(map.get_value(insert.first) == found->second);
+      }
+    } else if (op < 12) {
+      auto erased = map.EraseKey(key);
+      CHECK(erased == (reference.erase(key) != 0));
+      handles.erase(key);
+    } else if (op < 14 && !handles.empty()) {
+      // Erase with a handle.
+      auto it = handles.begin();
+      std::advance(it, random() % handles.size());
+      map.Erase(it->second);
+      reference.erase(it->first);
+      handles.erase(it);
+    } else if (op == 14) {
+      auto handle = map.Find(key);
+      auto found = reference.find(key);
+      CHECK((handle != kInvalidFlatHashMapHandle) ==
+            (found != reference.end()));
+      if (handle != kInvalidFlatHashMapHandle) {
+        CHECK(handle == handles[key]);
+        CHECK(map.get_key(handle) == key);
+        found->second = static_cast<uint32_t>(random());
+        map.get_value(handle) = found->second;
+      }
+    } else if (random() % 64 == 0) {
+      map.Clear();
+      reference.clear();
+      handles.clear();
+    }
+    CHECK(map.size() == reference.size());
+  }
+
+  // Every entry is reachable with its key and its handle, and ForEach visits
+  // each entry once.
+  for (auto& entry : reference) {
+    auto handle = map.Find(entry.first);
+    CHECK(handle == handles[entry.first]);
+    CHECK(map.get_value(handle) == entry.second);
+  }
+  size_t visited = 0;
+  map.ForEach([&](FlatHashMapHandle handle, uint32_t key, uint32_t value) {
+    auto found = reference.find(key);
+    if (found != reference.end() && found->second == value &&
+        handles[key] == handle) {
+      visited++;
+    }
+  });
+  CHECK(visited == reference.size());
+}
+
+// Occupancy grid of an atlas.
+class Occupancy {
+ public:
+  explicit Occupancy(const vec2i& max_size)
+      : width_(max_size.x()), cells_(max_size.x() * max_size.y(), false) {}
+
+  // Returns false if the rectangle overlaps a reserved one.
+  bool Fill(const vec2i& pos, const vec2i& size, bool reserved) {
+    for (int32_t y = pos.y(); y < pos.y() + size.y(); ++y) {
+      for (int32_t x = pos.x(); x < pos.x() + size.x(); ++x) {
+        auto cell = cells_.begin() + y * width_ + x;
+        if (*cell == reserved) {
+          return false;
+        }
+        *cell = reserved;
+      }
+    }
+    return true;
+  }
+
+ private:
+  int32_t width_;
+  std::vector<bool> cells_;
+};
+
+struct Rect {
+  vec2i pos;
+  vec2i size;
+};
+
+void TestPacker(GlyphCachePacker* packer, uint32_t seed) {
+  std::mt19937 random(seed);
+  const vec2i kMaxSize(256, 256);
+  auto size = vec2i(64, 64);
+  packer->Reset(size);
+  Occupancy occupancy(kMaxSize);
+  std::vector<Rect> reserved;
+  int32_t used_area = 0;
+
+  for (int i = 0; i < 20000; ++i) {
+    auto op = random() % 16;
+    if (op < 9) {
+      Rect rect;
+      rect.size = vec2i(1 + random() % 24, 1 + random() % 24);
+      if (!packer->Reserve(rect.size, &rect.pos)) {
+        continue;
+      }
+      CHECK(rect.pos.x() >= 0 && rect.pos.y() >= 0 &&
+            rect.pos.x() + rect.size.x() <= size.x() &&
+            rect.pos.y() + rect.size.y() <= size.y());
+      CHECK(occupancy.Fill(rect.pos, rect.size, true));
+      reserved.push_back(rect);
+      used_area += rect.size.x() * rect.size.y();
+    } else if (op < 15 && !reserved.empty()) {
+      auto index = random() % reserved.size();
+      auto rect = reserved[index];
+      reserved[index] = reserved.back();
+      reserved.pop_back();
+      packer->Release(rect.pos, rect.size);
+      CHECK(occupancy.Fill(rect.pos, rect.size, false));
+      used_area -= rect.size.x() * rect.size.y();
+    } else if (op == 15 && random() % 32 == 0 && size.y() < kMaxSize.y()) {
+      size = random() % 2 && size.x() < kMaxSize.x()
+                 ? vec2i(size.x() * 2, size.y())
+                 : vec2i(size.x(), size.y() * 2);
+      packer->Grow(size);
+    }
+    auto free_area = packer->GetFreeArea();
+    CHECK(free_area == size.x() * size.y() - used_area);
+    CHECK(packer->GetLargestFreeArea() <= free_area);
+  }
+
+  // Releasing everything makes the whole atlas available again.
+  for (auto& rect : reserved) {
+    packer->Release(rect.pos, rect.size);
+  }
+  CHECK(packer->GetFreeArea() == size.x() * size.y());
+}
+
+// LRU model of LayoutCache.
+class LayoutCacheModel {
+ public:
+  LayoutCacheModel(size_t budget, uint32_t max_age)
+      : budget_(budget), max_age_(max_age), used_bytes_(0), frame_(0),
+        evictions_(0) {}
+
+  bool Find(uint32_t key) {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      return false;
+    }
+    it->second.frame = frame_;
+    lru_.remove(key);
+    lru_.push_back(key);
+    return true;
+  }
+  void Insert(uint32_t key, size_t bytes) {
+    entries_[key] = Entry{bytes, frame_};
+    lru_.push_back(key);
+    used_bytes_ += bytes;
+    Evict();
+  }
+  void Update() {
+    frame_++;
+    Evict();
+  }
+  void set_budget(size_t budget) {
+    budget_ = budget;
+    Evict();
+  }
+  bool Contains(uint32_t key, uint32_t* age) const {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      return false;
+    }
+    *age = frame_ - it->second.frame;
+    return true;
+  }
+  const std::list<uint32_t>& lru() const { return lru_; }
+  size_t used_bytes() const { return used_bytes_; }
+  uint64_t evictions() const { return evictions_; }
+
+ private:
+  struct Entry {
+    size_t bytes;
+    uint32_t frame;
+  };
+
+  void Evict() {
+    while (!lru_.empty()) {
+      auto& entry = entries_[lru_.front()];
+      auto expired = max_age_ && frame_ - entry.frame > max_age_;
+      if (entry.frame == frame_ || (!expired && used_bytes_ <= budget_)) {
+        break;
+      }
+      used_bytes_ -= entry.bytes;
+      entries_.erase(lru_.front());
+      lru_.pop_front();
+      evictions_++;
+    }
+  }
+
+  std::map<uint32_t, Entry> entries_;
+  std::list<uint32_t> lru_;
+  size_t budget_;
+  uint32_t max_age_;
+  size_t used_bytes_;
+  uint32_t frame_;
+  uint64_t evictions_;
+};
+
+void TestLayoutCache(uint32_t seed, uint32_t max_age) {
+  std::mt19937 random(seed);
+  LayoutCache<uint32_t, uint32_t, MixedHash> cache(4096, max_age);
+  LayoutCacheModel model(4096, max_age);
+
+  for (int i = 0; i < 20000; ++i) {
+    auto key = random() % 256;
+    auto op = random() % 16;
+    if (op < 8) {
+      auto value = cache.Find(key);
+      CHECK((value != nullptr) == model.Find(key));
+      CHECK(value == nullptr || *value == key);
+      if (value == nullptr) {
+        auto bytes = 16 + random() % 256;
+        auto inserted = cache.Insert(
+            key, std::unique_ptr<uint32_t>(new uint32_t(key)), bytes);
+        CHECK(*inserted == key);
+        model.Insert(key, bytes);
+      }
+    } else if (op < 14) {
+      // Peek() doesn't count a use.
+      uint32_t age = 0;
+      uint32_t model_age = 0;
+      auto value = cache.Peek(key, &age);
+      CHECK((value != nullptr) == model.Contains(key, &model_age));
+      CHECK(value == nullptr || (*value == key && age == model_age));
+    } else if (op == 14) {
+      cache.Update();
+      model.Update();
+    } else if (random() % 16 == 0) {
+      auto budget = 1024 + random() % 8192;
+      cache.set_budget(budget);
+      model.set_budget(budget);
+    }
+    CHECK(cache.size() == model.lru().size());
+    CHECK(cache.get_used_bytes() == model.used_bytes());
+    CHECK(cache.get_stats().evictions == model.evictions());
+  }
+  for (auto key : model.lru()) {
+    uint32_t age;
+    CHECK(cache.Peek(key, &age) != nullptr);
+  }
+}
+
+int main() {
+  for (uint32_t seed = 1; seed <= 8; ++seed) {
+    TestFlatHashMap<MixedHash>(seed, 1024);
+    TestFlatHashMap<MixedHash>(seed, 65536);
+    TestFlatHashMap<CollidingHash>(seed, 512);
+    GuillotinePacker guillotine;
+    TestPacker(&guillotine, seed);
+    SkylinePacker skyline;
+    TestPacker(&skyline, seed);
+    TestLayoutCache(seed, 0);
+    TestLayoutCache(seed, 8);
+  }
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
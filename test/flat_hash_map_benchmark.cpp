@@ -0,0 +1,125 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmark of FlatHashMap against std::unordered_map.
+// Measures insertion, look up hits and look up misses of uint32_t keys, and
+// counts heap allocations of the insertions.
+// Usage: flat_hash_map_benchmark [number of entries]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "flatui/internal/flat_hash_map.h"
+
+// Heap allocations made by the process.
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  if (void *p = malloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+
+struct MixedHash {
+  size_t operator()(const uint32_t key) const { return flatui::HashMix(key); }
+};
+
+// Adapters of the maps with the operations measured.
+struct FlatHashMapAdapter {
+  static const char *name() { return "FlatHashMap"; }
+  void Insert(uint32_t key, uint32_t value) { map.Insert(key, value); }
+  bool Find(uint32_t key) const {
+    return map.Find(key) != flatui::kInvalidFlatHashMapHandle;
+  }
+  flatui::FlatHashMap<uint32_t, uint32_t, MixedHash> map;
+};
+
+struct UnorderedMapAdapter {
+  static const char *name() { return "std::unordered_map"; }
+  void Insert(uint32_t key, uint32_t value) { map.emplace(key, value); }
+  bool Find(uint32_t key) const { return map.find(key) != map.end(); }
+  std::unordered_map<uint32_t, uint32_t, MixedHash> map;
+};
+
+// Returns nanoseconds per call of f over |keys|.
+template <typename F>
+double Measure(const std::vector<uint32_t> &keys, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (auto key : keys) {
+    f(key);
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / keys.size();
+}
+
+template <typename Map>
+void Run(const std::vector<uint32_t> &keys,
+         const std::vector<uint32_t> &missing_keys, int repeat) {
+  double insert = 0.0;
+  double hit = 0.0;
+  double miss = 0.0;
+  size_t insert_allocations = 0;
+  size_t found = 0;
+  for (int i = 0; i < repeat; ++i) {
+    Map map;
+    auto allocations_before = allocations;
+    insert += Measure(keys, [&](uint32_t key) { map.Insert(key, key); });
+    insert_allocations += allocations - allocations_before;
+    hit += Measure(keys, [&](uint32_t key) { found += map.Find(key); });
+    miss +=
+        Measure(missing_keys, [&](uint32_t key) { found += map.Find(key); });
+  }
+  if (found != keys.size() * repeat) {
+    fprintf(stderr, "%s: unexpected look up results\n", Map::name());
+    exit(1);
+  }
+  printf("%-20s insert %6.1f ns  hit %6.1f ns  miss %6.1f ns  allocs %zu\n",
+         Map::name(), insert / repeat, hit / repeat, miss / repeat,
+         insert_allocations / repeat);
+}
+
+int main(int argc, char **argv) {
+  size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+  if (!count) {
+    fprintf(stderr, "Usage: %s [number of entries]\n", argv[0]);
+    return 1;
+  }
+
+  // Keys are distinct, missing keys are not in the key set.
+  std::mt19937 random(1);
+  std::vector<uint32_t> keys(count);
+  std::vector<uint32_t> missing_keys(count);
+  for (size_t i = 0; i < count; ++i) {
+    keys[i] = static_cast<uint32_t>(i * 2);
+    missing_keys[i] = static_cast<uint32_t>(i * 2 + 1);
+  }
+  std::shuffle(keys.begin(), keys.end(), random);
+  std::shuffle(missing_keys.begin(), missing_keys.end(), random);
+
+  printf("%zu entries\n", count);
+  const int kRepeat = 10;
+  Run<FlatHashMapAdapter>(keys, missing_keys, kRepeat);
+  Run<UnorderedMapAdapter>(keys, missing_keys, kRepeat);
+  return 0;
+}
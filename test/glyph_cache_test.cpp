@@ -0,0 +1,329 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks of GlyphCache with every packing strategy.
+// Glyphs are stored with a pattern unique to the glyph. Every cached glyph is
+// read back through its page and UV, as the renderer samples it, after the
+// cache grows, adds pages, shrinks, evicts, compacts, flushes and restores a
+// snapshot. The cache revision must change whenever a UV fetched before
+// changes, callers rely on it to fetch UVs again.
+// Runs without a display.
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "flatui/internal/glyph_cache.h"
+
+using flatui::GlyphCache;
+using flatui::GlyphCacheEntry;
+using flatui::GlyphCachePacking;
+using flatui::GlyphCachePartition;
+using flatui::GlyphKey;
+using flatui::kGlyphCachePackingGuillotine;
+using flatui::kGlyphCachePackingRow;
+using flatui::kGlyphCachePackingSkyline;
+using flatui::kGlyphCacheShrinkCycles;
+using flatui::kNullHash;
+using mathfu::vec2i;
+using mathfu::vec4;
+
+static int failures = 0;
+
+#define CHECK(condition)                                                 \
+  do {                                                                   \
+    if (!(condition)) {                                                  \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+              #condition);                                               \
+      failures++;                                                        \
+      return;                                                            \
+    }                                                                    \
+  } while (0)
+
+typedef GlyphCache<uint8_t> TestCache;
+
+static const flatui::HashedId kFontId = 1;
+static const uint32_t kNumGlyphs = 400;
+
+// Size and pixels of the test glyph |c|.
+static vec2i GlyphSize(uint32_t c) {
+  return vec2i(3 + static_cast<int32_t>(c % 13),
+               3 + static_cast<int32_t>(c * 7 % 11));
+}
+static uint8_t Pixel(uint32_t c, int32_t x, int32_t y) {
+  return static_cast<uint8_t>(((c * 31 + x * 7 + y * 13) & 0x7f) | 0x80);
+}
+static GlyphKey Key(uint32_t c) { return GlyphKey(kFontId, c, 16); }
+
+static const GlyphCacheEntry* SetGlyph(TestCache* cache, uint32_t c) {
+  auto size = GlyphSize(c);
+  std::vector<uint8_t> image(size.x() * size.y());
+  for (int32_t y = 0; y < size.y(); ++y) {
+    for (int32_t x = 0; x < size.x(); ++x) {
+      image[x + y * size.x()] = Pixel(c, x, y);
+    }
+  }
+  GlyphCacheEntry entry;
+  entry.set_code_point(c);
+  entry.set_size(size);
+  return cache->Set(image.data(), Key(c), entry);
+}
+
+// Read a cached glyph back through its page and UV.
+static void CheckGlyph(TestCache* cache, uint32_t c) {
+  auto entry = cache->Find(Key(c));
+  CHECK(entry != nullptr);
+  auto size = GlyphSize(c);
+  CHECK(entry->get_size().x() == size.x() && entry->get_size().y() == size.y());
+  CHECK(entry->get_page() >= 0 && entry->get_page() < cache->get_num_pages());
+
+  auto cache_size = cache->get_size();
+  auto uv = entry->get_uv();
+  auto x0 = static_cast<int32_t>(std::lround(uv.x() * cache_size.x()));
+  auto y0 = static_cast<int32_t>(std::lround(uv.y() * cache_size.y()));
+  auto x1 = static_cast<int32_t>(std::lround(uv.z() * cache_size.x()));
+  auto y1 = static_cast<int32_t>(std::lround(uv.w() * cache_size.y()));
+  CHECK(x0 >= 0 && y0 >= 0 && x1 <= cache_size.x() && y1 <= cache_size.y());
+  CHECK(x1 - x0 == size.x() && y1 - y0 == size.y());
+
+  auto page = cache->get_buffer(entry->get_page());
+  for (int32_t y = 0; y < size.y(); ++y) {
+    for (int32_t x = 0; x < size.x(); ++x) {
+      CHECK(page[x0 + x + (y0 + y) * cache_size.x()] == Pixel(c, x, y));
+    }
+  }
+}
+
+// Check all cached glyphs. Returns the number of cached glyphs.
+static uint32_t CheckGlyphs(TestCache* cache) {
+  uint32_t cached = 0;
+  for (uint32_t c = 0; c < kNumGlyphs; ++c) {
+    if (cache->Contains(Key(c))) {
+      CheckGlyph(cache, c);
+      cached++;
+    }
+  }
+  return cached;
+}
+
+// UVs of cached glyphs and the revision they were fetched in.
+class UVTracker {
+ public:
+  UVTracker() : uvs_(kNumGlyphs), revision_(0) {}
+
+  // Fetching counts a use of the glyphs, |count| limits the glyphs fetched.
+  void Fetch(TestCache* cache, uint32_t count = kNumGlyphs) {
+    for (uint32_t c = 0; c < kNumGlyphs; ++c) {
+      auto entry = c < count && cache->Contains(Key(c)) ? cache->Find(Key(c))
+                                                        : nullptr;
+      uvs_[c] = entry != nullptr ? entry->get_uv() : vec4(-1.0f);
+    }
+    revision_ = cache->get_revision();
+  }
+
+  // Check that a UV fetched before is still valid, or the revision changed.
+  void Check(TestCache* cache) {
+    if (cache->get_revision() != revision_) {
+      return;
+    }
+    for (uint32_t c = 0; c < kNumGlyphs; ++c) {
+      if (uvs_[c].x() < 0.0f || !cache->Contains(Key(c))) {
+        continue;
+      }
+      auto uv = cache->Find(Key(c))->get_uv();
+      CHECK(uv.x() == uvs_[c].x() && uv.y() == uvs_[c].y() &&
+            uv.z() == uvs_[c].z() && uv.w() == uvs_[c].w());
+    }
+  }
+
+ private:
+  std::vector<vec4> uvs_;
+  uint32_t revision_;
+};
+
+// Fill a small cache in one cycle so that it grows up to the maximum size.
+void TestGrow(GlyphCachePacking packing) {
+  TestCache cache(vec2i(32, 32), packing);
+  cache.set_max_size(vec2i(256, 256));
+  UVTracker tracker;
+  uint32_t stored = 0;
+  for (uint32_t c = 0; c < kNumGlyphs; ++c) {
+    tracker.Fetch(&cache);
+    if (SetGlyph(&cache, c) != nullptr) {
+      stored++;
+    }
+    tracker.Check(&cache);
+    CHECK(CheckGlyphs(&cache) == stored);
+  }
+  CHECK(cache.get_stats().grows > 0);
+  CHECK(cache.get_size().x() > 32 && cache.get_size().y() > 32);
+}
+
+// Fill a cache that adds pages instead of growing.
+void TestPages(GlyphCachePacking packing) {
+  TestCache cache(vec2i(64, 64), packing, 4);
+  uint32_t stored = 0;
+  for (uint32_t c = 0; c < kNumGlyphs; ++c) {
+    if (SetGlyph(&cache, c) != nullptr) {
+      stored++;
+    }
+  }
+  CHECK(cache.get_num_pages() > 1);
+  CHECK(CheckGlyphs(&cache) == stored);
+}
+
+// Grow the cache, then use a few glyphs until it shrinks back. Pinned and
+// recently used glyphs are kept.
+void TestShrink(GlyphCachePacking packing) {
+  TestCache cache(vec2i(64, 64), packing);
+  cache.set_max_size(vec2i(256, 256));
+  for (uint32_t c = 0; c < kNumGlyphs; ++c) {
+    SetGlyph(&cache, c);
+  }
+  auto grown_size = cache.get_size();
+  CHECK(grown_size.x() > 64 || grown_size.y() > 64);
+  CHECK(cache.Pin(Key(kNumGlyphs - 1)));
+
+  UVTracker tracker;
+  for (int32_t i = 0; i < kGlyphCacheShrinkCycles * 4; ++i) {
+    tracker.Fetch(&cache, 8);
+    cache.Update();
+    tracker.Check(&cache);
+    for (uint32_t c = 0; c < 8; ++c) {
+      cache.Find(Key(c));
+    }
+  }
+  CHECK(cache.get_size().x() * cache.get_size().y() <
+        grown_size.x() * grown_size.y());
+  for (uint32_t c = 0; c < 8; ++c) {
+    CHECK(cache.Contains(Key(c)));
+  }
+  CHECK(cache.Contains(Key(kNumGlyphs - 1)));
+  CHECK(cache.get_num_pinned() == 1);
+  CheckGlyphs(&cache);
+}
+
+// Store glyphs over many cycles in a full cache, so that glyphs are evicted
+// and the cache is compacted.
+void TestEviction(GlyphCachePacking packing) {
+  TestCache cache(vec2i(128, 128), packing);
+  UVTracker tracker;
+  for (uint32_t cycle = 0; cycle < 64; ++cycle) {
+    tracker.Fetch(&cache);
+    cache.Update();
+    for (uint32_t i = 0; i < 40; ++i) {
+      SetGlyph(&cache, (cycle * 37 + i * 11) % kNumGlyphs);
+    }
+    tracker.Check(&cache);
+    tracker.Fetch(&cache);
+    while (cache.CompactStep()) {
+    }
+    tracker.Check(&cache);
+    CheckGlyphs(&cache);
+  }
+  CHECK(cache.get_stats().evictions > 0);
+}
+
+// Flush keeps pinned glyphs only, and leaves no stale dirty rects.
+void TestFlush(GlyphCachePacking packing) {
+  TestCache cache(vec2i(128, 128), packing);
+  for (uint32_t c = 0; c < 40; ++c) {
+    SetGlyph(&cache, c);
+  }
+  cache.Flush();
+  CHECK(!cache.get_dirty_state() && !cache.IsPageDirty(0));
+  CHECK(cache.get_dirty_rects(0).empty());
+
+  for (uint32_t c = 0; c < 40; ++c) {
+    SetGlyph(&cache, c);
+  }
+  CHECK(cache.Pin(Key(3)) && cache.Pin(Key(17)));
+  cache.set_dirty_state(false);
+  cache.Flush();
+  CHECK(CheckGlyphs(&cache) == 2);
+  CHECK(cache.Contains(Key(3)) && cache.Contains(Key(17)));
+  CHECK(cache.get_dirty_state() && cache.IsPageDirty(0));
+}
+
+// Glyphs are stored in and counted by their partitions. Test glyphs (size
+// 16) belong to the small glyph partition, large glyphs of another font to
+// the default partition.
+void TestPartitions(GlyphCachePacking packing) {
+  TestCache cache(vec2i(128, 128), packing);
+  std::vector<GlyphCachePartition> partitions;
+  partitions.push_back(GlyphCachePartition(kNullHash, 16, 0.5f));
+  cache.SetPartitions(partitions);
+  std::vector<uint8_t> large_image(12 * 12, 0x80);
+  GlyphCacheEntry large_entry;
+  large_entry.set_size(vec2i(12, 12));
+  for (uint32_t cycle = 0; cycle < 16; ++cycle) {
+    cache.Update();
+    for (uint32_t i = 0; i < 20; ++i) {
+      auto c = (cycle * 20 + i) % kNumGlyphs;
+      SetGlyph(&cache, c);
+      cache.Set(large_image.data(), GlyphKey(kFontId + 1, c, 48), large_entry);
+    }
+  }
+  uint32_t large = 0;
+  for (uint32_t c = 0; c < kNumGlyphs; ++c) {
+    large += cache.Contains(GlyphKey(kFontId + 1, c, 48));
+  }
+  auto small = CheckGlyphs(&cache);
+  CHECK(small > 0 && large > 0);
+  CHECK(cache.GetPartitionStats(1).num_glyphs == static_cast<int32_t>(small));
+  CHECK(cache.GetPartitionStats(0).num_glyphs == static_cast<int32_t>(large));
+}
+
+// Glyphs saved to a snapshot are restored with their images.
+void TestSaveRestore(GlyphCachePacking packing) {
+  TestCache cache(vec2i(128, 128), packing);
+  for (uint32_t c = 0; c < 60; ++c) {
+    SetGlyph(&cache, c);
+  }
+  auto cached = CheckGlyphs(&cache);
+  std::vector<uint8_t> snapshot;
+  cache.Save(&snapshot);
+
+  TestCache restored(vec2i(128, 128), packing);
+  auto count = restored.Restore(snapshot.data(), snapshot.size(),
+                                [](const GlyphKey&) { return true; });
+  CHECK(count == static_cast<int32_t>(cached));
+  CHECK(CheckGlyphs(&restored) == cached);
+
+  // A truncated snapshot is rejected.
+  TestCache rejected(vec2i(128, 128), packing);
+  CHECK(rejected.Restore(snapshot.data(), snapshot.size() - 1,
+                         [](const GlyphKey&) { return true; }) == -1);
+}
+
+int main() {
+  const GlyphCachePacking kPackings[] = {kGlyphCachePackingRow,
+                                         kGlyphCachePackingSkyline,
+                                         kGlyphCachePackingGuillotine};
+  for (auto packing : kPackings) {
+    TestGrow(packing);
+    TestPages(packing);
+    TestShrink(packing);
+    TestEviction(packing);
+    TestFlush(packing);
+    TestPartitions(packing);
+    TestSaveRestore(packing);
+  }
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,158 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Corpus check of the simple layout.
+// Lays out a corpus with FontManager::LayoutSimpleText() and compares every
+// run that takes the simple path with the harfbuzz layout of the run. Runs
+// harfbuzz must lay out (RTL, non-Latin scripts, the soft hyphen) have to be
+// rejected by the simple layout.
+// Usage: simple_layout_test [font files relative to test/assets]
+
+#include <cstring>
+#include "fplbase/utilities.h"
+#include "flatui/font_manager.h"
+
+namespace flatui {
+
+// Glyph sizes the corpus is laid out at.
+static const int32_t kTestSizes[] = {12, 16, 32, 48};
+
+// Runs that must match harfbuzz whenever the simple layout accepts them.
+static const char *kMatchingCorpus[] = {
+    "The quick brown fox jumps over the lazy dog.",
+    "SPHINX OF BLACK QUARTZ, JUDGE MY VOW!",
+    "0123456789 +-*/=<>()[]{} #$%&@ ~^_|\\ '\"`;:,.?",
+    // Kerning pairs.
+    "AV AW AY Av Aw Ay LT LV LY PA P. P, Ta Te To Tr Ty Va Ve Vo WA Wa We "
+    "Yo Ya Y. F. r. f' 11",
+    // Ligature candidates.
+    "fi fl ff ffi ffl office affluent",
+    // Latin-1.
+    "caf\xC3\xA9 na\xC3\xAFve r\xC3\xA9sum\xC3\xA9 se\xC3\xB1or \xC3\x9C"
+    "ber Stra\xC3\x9F" "e",
+    "\xC3\x86r\xC3\xB8sk\xC3\xB8" "bing \xC3\x85" "ngstr\xC3\xB6m",
+    "\xC2\xBD \xC3\x97 \xC3\xB7 \xC2\xA9 \xC2\xAE \xC2\xB0 \xC2\xB1 "
+    "\xC2\xA3 \xC2\xA5 \xC2\xA7 \xC2\xAB\xC2\xBB \xC2\xBF\xC2\xA1",
+    // No-break space.
+    "10\xC2\xA0km",
+};
+
+// Runs the simple layout must leave to harfbuzz.
+static const char *kRejectedCorpus[] = {
+    // Soft hyphen.
+    "co\xC2\xAD" "operate",
+    // Control characters.
+    "tab\tstop",
+    "line\nbreak",
+    // Hebrew and Arabic.
+    "\xD7\xA9\xD7\x9C\xD7\x95\xD7\x9D",
+    "\xD9\x85\xD8\xB1\xD8\xAD\xD8\xA8\xD8\xA7",
+    // Cyrillic, Greek, Japanese.
+    "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82",
+    "\xCE\x9A\xCE\xB1\xCE\xBB\xCE\xB7\xCE\xBC\xCE\xAD\xCF\x81\xCE\xB1",
+    "\xE3\x81\x93\xE3\x82\x93\xE3\x81\xAB\xE3\x81\xA1\xE3\x81\xAF",
+    // Characters beyond Latin-1.
+    "caf\xC3\xA9 \xE2\x80\x94 \xE2\x82\xAC",
+};
+
+class SimpleLayoutTest {
+ public:
+  SimpleLayoutTest() : failures_(0), simple_layouts_(0) {}
+
+  bool Run(const char *font_name) {
+    if (!font_manager_.Open(font_name) ||
+        !font_manager_.SelectFont(font_name)) {
+      fplbase::LogError("Can't open %s\n", font_name);
+      return false;
+    }
+    for (auto ysize : kTestSizes) {
+      font_manager_.SetFaceSize(font_manager_.current_face_, ysize);
+
+      font_manager_.SetLayoutDirection(TextLayoutDirectionLTR);
+      font_manager_.SetScript("Latn");
+      for (auto text : kMatchingCorpus) {
+        CheckMatch(font_name, ysize, text);
+      }
+      for (auto text : kRejectedCorpus) {
+        CheckRejected(font_name, ysize, text, "script");
+      }
+
+      // Latin text is shaped by harfbuzz in other directions and scripts.
+      font_manager_.SetLayoutDirection(TextLayoutDirectionRTL);
+      CheckRejected(font_name, ysize, kMatchingCorpus[0], "RTL");
+      font_manager_.SetLayoutDirection(TextLayoutDirectionLTR);
+      font_manager_.SetScript("Arab");
+      CheckRejected(font_name, ysize, kMatchingCorpus[0], "Arab");
+      font_manager_.SetScript("Latn");
+    }
+    return true;
+  }
+
+  int32_t failures() const { return failures_; }
+  int32_t simple_layouts() const { return simple_layouts_; }
+
+ private:
+  void CheckMatch(const char *font_name, int32_t ysize, const char *text) {
+    auto length = strlen(text);
+    uint32_t width;
+    if (!font_manager_.LayoutSimpleText(text, length, &width)) {
+      return;
+    }
+    simple_layouts_++;
+    if (!font_manager_.MatchesShapedText(text, length)) {
+      fplbase::LogError("%s@%d: simple layout differs from harfbuzz: '%s'\n",
+                        font_name, ysize, text);
+      failures_++;
+    }
+  }
+
+  void CheckRejected(const char *font_name, int32_t ysize, const char *text,
+                     const char *reason) {
+    uint32_t width;
+    if (font_manager_.LayoutSimpleText(text, strlen(text), &width)) {
+      fplbase::LogError("%s@%d: simple layout accepted (%s): '%s'\n",
+                        font_name, ysize, reason, text);
+      failures_++;
+    }
+  }
+
+  FontManager font_manager_;
+  int32_t failures_;
+  int32_t simple_layouts_;
+};
+
+}  // namespace flatui
+
+extern "C" int FPL_main(int argc, char **argv) {
+  // Set the local directory to the assets for this test.
+  if (!fplbase::ChangeToUpstreamDir(argv[0], "test/assets")) {
+    fplbase::LogError("Can't find test/assets\n");
+    return 1;
+  }
+
+  flatui::SimpleLayoutTest test;
+  static const char *kDefaultFonts[] = {"fonts/NotoSansCJKjp-Bold.otf"};
+  auto fonts = argc > 1 ? const_cast<const char **>(argv + 1) : kDefaultFonts;
+  auto num_fonts = argc > 1 ? argc - 1 : 1;
+  for (auto i = 0; i < num_fonts; ++i) {
+    if (!test.Run(fonts[i])) {
+      return 1;
+    }
+  }
+
+  // A corpus that never takes the simple path doesn't check anything.
+  fplbase::LogInfo("%d simple layouts checked, %d failures\n",
+                   test.simple_layouts(), test.failures());
+  return test.failures() || !test.simple_layouts() ? 1 : 0;
+}